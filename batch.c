@@ -0,0 +1,266 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "memory.h"
+#include "source.h"
+#include "vm.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+typedef struct {
+    const char* path;
+    char* output; // Everything the script printed, results and errors alike
+    size_t outputLength;
+    int status;   // The exit code clox would have given for this file alone
+} BatchTask;
+
+typedef struct {
+    BatchTask* tasks;
+    int count;
+    int next; // Index of the next task to hand out
+    Backend backend;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t lock;
+#endif
+} Batch;
+
+/**
+ * Appends a path to a growable array of paths.
+ *
+ * @param paths the array of paths
+ * @param count the number of paths in the array
+ * @param capacity the capacity of the array
+ * @param path the path to append, which need not be null-terminated
+ * @param length the length of the path
+ */
+static void addPath(char*** paths, int* count, int* capacity,
+                    const char* path, size_t length) {
+    if (*capacity < *count + 1) {
+        int oldCapacity = *capacity;
+        *capacity = GROW_CAPACITY(oldCapacity);
+        *paths = GROW_ARRAY(char*, *paths, oldCapacity, *capacity,
+                            MEMORY_OTHER);
+    }
+
+    char* copy = (char*)reallocate(NULL, 0, length + 1, MEMORY_OTHER);
+    memcpy(copy, path, length);
+    copy[length] = '\0';
+    (*paths)[(*count)++] = copy;
+}
+
+/**
+ * Frees an array of paths built by addPath().
+ *
+ * @param paths the array of paths
+ * @param count the number of paths in the array
+ * @param capacity the capacity of the array
+ */
+static void freePaths(char** paths, int count, int capacity) {
+    for (int i = 0; i < count; i++) {
+        FREE_ARRAY(char, paths[i], strlen(paths[i]) + 1, MEMORY_OTHER);
+    }
+    FREE_ARRAY(char*, paths, capacity, MEMORY_OTHER);
+}
+
+/**
+ * Appends every path listed in a manifest to a growable array of paths.
+ *
+ * @param manifest the path to the manifest, one script path per line
+ * @param paths the array of paths
+ * @param count the number of paths in the array
+ * @param capacity the capacity of the array
+ * @return true if the manifest could be read, false otherwise
+ *
+ * Blank lines are skipped and a trailing carriage return is ignored, so
+ * manifests written on Windows work as well.
+ */
+static bool readManifest(const char* manifest, char*** paths, int* count,
+                         int* capacity) {
+    SourceFile file;
+    if (!openSource(manifest, &file, stderr)) return false;
+
+    const char* line = file.source;
+    const char* end = file.source + file.length;
+    while (line < end) {
+        const char* lineEnd = memchr(line, '\n', end - line);
+        if (lineEnd == NULL) lineEnd = end;
+
+        size_t length = lineEnd - line;
+        if (length > 0 && line[length - 1] == '\r') length--;
+        if (length > 0) addPath(paths, count, capacity, line, length);
+
+        line = lineEnd + 1;
+    }
+
+    closeSource(&file);
+    return true;
+}
+
+/**
+ * Runs a single script of the batch on a worker's virtual machine.
+ *
+ * @param vm the worker's virtual machine
+ * @param task the script to run
+ *
+ * The script's output is captured in memory so that it can be printed in input
+ * order once every worker is done.
+ */
+static void runTask(VM* vm, BatchTask* task) {
+    FILE* capture = open_memstream(&task->output, &task->outputLength);
+    if (capture == NULL) {
+        task->output = NULL;
+        task->outputLength = 0;
+        capture = stderr;
+    }
+    vm->out = capture;
+    vm->err = capture;
+
+    SourceFile file;
+    if (!openSource(task->path, &file, capture)) {
+        task->status = 74;
+    } else {
+        InterpretResult result = interpretN(vm, file.source, file.length);
+        closeSource(&file);
+
+        task->status = result == INTERPRET_COMPILE_ERROR ? 65
+                     : result == INTERPRET_RUNTIME_ERROR ? 70
+                     : 0;
+    }
+
+    if (capture != stderr) fclose(capture);
+}
+
+/**
+ * Hands out the next task of the batch.
+ *
+ * @param batch the batch to take the task from
+ * @return the task, or NULL when every task has been taken
+ */
+static BatchTask* nextTask(Batch* batch) {
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&batch->lock);
+#endif
+    BatchTask* task = NULL;
+    if (batch->next < batch->count) task = &batch->tasks[batch->next++];
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&batch->lock);
+#endif
+    return task;
+}
+
+/**
+ * Runs tasks from the batch until there are none left.
+ *
+ * @param context the Batch to work on
+ * @return NULL
+ *
+ * Each worker owns its own virtual machine, and every call to interpretN()
+ * builds its own parser and scanner, so workers share nothing but the batch.
+ * Each script is compiled and run out of the worker's arena.
+ */
+static void* work(void* context) {
+    Batch* batch = (Batch*)context;
+    Arena arena;
+    initArena(&arena);
+    VM vm;
+    initVM(&vm);
+    vm.arena = &arena;
+    vm.backend = batch->backend;
+
+    BatchTask* task;
+    while ((task = nextTask(batch)) != NULL) {
+        runTask(&vm, task);
+    }
+
+    freeVM(&vm);
+    freeArena(&arena);
+    return NULL;
+}
+
+/**
+ * Runs many scripts on a pool of worker threads.
+ *
+ * @param args the scripts to run; an argument starting with '@' names a
+ *             manifest listing one script path per line
+ * @param count the number of arguments
+ * @param jobs the number of worker threads, or 0 for one per online processor
+ * @param backend the backend to run the scripts on
+ * @return 0 if every script succeeded, otherwise the exit code of the first
+ *         script that failed
+ *
+ * Once every worker is done, each script's output is printed in input order
+ * followed by a "path: status" line, where the status is the exit code clox
+ * would have given for that file on its own.
+ */
+int runBatch(const char* args[], int count, int jobs, Backend backend) {
+    char** paths = NULL;
+    int pathCount = 0;
+    int pathCapacity = 0;
+    for (int i = 0; i < count; i++) {
+        if (args[i][0] == '@') {
+            if (!readManifest(args[i] + 1, &paths, &pathCount, &pathCapacity)) {
+                freePaths(paths, pathCount, pathCapacity);
+                return 74;
+            }
+        } else {
+            addPath(&paths, &pathCount, &pathCapacity, args[i], strlen(args[i]));
+        }
+    }
+
+    Batch batch;
+    batch.tasks = GROW_ARRAY(BatchTask, NULL, 0, pathCount, MEMORY_OTHER);
+    batch.count = pathCount;
+    batch.next = 0;
+    batch.backend = backend;
+    for (int i = 0; i < pathCount; i++) {
+        batch.tasks[i] = (BatchTask){paths[i], NULL, 0, 0};
+    }
+
+#ifdef HAVE_PTHREADS
+    if (jobs <= 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = processors > 0 ? (int)processors : 1;
+    }
+    if (jobs > pathCount) jobs = pathCount;
+
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_t* workers = GROW_ARRAY(pthread_t, NULL, 0, jobs, MEMORY_OTHER);
+    int started = 0;
+    while (started < jobs &&
+           pthread_create(&workers[started], NULL, work, &batch) == 0) {
+        started++;
+    }
+    // If no thread could be started, the main thread does the work itself.
+    if (started == 0) work(&batch);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    FREE_ARRAY(pthread_t, workers, jobs, MEMORY_OTHER);
+    pthread_mutex_destroy(&batch.lock);
+#else
+    (void)jobs;
+    work(&batch);
+#endif
+
+    int status = 0;
+    for (int i = 0; i < pathCount; i++) {
+        BatchTask* task = &batch.tasks[i];
+        if (task->output != NULL) {
+            fwrite(task->output, sizeof(char), task->outputLength, stdout);
+            free(task->output);
+        }
+        printf("%s: %d\n", task->path, task->status);
+        if (status == 0) status = task->status;
+    }
+
+    freePaths(paths, pathCount, pathCapacity);
+    FREE_ARRAY(BatchTask, batch.tasks, pathCount, MEMORY_OTHER);
+    return status;
+}
\ No newline at end of file
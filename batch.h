@@ -0,0 +1,9 @@
+#ifndef clox_batch_h
+#define clox_batch_h
+
+#include "common.h"
+#include "vm.h"
+
+int runBatch(const char* args[], int count, int jobs, Backend backend);
+
+#endif
\ No newline at end of file
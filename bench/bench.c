@@ -0,0 +1,489 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "chunk.h"
+#include "columns.h"
+#include "compiler.h"
+#include "memory.h"
+#include "optimizer.h"
+#include "registers.h"
+#include "scanner.h"
+#include "vm.h"
+
+// How long each measurement is repeated for, at the least
+#define MIN_SECONDS 0.25
+#define MIN_RUNS 3
+
+// How many rows the columns workload evaluates its predicate over
+#define COLUMN_ROWS (1 << 20)
+#define COLUMN_INPUTS 3
+
+// A generated program. The source is what the compiler is timed on; the
+// chunk is the same program compiled without constant folding, which is what
+// the interpreter loops are timed on, since the folded chunk is a single
+// constant.
+typedef struct {
+    char* text;
+    size_t length;
+    size_t capacity;
+    Chunk chunk;
+    Chunk registers; // The chunk translated for the register backend
+    uint32_t seed;   // State of the generator's random numbers
+} Workload;
+
+// What is timed on a workload
+typedef enum {
+    MODE_PROGRAM, // Compiling, translating and both backends
+    MODE_SCAN,    // Only the scanner; the text is not a program
+    MODE_COLUMNS, // Evaluating the text over rows of inputs
+} WorkloadMode;
+
+typedef struct {
+    const char* name;
+    void (*generate)(Workload* workload);
+    WorkloadMode mode;
+} WorkloadKind;
+
+// The inputs and program of the columns workload
+typedef struct {
+    VM vm;
+    Program program;
+    double* columns[COLUMN_INPUTS];
+    Value* results;
+} ColumnBench;
+
+/**
+ * Returns the current time in seconds, from a monotonic clock.
+ */
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+/**
+ * Returns the next number of a fixed pseudo-random sequence, so that every
+ * run of the suite generates the same programs.
+ */
+static uint32_t nextRandom(Workload* workload) {
+    workload->seed = workload->seed * 1664525u + 1013904223u;
+    return workload->seed >> 8;
+}
+
+/**
+ * Appends formatted text to a workload's source.
+ */
+static void appendText(Workload* workload, const char* format, ...) {
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        size_t space = workload->capacity - workload->length;
+        int written = vsnprintf(workload->text + workload->length, space,
+                                format, args);
+        va_end(args);
+
+        if ((size_t)written < space) {
+            workload->length += (size_t)written;
+            return;
+        }
+
+        int oldCapacity = (int)workload->capacity;
+        workload->capacity = GROW_CAPACITY(workload->capacity) + written;
+        workload->text = GROW_ARRAY(char, workload->text, oldCapacity,
+                                    workload->capacity, MEMORY_OTHER);
+    }
+}
+
+/**
+ * Appends a number literal to the source and its constant to the chunk.
+ */
+static void emitNumber(Workload* workload, double value) {
+    appendText(workload, "%.17g", value);
+
+    int constant = addConstant(&workload->chunk, NUMBER_VAL(value));
+    if (constant <= UINT8_MAX) {
+        writeChunk(&workload->chunk, OP_CONSTANT, 1);
+        writeChunk(&workload->chunk, (uint8_t)constant, 1);
+    } else {
+        writeChunk(&workload->chunk, OP_CONSTANT_LONG, 1);
+        writeChunk(&workload->chunk, (uint8_t)(constant & 0xff), 1);
+        writeChunk(&workload->chunk, (uint8_t)((constant >> 8) & 0xff), 1);
+        writeChunk(&workload->chunk, (uint8_t)((constant >> 16) & 0xff), 1);
+    }
+}
+
+/**
+ * Appends a balanced tree of arithmetic operators of the given depth.
+ */
+static void arithmeticTree(Workload* workload, int depth) {
+    if (depth == 0) {
+        emitNumber(workload, (double)(nextRandom(workload) % 9 + 1));
+        return;
+    }
+
+    static const char* symbols[] = {"+", "-", "*", "/"};
+    static const OpCode ops[] = {OP_ADD, OP_SUBTRACT, OP_MULTIPLY, OP_DIVIDE};
+    int op = (int)(nextRandom(workload) % 4);
+
+    appendText(workload, "(");
+    arithmeticTree(workload, depth - 1);
+    appendText(workload, " %s ", symbols[op]);
+    arithmeticTree(workload, depth - 1);
+    appendText(workload, ")");
+    writeChunk(&workload->chunk, ops[op], 1);
+}
+
+/**
+ * Deep arithmetic: a balanced expression of 2^16 number literals.
+ */
+static void generateArithmetic(Workload* workload) {
+    arithmeticTree(workload, 16);
+}
+
+/**
+ * Comparison chains: 20000 numeric comparisons joined by == and !=.
+ */
+static void generateComparisons(Workload* workload) {
+    static const char* symbols[] = {"<", ">", "<=", ">="};
+
+    bool equal = true;
+    for (int i = 0; i < 20000; i++) {
+        if (i > 0) appendText(workload, equal ? " == " : " != ");
+
+        int op = (int)(nextRandom(workload) % 4);
+        appendText(workload, "(");
+        emitNumber(workload, (double)(nextRandom(workload) % 100));
+        appendText(workload, " %s ", symbols[op]);
+        emitNumber(workload, (double)(nextRandom(workload) % 100));
+        appendText(workload, ")");
+
+        // <= and >= compile to the negation of > and <
+        switch (op) {
+            case 0: writeChunk(&workload->chunk, OP_LESS, 1); break;
+            case 1: writeChunk(&workload->chunk, OP_GREATER, 1); break;
+            case 2:
+                writeChunk(&workload->chunk, OP_GREATER, 1);
+                writeChunk(&workload->chunk, OP_NOT, 1);
+                break;
+            case 3:
+                writeChunk(&workload->chunk, OP_LESS, 1);
+                writeChunk(&workload->chunk, OP_NOT, 1);
+                break;
+        }
+
+        if (i > 0) {
+            writeChunk(&workload->chunk, equal ? OP_EQUAL : OP_NOT_EQUAL, 1);
+        }
+        equal = nextRandom(workload) % 2 == 0;
+    }
+}
+
+/**
+ * Huge literal table: the sum of 50000 distinct number literals, enough to
+ * need OP_CONSTANT_LONG for most of them.
+ */
+static void generateLiterals(Workload* workload) {
+    for (int i = 0; i < 50000; i++) {
+        if (i > 0) appendText(workload, " + ");
+        emitNumber(workload, i + 0.5);
+        if (i > 0) writeChunk(&workload->chunk, OP_ADD, 1);
+    }
+}
+
+/**
+ * Scanner only: 8 MiB of mixed tokens, blanks, comments and strings.
+ */
+static void generateScannerText(Workload* workload) {
+    static const char* pieces[] = {
+        "12345.678 ", "(", ")", " + ", " - ", " * ", " / ", " <= ", " != ",
+        "identifier_name ", "and ", "while ", "\"a string literal\" ",
+        "// a comment running to the end of the line\n", "\n    ", "\t",
+    };
+    int pieceCount = (int)(sizeof(pieces) / sizeof(pieces[0]));
+
+    while (workload->length < 8 * 1024 * 1024) {
+        appendText(workload, "%s", pieces[nextRandom(workload) % pieceCount]);
+    }
+}
+
+/**
+ * Generates the predicate the columns workload evaluates on every row, the
+ * kind of filter a query engine runs over each record.
+ */
+static void generatePredicate(Workload* workload) {
+    appendText(workload, "($0 * 2 + $1 > 10) == ($2 - $0 <= 0.5 * $1)");
+}
+
+/**
+ * Counts the instructions of a chunk, which is also how many are executed
+ * since the code has no jumps.
+ */
+static int countInstructions(Chunk* chunk) {
+    int count = 0;
+    for (int offset = 0; offset < chunk->count;) {
+        offset += instructionLength(chunk->code[offset]);
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Times a function of a workload by repeating it until at least MIN_SECONDS
+ * and MIN_RUNS have passed.
+ *
+ * @return the mean time of one run in seconds
+ */
+static double timeRuns(void (*run)(Workload*, void*), Workload* workload,
+                       void* context, int* runs) {
+    int count = 0;
+    double start = now();
+    double elapsed;
+    do {
+        run(workload, context);
+        count++;
+        elapsed = now() - start;
+    } while (elapsed < MIN_SECONDS || count < MIN_RUNS);
+
+    *runs = count;
+    return elapsed / count;
+}
+
+static void runCompile(Workload* workload, void* context) {
+    Chunk chunk;
+    initChunk(&chunk);
+    if (!compile(workload->text, workload->length, &chunk, (FILE*)context)) {
+        fprintf(stderr, "Benchmark program failed to compile.\n");
+        exit(70);
+    }
+    freeChunk(&chunk);
+}
+
+static void runExecute(Workload* workload, void* context) {
+    interpretChunk((VM*)context, &workload->chunk);
+}
+
+static void runTranslate(Workload* workload, void* context) {
+    (void)context;
+    Chunk registers;
+    initChunk(&registers);
+    if (!translateRegisters(&workload->chunk, &registers)) {
+        fprintf(stderr, "Benchmark program failed to translate.\n");
+        exit(70);
+    }
+    freeChunk(&registers);
+}
+
+static void runRegisterCode(Workload* workload, void* context) {
+    interpretRegisters((VM*)context, &workload->registers);
+}
+
+static void runScanner(Workload* workload, void* context) {
+    Scanner scanner;
+    initScannerN(&scanner, workload->text, workload->length);
+    int* tokens = (int*)context;
+    *tokens = 0;
+    for (;;) {
+        Token token = scanToken(&scanner);
+        if (token.type == TOKEN_EOF) break;
+        (*tokens)++;
+    }
+    freeScanner(&scanner);
+}
+
+static void runTokenize(Workload* workload, void* context) {
+    TokenBuffer* tokens = (TokenBuffer*)context;
+    tokenize(tokens, workload->text, workload->length);
+}
+
+static void runRows(Workload* workload, void* context) {
+    (void)workload;
+    ColumnBench* bench = (ColumnBench*)context;
+    for (size_t i = 0; i < COLUMN_ROWS; i++) {
+        Value inputs[COLUMN_INPUTS];
+        for (int j = 0; j < COLUMN_INPUTS; j++) {
+            inputs[j] = NUMBER_VAL(bench->columns[j][i]);
+        }
+        evaluate(&bench->vm, &bench->program, inputs, COLUMN_INPUTS,
+                 &bench->results[i]);
+    }
+}
+
+static void runColumns(Workload* workload, void* context) {
+    (void)workload;
+    ColumnBench* bench = (ColumnBench*)context;
+    evaluateColumns(&bench->vm, &bench->program,
+                    (const double* const*)bench->columns, COLUMN_INPUTS,
+                    COLUMN_ROWS, bench->results);
+}
+
+/**
+ * Times the columns workload: its predicate evaluated a row at a time on
+ * each backend, and then a batch of rows at a time with evaluateColumns().
+ */
+static void runColumnWorkload(const WorkloadKind* kind, Workload* workload,
+                              FILE* sink) {
+    ColumnBench bench;
+    initVM(&bench.vm);
+    if (!compileProgram(&bench.program, workload->text, workload->length,
+                        sink)) {
+        fprintf(stderr, "Benchmark program failed to compile.\n");
+        exit(70);
+    }
+    for (int j = 0; j < COLUMN_INPUTS; j++) {
+        bench.columns[j] = GROW_ARRAY(double, NULL, 0, COLUMN_ROWS,
+                                      MEMORY_OTHER);
+        for (size_t i = 0; i < COLUMN_ROWS; i++) {
+            bench.columns[j][i] = (double)(nextRandom(workload) % 2000) / 100;
+        }
+    }
+    bench.results = GROW_ARRAY(Value, NULL, 0, COLUMN_ROWS, MEMORY_OTHER);
+
+    int runs;
+    double stackSeconds = timeRuns(runRows, workload, &bench, &runs);
+    bench.vm.backend = BACKEND_REGISTER;
+    double registerSeconds = timeRuns(runRows, workload, &bench, &runs);
+    bench.vm.backend = BACKEND_JIT;
+    double jitSeconds = timeRuns(runRows, workload, &bench, &runs);
+    bench.vm.backend = BACKEND_STACK;
+    double columnSeconds = timeRuns(runColumns, workload, &bench, &runs);
+
+    printf("%-12s %8d rows %10s %10.3f ms %12.0f rows/s\n", kind->name,
+           COLUMN_ROWS, "stack", stackSeconds * 1e3,
+           COLUMN_ROWS / stackSeconds);
+    printf("%-12s %12s %10s %10.3f ms %12.0f rows/s\n", "", "", "registers",
+           registerSeconds * 1e3, COLUMN_ROWS / registerSeconds);
+    printf("%-12s %12s %10s %10.3f ms %12.0f rows/s\n", "", "", "jit",
+           jitSeconds * 1e3, COLUMN_ROWS / jitSeconds);
+    printf("%-12s %12s %10s %10.3f ms %12.0f rows/s\n", "", "", "columns",
+           columnSeconds * 1e3, COLUMN_ROWS / columnSeconds);
+
+    FREE_ARRAY(Value, bench.results, COLUMN_ROWS, MEMORY_OTHER);
+    for (int j = 0; j < COLUMN_INPUTS; j++) {
+        FREE_ARRAY(double, bench.columns[j], COLUMN_ROWS, MEMORY_OTHER);
+    }
+    freeProgram(&bench.program);
+    freeVM(&bench.vm);
+}
+
+/**
+ * Generates, runs and reports one workload.
+ */
+static void runWorkload(const WorkloadKind* kind, FILE* sink) {
+    Workload workload;
+    workload.text = NULL;
+    workload.length = 0;
+    workload.capacity = 0;
+    workload.seed = 12345;
+    initChunk(&workload.chunk);
+    initChunk(&workload.registers);
+    appendText(&workload, "");
+    kind->generate(&workload);
+
+    resetMemoryPeaks();
+    int runs;
+    double megabytes = (double)workload.length / (1024 * 1024);
+
+    if (kind->mode == MODE_COLUMNS) {
+        runColumnWorkload(kind, &workload, sink);
+    } else if (kind->mode == MODE_SCAN) {
+        int tokens = 0;
+        double seconds = timeRuns(runScanner, &workload, &tokens, &runs);
+        printf("%-12s %8.2f MiB %10s %10.2f ms %12.0f tokens/s %8.1f MiB/s\n",
+               kind->name, megabytes, "scan", seconds * 1e3, tokens / seconds,
+               megabytes / seconds);
+
+        // Reuses one buffer, as a caller tokenizing many sources would
+        TokenBuffer buffer;
+        initTokenBuffer(&buffer);
+        seconds = timeRuns(runTokenize, &workload, &buffer, &runs);
+        printf("%-12s %12s %10s %10.2f ms %12.0f tokens/s %8.1f MiB/s\n",
+               "", "", "tokenize", seconds * 1e3, tokens / seconds,
+               megabytes / seconds);
+        freeTokenBuffer(&buffer);
+    } else {
+        writeChunk(&workload.chunk, OP_RETURN, 1);
+        optimizeChunk(&workload.chunk);
+        workload.chunk.maxStack = measureStack(&workload.chunk);
+        int instructions = countInstructions(&workload.chunk);
+
+        double compileSeconds = timeRuns(runCompile, &workload, sink, &runs);
+        double translateSeconds = timeRuns(runTranslate, &workload, NULL,
+                                           &runs);
+        translateRegisters(&workload.chunk, &workload.registers);
+
+        VM vm;
+        initVM(&vm);
+        vm.out = sink;
+        double stackSeconds = timeRuns(runExecute, &workload, &vm, &runs);
+        double registerSeconds = timeRuns(runRegisterCode, &workload, &vm,
+                                          &runs);
+        freeVM(&vm);
+
+        // Both backends are credited with the stack instructions of the
+        // workload, so their ops/s compare the same amount of work
+        printf("%-12s %8.2f MiB %10s %10.3f ms\n", kind->name, megabytes,
+               "compile", compileSeconds * 1e3);
+        printf("%-12s %12s %10s %10.3f ms\n", "", "", "translate",
+               translateSeconds * 1e3);
+        printf("%-12s %12s %10s %10.3f ms %12.0f ops/s\n", "", "",
+               "stack", stackSeconds * 1e3, instructions / stackSeconds);
+        printf("%-12s %12s %10s %10.3f ms %12.0f ops/s\n", "", "",
+               "registers", registerSeconds * 1e3,
+               instructions / registerSeconds);
+    }
+
+    MemoryStats stats;
+    getMemoryStats(&stats);
+    printf("%-12s %12s %10s %10.2f MiB peak\n", "", "", "memory",
+           (double)stats.total.peakBytes / (1024 * 1024));
+
+    freeChunk(&workload.chunk);
+    freeChunk(&workload.registers);
+    FREE_ARRAY(char, workload.text, workload.capacity, MEMORY_OTHER);
+}
+
+static const WorkloadKind workloads[] = {
+    {"arithmetic",  generateArithmetic,  MODE_PROGRAM},
+    {"comparisons", generateComparisons, MODE_PROGRAM},
+    {"literals",    generateLiterals,    MODE_PROGRAM},
+    {"scanner",     generateScannerText, MODE_SCAN},
+    {"columns",     generatePredicate,   MODE_COLUMNS},
+};
+
+/**
+ * Runs the benchmark suite, or only the workloads named on the command line.
+ *
+ * The register backend is timed on code translated once up front, and the
+ * translation is reported on its own line. Memory peaks are
+ * the bytes requested through reallocate() while the workload ran, not
+ * counting its generated text and chunk.
+ */
+int main(int argc, const char* argv[]) {
+    enableMemoryStats();
+    FILE* sink = fopen("/dev/null", "w");
+    if (sink == NULL) {
+        fprintf(stderr, "Could not open /dev/null.\n");
+        return 74;
+    }
+
+    int workloadCount = (int)(sizeof(workloads) / sizeof(workloads[0]));
+    for (int i = 0; i < workloadCount; i++) {
+        bool selected = argc == 1;
+        for (int j = 1; j < argc; j++) {
+            if (strcmp(argv[j], workloads[i].name) == 0) selected = true;
+        }
+        if (selected) runWorkload(&workloads[i], sink);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("max resident set size: %ld KiB\n", usage.ru_maxrss);
+
+    fclose(sink);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,875 @@
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "columns.h"
+#include "compiler.h"
+#include "memory.h"
+#include "vm.h"
+
+// How many programs are generated, and the deepest their trees may be
+#define DEFAULT_PROGRAMS 1000
+#define MAX_DEPTH 6
+#define MAX_NODES (1 << (MAX_DEPTH + 1))
+
+// Every program is evaluated on each row of inputs. The first NUMERIC_ROWS
+// rows hold only numbers, so the columns mode can evaluate them too.
+#define ROWS 16
+#define NUMERIC_ROWS 8
+#define MAX_INPUTS 4
+
+// What a run may write to the output and error streams, at the most
+#define OUTPUT_MAX 128
+
+// How each mode is timed: the best of TIMING_ROUNDS rounds, each of which
+// evaluates the whole corpus for at least ROUND_SECONDS
+#define TIMING_ROUNDS 5
+#define ROUND_SECONDS 0.05
+
+// How much slower than its last recorded time a mode may get
+#define DEFAULT_THRESHOLD 25.0
+
+// A node of a generated expression
+typedef enum {
+    NODE_NUMBER,
+    NODE_INPUT,
+    NODE_TRUE,
+    NODE_FALSE,
+    NODE_NIL,
+    NODE_UNARY,
+    NODE_BINARY,
+} NodeKind;
+
+// How tightly an operator binds, as in compiler.c's Precedence
+typedef enum {
+    LEVEL_EQUALITY,
+    LEVEL_COMPARISON,
+    LEVEL_TERM,
+    LEVEL_FACTOR,
+    LEVEL_UNARY,
+    LEVEL_PRIMARY,
+} Level;
+
+typedef struct {
+    const char* symbol;
+    OpCode op;
+    Level level;
+} Operator;
+
+typedef struct {
+    NodeKind kind;
+    const Operator* operator; // For unary and binary nodes
+    int left;                 // Operand of a unary node, index into nodes
+    int right;
+    int input;                // Which input a NODE_INPUT loads
+    char literal[32];         // Text of a NODE_NUMBER
+} Node;
+
+// What running a program on one row did
+typedef struct {
+    InterpretResult status;
+    Value value;                // Valid when the status is INTERPRET_OK
+    char printed[OUTPUT_MAX];   // What was printed, for modes that print
+    char error[OUTPUT_MAX];     // What was reported on the error stream
+} Outcome;
+
+// A generated program and what its reference chunk computes on each row
+typedef struct {
+    char text[MAX_NODES * 40];
+    int length;
+    int inputCount;
+    Program reference; // Built straight from the tree; neither folded,
+                       // optimized, translated nor quickened
+    Program program;   // Compiled from the text
+    Program plain;     // The same chunks under id 0, so they run unquickened
+    Program tokenized; // Compiled from the text through a token buffer,
+                       // and run as it is
+    Chunk interpreted; // Compiled from the text again, for interpretChunk()
+    Outcome expected[ROWS];
+} Case;
+
+typedef struct {
+    Node nodes[MAX_NODES];
+    int nodeCount;
+    uint32_t seed;
+    Value rows[ROWS][MAX_INPUTS];
+    double columns[MAX_INPUTS][NUMERIC_ROWS];
+    VM vm;
+    FILE* out;
+    FILE* err;
+    char outBuffer[OUTPUT_MAX];
+    char errBuffer[OUTPUT_MAX];
+    bool timing; // Skips capturing output, so it is not what gets timed
+} Fuzzer;
+
+// One way of running a program, checked against the reference chunk
+typedef struct {
+    const char* name;
+    void (*run)(Fuzzer* fuzzer, Case* program, Outcome* outcomes);
+    int rows;     // How many rows it runs: ROWS or NUMERIC_ROWS
+    bool prints;  // Compared by what it prints rather than by value
+} Mode;
+
+static const Operator unaryOperators[] = {
+    {"-", OP_NEGATE, LEVEL_UNARY},
+    {"!", OP_NOT,    LEVEL_UNARY},
+};
+
+static const Operator binaryOperators[] = {
+    {"==", OP_EQUAL,         LEVEL_EQUALITY},
+    {"!=", OP_NOT_EQUAL,     LEVEL_EQUALITY},
+    {"<",  OP_LESS,          LEVEL_COMPARISON},
+    {"<=", OP_LESS_EQUAL,    LEVEL_COMPARISON},
+    {">",  OP_GREATER,       LEVEL_COMPARISON},
+    {">=", OP_GREATER_EQUAL, LEVEL_COMPARISON},
+    {"+",  OP_ADD,           LEVEL_TERM},
+    {"-",  OP_SUBTRACT,      LEVEL_TERM},
+    {"*",  OP_MULTIPLY,      LEVEL_FACTOR},
+    {"/",  OP_DIVIDE,        LEVEL_FACTOR},
+};
+
+/**
+ * Returns the current time in seconds, from a monotonic clock.
+ */
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+/**
+ * Returns the next number of a pseudo-random sequence, so that a seed always
+ * generates the same programs.
+ */
+static uint32_t nextRandom(Fuzzer* fuzzer) {
+    fuzzer->seed = fuzzer->seed * 1664525u + 1013904223u;
+    return fuzzer->seed >> 8;
+}
+
+/**
+ * Writes a number literal of one of the shapes data files are made of.
+ */
+static void generateLiteral(Fuzzer* fuzzer, char* literal, size_t size) {
+    switch (nextRandom(fuzzer) % 6) {
+        case 0:
+            snprintf(literal, size, "%u", nextRandom(fuzzer) % 4);
+            break;
+        case 1:
+            snprintf(literal, size, "%u", nextRandom(fuzzer) % 300);
+            break;
+        case 2:
+            snprintf(literal, size, "%u.%u", nextRandom(fuzzer) % 100,
+                     nextRandom(fuzzer) % 10);
+            break;
+        case 3:
+            snprintf(literal, size, "0.%06u", nextRandom(fuzzer) % 1000000);
+            break;
+        case 4:
+            snprintf(literal, size, "%u%06u.%u", nextRandom(fuzzer),
+                     nextRandom(fuzzer) % 1000000, nextRandom(fuzzer));
+            break;
+        default:
+            snprintf(literal, size, "%.*f", (int)(nextRandom(fuzzer) % 20),
+                     (double)nextRandom(fuzzer) / 4096);
+            break;
+    }
+}
+
+/**
+ * Generates a random expression tree of at most the given depth, using every
+ * prefix and infix rule of the grammar.
+ *
+ * Most trees are well-typed, so that they get far enough to be folded and
+ * specialized; one leaf in sixteen is of any type, and one input in sixteen
+ * may be one the program is not given, so runtime errors are checked too.
+ *
+ * @param number whether the tree should compute a number rather than any
+ *        value
+ * @param inputCount how many inputs the program is evaluated with
+ * @return the index of its root in fuzzer->nodes
+ */
+static int generateNode(Fuzzer* fuzzer, int depth, bool number,
+                        int inputCount) {
+    int index = fuzzer->nodeCount++;
+    Node* node = &fuzzer->nodes[index];
+
+    uint32_t choice = nextRandom(fuzzer) % 10;
+    if (depth == 0 || choice < 3) {
+        uint32_t leaf = nextRandom(fuzzer) % 10;
+        if (nextRandom(fuzzer) % 16 == 0) number = false;
+        if (leaf < 4 || (inputCount == 0 && number)) {
+            node->kind = NODE_NUMBER;
+            generateLiteral(fuzzer, node->literal, sizeof(node->literal));
+        } else if (leaf < 8 || number) {
+            node->kind = NODE_INPUT;
+            int inputs = inputCount;
+            if (inputs == 0 || nextRandom(fuzzer) % 16 == 0) {
+                inputs = MAX_INPUTS;
+            }
+            node->input = (int)(nextRandom(fuzzer) % inputs);
+        } else {
+            static const NodeKind literals[] = {NODE_TRUE, NODE_FALSE,
+                                                NODE_NIL};
+            node->kind = literals[nextRandom(fuzzer) % 3];
+        }
+    } else if (choice < 4) {
+        // '-' takes a number, '!' any value
+        const Operator* operator = &unaryOperators[number ? 0 :
+                                                   nextRandom(fuzzer) % 2];
+        node->kind = NODE_UNARY;
+        node->operator = operator;
+        node->left = generateNode(fuzzer, depth - 1,
+                                  operator->op == OP_NEGATE, inputCount);
+    } else {
+        // Arithmetic comes last in binaryOperators and computes a number;
+        // equality takes any values and the rest take numbers
+        int count = (int)(sizeof(binaryOperators) / sizeof(binaryOperators[0]));
+        int first = number ? count - 4 : 0;
+        const Operator* operator =
+            &binaryOperators[first + nextRandom(fuzzer) % (count - first)];
+        bool operands = operator->level != LEVEL_EQUALITY;
+        node->kind = NODE_BINARY;
+        node->operator = operator;
+        node->left = generateNode(fuzzer, depth - 1, operands, inputCount);
+        node->right = generateNode(fuzzer, depth - 1, operands, inputCount);
+    }
+    return index;
+}
+
+/**
+ * Appends formatted text to a case's source.
+ */
+static void appendText(Case* program, const char* format, const char* text) {
+    int space = (int)sizeof(program->text) - program->length;
+    program->length += snprintf(program->text + program->length, space,
+                                format, text);
+}
+
+/**
+ * Prints a tree as source, with the parentheses its precedence needs and
+ * now and then some it does not.
+ *
+ * @param level how tightly the context binds the node; one that binds more
+ *        loosely is parenthesized
+ */
+static void printNode(Fuzzer* fuzzer, Case* program, int index, Level level) {
+    Node* node = &fuzzer->nodes[index];
+    Level binds = LEVEL_PRIMARY;
+    if (node->kind == NODE_UNARY || node->kind == NODE_BINARY) {
+        binds = node->operator->level;
+    }
+    bool parenthesize = binds < level || nextRandom(fuzzer) % 8 == 0;
+    if (parenthesize) appendText(program, "%s", "(");
+
+    switch (node->kind) {
+        case NODE_NUMBER: appendText(program, "%s", node->literal); break;
+        case NODE_INPUT: {
+            char input[8];
+            snprintf(input, sizeof(input), "$%d", node->input);
+            appendText(program, "%s", input);
+            break;
+        }
+        case NODE_TRUE: appendText(program, "%s", "true"); break;
+        case NODE_FALSE: appendText(program, "%s", "false"); break;
+        case NODE_NIL: appendText(program, "%s", "nil"); break;
+        case NODE_UNARY:
+            appendText(program, "%s", node->operator->symbol);
+            printNode(fuzzer, program, node->left, LEVEL_UNARY);
+            break;
+        case NODE_BINARY:
+            // Binary operators are left-associative
+            printNode(fuzzer, program, node->left, binds);
+            appendText(program, " %s ", node->operator->symbol);
+            printNode(fuzzer, program, node->right, (Level)(binds + 1));
+            break;
+    }
+
+    if (parenthesize) appendText(program, "%s", ")");
+}
+
+/**
+ * Emits a tree as the plainest stack code there is: one instruction per
+ * node, in the order the expression is defined to be evaluated.
+ */
+static void emitNode(Fuzzer* fuzzer, Chunk* chunk, int index) {
+    Node* node = &fuzzer->nodes[index];
+    switch (node->kind) {
+        case NODE_NUMBER: {
+            int constant = addConstant(chunk,
+                                       NUMBER_VAL(strtod(node->literal, NULL)));
+            if (constant <= UINT8_MAX) {
+                writeChunk(chunk, OP_CONSTANT, 1);
+                writeChunk(chunk, (uint8_t)constant, 1);
+            } else {
+                writeChunk(chunk, OP_CONSTANT_LONG, 1);
+                writeChunk(chunk, (uint8_t)(constant & 0xff), 1);
+                writeChunk(chunk, (uint8_t)((constant >> 8) & 0xff), 1);
+                writeChunk(chunk, (uint8_t)((constant >> 16) & 0xff), 1);
+            }
+            break;
+        }
+        case NODE_INPUT:
+            writeChunk(chunk, OP_INPUT, 1);
+            writeChunk(chunk, (uint8_t)node->input, 1);
+            break;
+        case NODE_TRUE: writeChunk(chunk, OP_TRUE, 1); break;
+        case NODE_FALSE: writeChunk(chunk, OP_FALSE, 1); break;
+        case NODE_NIL: writeChunk(chunk, OP_NIL, 1); break;
+        case NODE_UNARY:
+            emitNode(fuzzer, chunk, node->left);
+            writeChunk(chunk, node->operator->op, 1);
+            break;
+        case NODE_BINARY:
+            emitNode(fuzzer, chunk, node->left);
+            emitNode(fuzzer, chunk, node->right);
+            writeChunk(chunk, node->operator->op, 1);
+            break;
+    }
+}
+
+/**
+ * Fills the rows of inputs: the numbers arithmetic trips over, and in the
+ * later rows booleans and nil as well.
+ */
+static void generateRows(Fuzzer* fuzzer) {
+    static const double numbers[] = {0.0, -0.0, 1.0, -1.0, 2.5, 3.0, 1e300,
+                                     -7.25, INFINITY, -INFINITY, NAN};
+    int numberCount = (int)(sizeof(numbers) / sizeof(numbers[0]));
+    for (int i = 0; i < ROWS; i++) {
+        for (int j = 0; j < MAX_INPUTS; j++) {
+            double number = numbers[nextRandom(fuzzer) % numberCount];
+            Value value = NUMBER_VAL(number);
+            if (i >= NUMERIC_ROWS) {
+                switch (nextRandom(fuzzer) % 4) {
+                    case 0: value = BOOL_VAL(true); break;
+                    case 1: value = BOOL_VAL(false); break;
+                    case 2: value = NIL_VAL; break;
+                    default: break;
+                }
+            } else {
+                fuzzer->columns[j][i] = number;
+            }
+            fuzzer->rows[i][j] = value;
+        }
+    }
+}
+
+/**
+ * Starts capturing what a run prints and reports.
+ */
+static void beginCapture(Fuzzer* fuzzer) {
+    if (fuzzer->timing) return;
+    rewind(fuzzer->out);
+    rewind(fuzzer->err);
+}
+
+/**
+ * Copies what a run printed and reported since beginCapture() into an
+ * outcome.
+ */
+static void endCapture(Fuzzer* fuzzer, Outcome* outcome) {
+    if (fuzzer->timing) return;
+    FILE* streams[] = {fuzzer->out, fuzzer->err};
+    const char* buffers[] = {fuzzer->outBuffer, fuzzer->errBuffer};
+    char* texts[] = {outcome->printed, outcome->error};
+    for (int i = 0; i < 2; i++) {
+        fflush(streams[i]);
+        long length = ftell(streams[i]);
+        if (length < 0) length = 0;
+        if (length > OUTPUT_MAX - 1) length = OUTPUT_MAX - 1;
+        memcpy(texts[i], buffers[i], (size_t)length);
+        texts[i][length] = '\0';
+    }
+}
+
+/**
+ * Evaluates a program on each row with the VM's backend.
+ */
+static void evaluateRows(Fuzzer* fuzzer, const Program* program,
+                         int inputCount, Outcome* outcomes) {
+    for (int i = 0; i < ROWS; i++) {
+        beginCapture(fuzzer);
+        outcomes[i].status = evaluate(&fuzzer->vm, program, fuzzer->rows[i],
+                                      inputCount, &outcomes[i].value);
+        endCapture(fuzzer, &outcomes[i]);
+    }
+}
+
+/**
+ * Evaluates the compiled chunk as it is, without quickening it, which is the
+ * baseline the other stack modes are timed against.
+ */
+static void runOnStack(Fuzzer* fuzzer, Case* program, Outcome* outcomes) {
+    fuzzer->vm.backend = BACKEND_STACK;
+    evaluateRows(fuzzer, &program->plain, program->inputCount, outcomes);
+}
+
+/**
+ * Evaluates the compiled chunk from the VM's quickened copy of its code.
+ */
+static void runQuickened(Fuzzer* fuzzer, Case* program, Outcome* outcomes) {
+    fuzzer->vm.backend = BACKEND_STACK;
+    evaluateRows(fuzzer, &program->program, program->inputCount, outcomes);
+}
+
+/**
+ * Evaluates the chunk compileTokenized() made, which checkCase() has already
+ * found to be the same as compile()'s.
+ */
+static void runTokenized(Fuzzer* fuzzer, Case* program, Outcome* outcomes) {
+    fuzzer->vm.backend = BACKEND_STACK;
+    evaluateRows(fuzzer, &program->tokenized, program->inputCount, outcomes);
+}
+
+static void runOnRegisters(Fuzzer* fuzzer, Case* program, Outcome* outcomes) {
+    fuzzer->vm.backend = BACKEND_REGISTER;
+    evaluateRows(fuzzer, &program->program, program->inputCount, outcomes);
+}
+
+static void runOnJit(Fuzzer* fuzzer, Case* program, Outcome* outcomes) {
+    fuzzer->vm.backend = BACKEND_JIT;
+    evaluateRows(fuzzer, &program->program, program->inputCount, outcomes);
+}
+
+/**
+ * Runs a program through interpretChunk(), the path files and the REPL take.
+ * It never quickens, and its time includes printing each result, which
+ * interpretChunk() always does.
+ */
+static void runInterpreted(Fuzzer* fuzzer, Case* program,
+                           Outcome* outcomes) {
+    fuzzer->vm.backend = BACKEND_STACK;
+    for (int i = 0; i < ROWS; i++) {
+        fuzzer->vm.inputs = fuzzer->rows[i];
+        fuzzer->vm.inputCount = program->inputCount;
+        beginCapture(fuzzer);
+        outcomes[i].status = interpretChunk(&fuzzer->vm, &program->interpreted);
+        endCapture(fuzzer, &outcomes[i]);
+    }
+}
+
+/**
+ * Evaluates a program over the numeric rows at once. A runtime error is
+ * reported once for all of them, and since a program has no branches, every
+ * numeric row would have hit the same one.
+ */
+static void runOnColumns(Fuzzer* fuzzer, Case* program, Outcome* outcomes) {
+    const double* inputs[MAX_INPUTS];
+    for (int j = 0; j < MAX_INPUTS; j++) inputs[j] = fuzzer->columns[j];
+    Value results[NUMERIC_ROWS];
+
+    fuzzer->vm.backend = BACKEND_STACK;
+    beginCapture(fuzzer);
+    InterpretResult status = evaluateColumns(&fuzzer->vm, &program->program,
+                                             inputs, program->inputCount,
+                                             NUMERIC_ROWS, results);
+    endCapture(fuzzer, &outcomes[0]);
+    for (int i = 0; i < NUMERIC_ROWS; i++) {
+        outcomes[i].status = status;
+        outcomes[i].value = results[i];
+        if (i == 0) continue;
+        strcpy(outcomes[i].printed, outcomes[0].printed);
+        strcpy(outcomes[i].error, outcomes[0].error);
+    }
+}
+
+static const Mode modes[] = {
+    {"stack",     runOnStack,     ROWS,         false},
+    {"tokens",    runTokenized,   ROWS,         false},
+    {"quickened", runQuickened,   ROWS,         false},
+    {"interpret", runInterpreted, ROWS,         true},
+    {"registers", runOnRegisters, ROWS,         false},
+    {"jit",       runOnJit,       ROWS,         false},
+    {"columns",   runOnColumns,   NUMERIC_ROWS, false},
+};
+
+#define MODE_COUNT ((int)(sizeof(modes) / sizeof(modes[0])))
+
+/**
+ * Generates a program, compiles it every way the modes need, and works out
+ * what the reference chunk computes on each row.
+ *
+ * @return false if the compiler rejected the program, which is always a
+ *         bug since the program follows the grammar
+ */
+static bool generateCase(Fuzzer* fuzzer, Case* program) {
+    program->inputCount = (int)(nextRandom(fuzzer) % (MAX_INPUTS + 1));
+    fuzzer->nodeCount = 0;
+    int root = generateNode(fuzzer, (int)(nextRandom(fuzzer) % MAX_DEPTH) + 1,
+                            nextRandom(fuzzer) % 2 == 0, program->inputCount);
+    program->length = 0;
+    printNode(fuzzer, program, root, LEVEL_EQUALITY);
+
+    Program* reference = &program->reference;
+    initChunk(&reference->chunk);
+    initChunk(&reference->registers);
+    initJit(&reference->jit);
+    reference->id = 0;
+    emitNode(fuzzer, &reference->chunk, root);
+    writeChunk(&reference->chunk, OP_RETURN, 1);
+    reference->chunk.maxStack = measureStack(&reference->chunk);
+
+    Program* tokenized = &program->tokenized;
+    initChunk(&tokenized->chunk);
+    initChunk(&tokenized->registers);
+    initJit(&tokenized->jit);
+    tokenized->id = 0;
+
+    initChunk(&program->interpreted);
+    if (!compileProgram(&program->program, program->text,
+                        (size_t)program->length, fuzzer->err) ||
+        !compileTokenized(program->text, (size_t)program->length,
+                          &tokenized->chunk, fuzzer->err) ||
+        !compile(program->text, (size_t)program->length,
+                 &program->interpreted, fuzzer->err)) {
+        return false;
+    }
+    program->plain = program->program;
+    program->plain.id = 0;
+
+    fuzzer->vm.backend = BACKEND_STACK;
+    evaluateRows(fuzzer, reference, program->inputCount, program->expected);
+    for (int i = 0; i < ROWS; i++) {
+        Outcome* expected = &program->expected[i];
+        if (expected->status != INTERPRET_OK) continue;
+        FILE* printed = fmemopen(expected->printed, OUTPUT_MAX, "w");
+        fprintValue(printed, expected->value);
+        fputc('\n', printed);
+        fclose(printed);
+    }
+    return true;
+}
+
+static void freeCase(Case* program) {
+    freeChunk(&program->reference.chunk);
+    freeProgram(&program->program);
+    freeChunk(&program->tokenized.chunk);
+    freeChunk(&program->interpreted);
+}
+
+/**
+ * Tells whether two results are the same value. Numbers must match bit for
+ * bit, so that a sign of zero lost by folding shows up, except that any NaN
+ * matches any other.
+ */
+static bool sameValue(Value a, Value b) {
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        if (isnan(x) && isnan(y)) return true;
+        return memcmp(&x, &y, sizeof(x)) == 0;
+    }
+    return valuesEqual(a, b);
+}
+
+/**
+ * Checks the outcome of a mode on one row against the reference.
+ */
+static bool sameOutcome(const Mode* mode, const Outcome* expected,
+                        const Outcome* actual) {
+    if (expected->status != actual->status) return false;
+    if (strcmp(expected->error, actual->error) != 0) return false;
+    if (expected->status != INTERPRET_OK) return true;
+    if (!mode->prints) return sameValue(expected->value, actual->value);
+
+    // As with values, a NaN of either sign is as good as any other
+    if (IS_NUMBER(expected->value) && isnan(AS_NUMBER(expected->value))) {
+        return strcmp(actual->printed, "nan\n") == 0 ||
+               strcmp(actual->printed, "-nan\n") == 0;
+    }
+    return strcmp(expected->printed, actual->printed) == 0;
+}
+
+/**
+ * Describes an outcome on one line, for mismatch reports.
+ */
+static void printOutcome(const char* label, const Outcome* outcome) {
+    fprintf(stderr, "  %-9s status %d", label, outcome->status);
+    if (outcome->status == INTERPRET_OK) {
+        fprintf(stderr, " value ");
+        fprintValue(stderr, outcome->value);
+        if (IS_NUMBER(outcome->value)) {
+            fprintf(stderr, " (%a)", AS_NUMBER(outcome->value));
+        }
+    } else {
+        fprintf(stderr, " error %s", outcome->error);
+    }
+    fputc('\n', stderr);
+}
+
+/**
+ * Tells whether two chunks hold the same code, line table, constants and
+ * stack depth.
+ */
+static bool sameChunk(const Chunk* a, const Chunk* b) {
+    if (a->count != b->count || a->lineCount != b->lineCount ||
+        a->constants.count != b->constants.count ||
+        a->maxStack != b->maxStack) {
+        return false;
+    }
+    if (memcmp(a->code, b->code, (size_t)a->count) != 0) return false;
+    for (int i = 0; i < a->lineCount; i++) {
+        if (a->lines[i].offset != b->lines[i].offset ||
+            a->lines[i].line != b->lines[i].line) {
+            return false;
+        }
+    }
+    for (int i = 0; i < a->constants.count; i++) {
+        if (!sameValue(a->constants.values[i], b->constants.values[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Runs every mode on a case and reports the rows where one disagrees with
+ * the reference, after checking that compiling through a token buffer gave
+ * the same chunk as compile().
+ *
+ * @return how many rows disagreed, over all modes, plus one if the chunks
+ *         differed
+ */
+static int checkCase(Fuzzer* fuzzer, Case* program, int reported) {
+    int mismatches = 0;
+    if (!sameChunk(&program->tokenized.chunk, &program->program.chunk)) {
+        if (reported < 10) {
+            fprintf(stderr, "compileTokenized() and compile() differ on: "
+                    "%.*s\n", program->length, program->text);
+        }
+        mismatches++;
+    }
+    for (int m = 0; m < MODE_COUNT; m++) {
+        Outcome outcomes[ROWS];
+        modes[m].run(fuzzer, program, outcomes);
+        for (int i = 0; i < modes[m].rows; i++) {
+            if (sameOutcome(&modes[m], &program->expected[i], &outcomes[i])) {
+                continue;
+            }
+            if (reported + mismatches < 10) {
+                fprintf(stderr, "mismatch in %s on row %d of: %.*s\n",
+                        modes[m].name, i, program->length, program->text);
+                fprintf(stderr, "  inputs   ");
+                for (int j = 0; j < program->inputCount; j++) {
+                    fputc(' ', stderr);
+                    fprintValue(stderr, fuzzer->rows[i][j]);
+                }
+                fputc('\n', stderr);
+                printOutcome("expected", &program->expected[i]);
+                printOutcome("actual", &outcomes[i]);
+            }
+            mismatches++;
+            break;
+        }
+    }
+    return mismatches;
+}
+
+/**
+ * Times a mode over the whole corpus.
+ *
+ * @return the best time of one evaluation of one program on one row, in
+ *         nanoseconds
+ */
+static double timeMode(Fuzzer* fuzzer, const Mode* mode, Case* cases,
+                       int caseCount) {
+    static Outcome outcomes[ROWS];
+    fuzzer->timing = true;
+    double best = INFINITY;
+    for (int round = 0; round < TIMING_ROUNDS; round++) {
+        long evaluations = 0;
+        double start = now();
+        double elapsed;
+        do {
+            for (int i = 0; i < caseCount; i++) {
+                mode->run(fuzzer, &cases[i], outcomes);
+            }
+            evaluations += (long)caseCount * mode->rows;
+            elapsed = now() - start;
+        } while (elapsed < ROUND_SECONDS);
+
+        double nanoseconds = elapsed * 1e9 / (double)evaluations;
+        if (nanoseconds < best) best = nanoseconds;
+    }
+    fuzzer->timing = false;
+    return best;
+}
+
+/**
+ * Finds the last time recorded in a performance history for a mode, on this
+ * host and for this corpus.
+ *
+ * The history has one tab-separated line per measurement: a label naming the
+ * build, the host, the seed and program count of the corpus, the mode, and
+ * its nanoseconds per evaluation. Lines starting with '#' are comments.
+ *
+ * @return the last recorded time, or 0 if there is none
+ */
+static double lastRecorded(const char* path, const char* host, uint32_t seed,
+                           int programs, const char* mode) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return 0;
+
+    double last = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') continue;
+        char label[128], lineHost[128], lineMode[32];
+        unsigned lineSeed;
+        int linePrograms;
+        double nanoseconds;
+        if (sscanf(line, "%127s %127s %u %d %31s %lf", label, lineHost,
+                   &lineSeed, &linePrograms, lineMode, &nanoseconds) != 6) {
+            continue;
+        }
+        if (strcmp(lineHost, host) == 0 && lineSeed == seed &&
+            linePrograms == programs && strcmp(lineMode, mode) == 0) {
+            last = nanoseconds;
+        }
+    }
+    fclose(file);
+    return last;
+}
+
+static int usage(void) {
+    fprintf(stderr,
+            "Usage: clox-fuzz [options]\n"
+            "  --seed=N            generate the programs from seed N\n"
+            "  --programs=N        how many programs to generate\n"
+            "  --history=PATH      compare timings with a performance history\n"
+            "  --record            append the timings to the history\n"
+            "  --label=NAME        what to call this build in the history\n"
+            "  --threshold=PERCENT how much slower a mode may get\n"
+            "  --no-timing         only check that the modes agree\n");
+    return 64;
+}
+
+/**
+ * Generates random programs from the grammar, checks that every way of
+ * running them computes what a plain, unoptimized chunk of the same tree
+ * does, and times each mode.
+ *
+ * The reference chunk is emitted straight from the generated tree and run by
+ * the interpreter without quickening, so constant folding, the peephole
+ * optimizer, inline numbers, number-specialized instructions, quickening,
+ * compiling through a token buffer, the register backend, the JIT and the
+ * columns evaluator are all checked against it, errors included. The value
+ * representation is fixed when clox is built, so NaN boxing is checked by
+ * building with CFLAGS=-DNAN_BOXING.
+ *
+ * With a history, a mode that got more than the threshold slower than its
+ * last recorded time on this host fails the run, as does any mismatch. The
+ * timings are only recorded when the run passes.
+ *
+ * @return 0 if every mode agreed and none regressed, 1 otherwise
+ */
+int main(int argc, const char* argv[]) {
+    uint32_t seed = 1;
+    int programs = DEFAULT_PROGRAMS;
+    const char* history = NULL;
+    const char* label = "unknown";
+    double threshold = DEFAULT_THRESHOLD;
+    bool record = false;
+    bool timing = true;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--seed=", 7) == 0) {
+            seed = (uint32_t)strtoul(arg + 7, NULL, 10);
+        } else if (strncmp(arg, "--programs=", 11) == 0) {
+            programs = atoi(arg + 11);
+            if (programs <= 0) return usage();
+        } else if (strncmp(arg, "--history=", 10) == 0) {
+            history = arg + 10;
+        } else if (strcmp(arg, "--record") == 0) {
+            record = true;
+        } else if (strncmp(arg, "--label=", 8) == 0) {
+            label = arg + 8;
+        } else if (strncmp(arg, "--threshold=", 12) == 0) {
+            threshold = atof(arg + 12);
+        } else if (strcmp(arg, "--no-timing") == 0) {
+            timing = false;
+        } else {
+            return usage();
+        }
+    }
+    if (record && (history == NULL || !timing)) return usage();
+
+    static Fuzzer fuzzer;
+    fuzzer.seed = seed;
+    initVM(&fuzzer.vm);
+    fuzzer.out = fmemopen(fuzzer.outBuffer, OUTPUT_MAX, "w");
+    fuzzer.err = fmemopen(fuzzer.errBuffer, OUTPUT_MAX, "w");
+    if (fuzzer.out == NULL || fuzzer.err == NULL) {
+        fprintf(stderr, "Could not open the output streams.\n");
+        return 74;
+    }
+    fuzzer.vm.out = fuzzer.out;
+    fuzzer.vm.err = fuzzer.err;
+    generateRows(&fuzzer);
+
+    Case* cases = GROW_ARRAY(Case, NULL, 0, programs, MEMORY_OTHER);
+    int mismatches = 0;
+    int errors = 0;
+    for (int i = 0; i < programs; i++) {
+        if (!generateCase(&fuzzer, &cases[i])) {
+            fprintf(stderr, "failed to compile: %.*s\n", cases[i].length,
+                    cases[i].text);
+            mismatches++;
+            continue;
+        }
+        for (int j = 0; j < ROWS; j++) {
+            if (cases[i].expected[j].status != INTERPRET_OK) errors++;
+        }
+        mismatches += checkCase(&fuzzer, &cases[i], mismatches);
+    }
+    printf("%d programs, %d rows each, %.0f%% runtime errors, %d modes: "
+           "%d mismatches\n", programs, ROWS,
+           errors * 100.0 / ((double)programs * ROWS), MODE_COUNT, mismatches);
+
+    char host[128] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    bool regressed = false;
+    double times[MODE_COUNT];
+    for (int m = 0; timing && mismatches == 0 && m < MODE_COUNT; m++) {
+        times[m] = timeMode(&fuzzer, &modes[m], cases, programs);
+        printf("%-12s %10.1f ns/eval", modes[m].name, times[m]);
+
+        double last = history == NULL ? 0 :
+            lastRecorded(history, host, seed, programs, modes[m].name);
+        if (last > 0) {
+            double change = (times[m] / last - 1) * 100;
+            printf(" %+7.1f%%", change);
+            if (change > threshold) {
+                printf("  regressed by more than %.0f%%", threshold);
+                regressed = true;
+            }
+        }
+        printf("\n");
+    }
+
+    if (record && mismatches == 0 && !regressed) {
+        FILE* file = fopen(history, "a");
+        if (file == NULL) {
+            fprintf(stderr, "Could not open \"%s\".\n", history);
+            return 74;
+        }
+        for (int m = 0; m < MODE_COUNT; m++) {
+            fprintf(file, "%s\t%s\t%u\t%d\t%s\t%.1f\n", label, host, seed,
+                    programs, modes[m].name, times[m]);
+        }
+        fclose(file);
+    }
+
+    for (int i = 0; i < programs; i++) freeCase(&cases[i]);
+    FREE_ARRAY(Case, cases, programs, MEMORY_OTHER);
+    freeVM(&fuzzer.vm);
+    fclose(fuzzer.out);
+    fclose(fuzzer.err);
+    return mismatches == 0 && !regressed ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "memory.h"
+
+// Every multi-byte field is stored little-endian, whatever the host order:
+//
+//   "clox" magic, u32 version, u64 source hash
+//   u32 code count, code bytes
+//   u32 line run count, (u32 offset, u32 line) per run
+//   u32 constant count, (u8 tag, payload) per constant
+static const char MAGIC[4] = {'c', 'l', 'o', 'x'};
+
+typedef enum {
+    CONSTANT_BOOL,
+    CONSTANT_NIL,
+    CONSTANT_NUMBER
+} ConstantTag;
+
+/**
+ * Hashes source code with 64-bit FNV-1a.
+ *
+ * @param source the source code to hash
+ * @param length the length of the source code in bytes
+ * @return the hash of the source code
+ */
+uint64_t hashSource(const char* source, size_t length) {
+    uint64_t hash = 14695981039346656037u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)source[i];
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+static void writeU32(FILE* file, uint32_t value) {
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i++) bytes[i] = (uint8_t)(value >> (8 * i));
+    fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+static void writeU64(FILE* file, uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++) bytes[i] = (uint8_t)(value >> (8 * i));
+    fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+static bool readU32(FILE* file, uint32_t* value) {
+    uint8_t bytes[4];
+    if (fread(bytes, 1, sizeof(bytes), file) != sizeof(bytes)) return false;
+    *value = 0;
+    for (int i = 0; i < 4; i++) *value |= (uint32_t)bytes[i] << (8 * i);
+    return true;
+}
+
+static bool readU64(FILE* file, uint64_t* value) {
+    uint8_t bytes[8];
+    if (fread(bytes, 1, sizeof(bytes), file) != sizeof(bytes)) return false;
+    *value = 0;
+    for (int i = 0; i < 8; i++) *value |= (uint64_t)bytes[i] << (8 * i);
+    return true;
+}
+
+/**
+ * Writes a single constant as its tag followed by its payload.
+ *
+ * @param file the file to write to
+ * @param value the constant to write
+ */
+static void writeConstant(FILE* file, Value value) {
+    if (IS_BOOL(value)) {
+        fputc(CONSTANT_BOOL, file);
+        fputc(AS_BOOL(value) ? 1 : 0, file);
+    } else if (IS_NIL(value)) {
+        fputc(CONSTANT_NIL, file);
+    } else {
+        double number = AS_NUMBER(value);
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(double));
+        fputc(CONSTANT_NUMBER, file);
+        writeU64(file, bits);
+    }
+}
+
+/**
+ * Reads a single constant written by writeConstant().
+ *
+ * @param file the file to read from
+ * @param value receives the constant
+ * @return true if a well-formed constant was read
+ */
+static bool readConstant(FILE* file, Value* value) {
+    int tag = fgetc(file);
+    switch (tag) {
+        case CONSTANT_BOOL: {
+            int boolean = fgetc(file);
+            if (boolean == EOF) return false;
+            *value = BOOL_VAL(boolean != 0);
+            return true;
+        }
+        case CONSTANT_NIL:
+            *value = NIL_VAL;
+            return true;
+        case CONSTANT_NUMBER: {
+            uint64_t bits;
+            if (!readU64(file, &bits)) return false;
+            double number;
+            memcpy(&number, &bits, sizeof(double));
+            *value = NUMBER_VAL(number);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * Writes a compiled chunk to a bytecode file.
+ *
+ * @param chunk the chunk to write
+ * @param path the path of the file to create or replace
+ * @param sourceHash the hash of the source the chunk was compiled from
+ * @return true if the whole file was written
+ */
+bool writeBytecode(Chunk* chunk, const char* path, uint64_t sourceHash) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return false;
+
+    fwrite(MAGIC, 1, sizeof(MAGIC), file);
+    writeU32(file, BYTECODE_VERSION);
+    writeU64(file, sourceHash);
+
+    writeU32(file, (uint32_t)chunk->count);
+    fwrite(chunk->code, 1, (size_t)chunk->count, file);
+
+    writeU32(file, (uint32_t)chunk->lineCount);
+    for (int i = 0; i < chunk->lineCount; i++) {
+        writeU32(file, (uint32_t)chunk->lines[i].offset);
+        writeU32(file, (uint32_t)chunk->lines[i].line);
+    }
+
+    writeU32(file, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        writeConstant(file, chunk->constants.values[i]);
+    }
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (!ok) remove(path);
+    return ok;
+}
+
+/**
+ * Checks that every instruction of a loaded chunk can be run safely: its
+ * opcode exists, its operands lie within the code, and any constant it
+ * names is in the pool. The chunk must also end in OP_RETURN, or run()
+ * would go on past the end of the code.
+ *
+ * @param chunk the chunk, with its code and constants read
+ * @return true if the code is well formed
+ */
+static bool checkCode(const Chunk* chunk) {
+    int last = -1;
+    for (int offset = 0; offset < chunk->count;) {
+        uint8_t instruction = chunk->code[offset];
+        if (instruction > OP_RETURN) return false;
+        int length = instructionLength(instruction);
+        if (offset + length > chunk->count) return false;
+
+        const uint8_t* operands = &chunk->code[offset + 1];
+        int constant = -1;
+        switch (instruction) {
+            case OP_CONSTANT:
+            case OP_ADD_CONSTANT:
+            case OP_SUBTRACT_CONSTANT:
+            case OP_MULTIPLY_CONSTANT:
+            case OP_DIVIDE_CONSTANT:
+            case OP_GREATER_CONSTANT:
+            case OP_LESS_CONSTANT:
+                constant = operands[0];
+                break;
+            case OP_CONSTANT_LONG:
+                constant = operands[0] | (operands[1] << 8) |
+                           (operands[2] << 16);
+                break;
+            default:
+                break;
+        }
+        if (constant >= chunk->constants.count) return false;
+
+        last = offset;
+        offset += length;
+    }
+    return last != -1 && chunk->code[last] == OP_RETURN;
+}
+
+/**
+ * Tells how many bytes of a file are left to read.
+ *
+ * @param file the file, which must be seekable
+ * @return the bytes from the current position to the end, or -1 if they
+ *         cannot be told
+ */
+static long remainingBytes(FILE* file) {
+    long position = ftell(file);
+    if (position < 0 || fseek(file, 0, SEEK_END) != 0) return -1;
+    long end = ftell(file);
+    if (fseek(file, position, SEEK_SET) != 0 || end < position) return -1;
+    return end - position;
+}
+
+/**
+ * Reads the body of a bytecode file into an empty chunk.
+ *
+ * Counts are checked against what is left of the file before anything is
+ * allocated for them, so a corrupted count is rejected rather than making
+ * reallocate() exit when it cannot allocate that much.
+ *
+ * @param file the file to read, positioned just after the header
+ * @param chunk the chunk to fill
+ * @return true if the body was well formed
+ */
+static bool readBody(FILE* file, Chunk* chunk) {
+    uint32_t count;
+    if (!readU32(file, &count) || count == 0 || count > INT32_MAX) return false;
+    if ((long)count > remainingBytes(file)) return false;
+    chunk->code = GROW_ARRAY(uint8_t, NULL, 0, count, MEMORY_CODE);
+    chunk->capacity = (int)count;
+    if (fread(chunk->code, 1, count, file) != count) return false;
+    chunk->count = (int)count;
+
+    uint32_t lineCount;
+    if (!readU32(file, &lineCount) || lineCount == 0 || lineCount > count ||
+        (long)lineCount > remainingBytes(file) / 8) {
+        return false;
+    }
+    chunk->lines = GROW_ARRAY(LineStart, NULL, 0, lineCount, MEMORY_LINES);
+    chunk->lineCapacity = (int)lineCount;
+    for (uint32_t i = 0; i < lineCount; i++) {
+        uint32_t offset;
+        uint32_t line;
+        if (!readU32(file, &offset) || !readU32(file, &line)) return false;
+
+        // Runs must start at offset 0 and move strictly forwards
+        int previous = i == 0 ? -1 : chunk->lines[i - 1].offset;
+        if ((i == 0 && offset != 0) || (int)offset <= previous ||
+            offset >= count) {
+            return false;
+        }
+        chunk->lines[i].offset = (int)offset;
+        chunk->lines[i].line = (int)line;
+        chunk->lineCount++;
+    }
+
+    uint32_t constantCount;
+    if (!readU32(file, &constantCount)) return false;
+    for (uint32_t i = 0; i < constantCount; i++) {
+        Value value;
+        if (!readConstant(file, &value)) return false;
+        // The pool was interned when it was written, so every constant
+        // should land in its own slot again
+        if (addConstant(chunk, value) != (int)i) return false;
+    }
+    if (!checkCode(chunk)) return false;
+
+    chunk->maxStack = measureStack(chunk);
+    return chunk->maxStack >= 0;
+}
+
+/**
+ * Loads a chunk from a bytecode file written by writeBytecode().
+ *
+ * The file is rejected if it is malformed, was written by a different
+ * BYTECODE_VERSION or was compiled from a source with a different hash. Its
+ * code is checked as well, so that a corrupted file is recompiled rather
+ * than run.
+ *
+ * @param chunk an initialized, empty chunk that receives the bytecode
+ * @param path the path of the file to read
+ * @param sourceHash the hash of the source the chunk must come from
+ * @return true if the chunk was loaded; otherwise the chunk is left empty
+ */
+bool readBytecode(Chunk* chunk, const char* path, uint64_t sourceHash) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+
+    char magic[sizeof(MAGIC)];
+    uint32_t version;
+    uint64_t hash;
+    bool ok = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+              memcmp(magic, MAGIC, sizeof(MAGIC)) == 0 &&
+              readU32(file, &version) && version == BYTECODE_VERSION &&
+              readU64(file, &hash) && hash == sourceHash &&
+              readBody(file, chunk);
+
+    fclose(file);
+    if (!ok) freeChunk(chunk);
+    return ok;
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef clox_bytecode_h
+#define clox_bytecode_h
+
+#include "chunk.h"
+
+// Bump whenever the opcode set or the file layout changes so that stale
+// caches are ignored instead of being run.
+#define BYTECODE_VERSION 5
+
+uint64_t hashSource(const char* source, size_t length);
+bool writeBytecode(Chunk* chunk, const char* path, uint64_t sourceHash);
+bool readBytecode(Chunk* chunk, const char* path, uint64_t sourceHash);
+
+#endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "memory.h"
@@ -12,8 +13,13 @@ void initChunk(Chunk* chunk) {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
     chunk->lines = NULL;
     initValueArray(&chunk->constants);
+    chunk->constantIndex.capacity = 0;
+    chunk->constantIndex.slots = NULL;
+    chunk->maxStack = 0;
 }
 
 /**
@@ -22,39 +28,407 @@ void initChunk(Chunk* chunk) {
  * @param chunk the chunk to free
  */
 void freeChunk(Chunk* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity, MEMORY_CODE);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity, MEMORY_LINES);
     freeValueArray(&chunk->constants);
+    FREE_ARRAY(int, chunk->constantIndex.slots, chunk->constantIndex.capacity,
+               MEMORY_CONSTANTS);
     initChunk(chunk);
 }
 
+/**
+ * Empties a chunk so it can be compiled into again, keeping every buffer it
+ * has already grown.
+ *
+ * @param chunk the chunk to reset
+ */
+void resetChunk(Chunk* chunk) {
+    truncateChunk(chunk, 0);
+    truncateConstants(chunk, 0);
+    chunk->maxStack = 0;
+}
+
 /**
  * Adds a single byte to the end of a chunk's code.
  *
+ * Lines are run-length encoded: a new LineStart is only recorded when the
+ * byte comes from a different line than the byte before it.
+ *
  * @param chunk the chunk to write to
  * @param byte the byte to write
+ * @param line the source line the byte was compiled from
  */
 void writeChunk(Chunk* chunk, uint8_t byte, int line) {
     if (chunk->capacity < chunk->count + 1) {
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
-        chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
+        chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity,
+                                 MEMORY_CODE);
     }
 
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
+
+    if (chunk->lineCount > 0 &&
+        chunk->lines[chunk->lineCount - 1].line == line) {
+        return;
+    }
+
+    if (chunk->lineCapacity < chunk->lineCount + 1) {
+        int oldCapacity = chunk->lineCapacity;
+        chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->lines = GROW_ARRAY(LineStart, chunk->lines, oldCapacity,
+                                  chunk->lineCapacity, MEMORY_LINES);
+    }
+
+    LineStart* lineStart = &chunk->lines[chunk->lineCount++];
+    lineStart->offset = chunk->count - 1;
+    lineStart->line = line;
+}
+
+/**
+ * Discards every byte of a chunk's code from the given offset onwards,
+ * along with the line information of those bytes.
+ *
+ * @param chunk the chunk to truncate
+ * @param count the number of bytes to keep
+ */
+void truncateChunk(Chunk* chunk, int count) {
+    chunk->count = count;
+    while (chunk->lineCount > 0 &&
+           chunk->lines[chunk->lineCount - 1].offset >= count) {
+        chunk->lineCount--;
+    }
+}
+
+/**
+ * Finds the source line the byte at the given offset was compiled from.
+ *
+ * @param chunk the chunk that contains the byte
+ * @param offset the offset of the byte in the chunk's code
+ * @return the line of the byte
+ */
+int getLine(Chunk* chunk, int offset) {
+    int start = 0;
+    int end = chunk->lineCount - 1;
+
+    // Binary search for the last run that starts at or before offset
+    for (;;) {
+        int mid = (start + end) / 2;
+        LineStart* line = &chunk->lines[mid];
+        if (offset < line->offset) {
+            end = mid - 1;
+        } else if (mid == chunk->lineCount - 1 ||
+                   offset < chunk->lines[mid + 1].offset) {
+            return line->line;
+        } else {
+            start = mid + 1;
+        }
+    }
+}
+
+/**
+ * Returns the number of bytes taken by an instruction, including its operands.
+ *
+ * @param instruction the opcode of the instruction
+ * @return the size of the instruction in bytes
+ */
+int instructionLength(uint8_t instruction) {
+    switch (instruction) {
+        case OP_CONSTANT:
+        case OP_ADD_CONSTANT:
+        case OP_SUBTRACT_CONSTANT:
+        case OP_MULTIPLY_CONSTANT:
+        case OP_DIVIDE_CONSTANT:
+        case OP_GREATER_CONSTANT:
+        case OP_LESS_CONSTANT:
+        case OP_ADD_SMALL_INT:
+        case OP_SUBTRACT_SMALL_INT:
+        case OP_MULTIPLY_SMALL_INT:
+        case OP_DIVIDE_SMALL_INT:
+        case OP_GREATER_SMALL_INT:
+        case OP_LESS_SMALL_INT:
+        case OP_INPUT:
+        case OP_SMALL_INT:
+            return 2;
+        case OP_CONSTANT_LONG:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+/**
+ * Decodes an instruction that pushes a number held in the bytecode itself
+ * rather than in the constant pool.
+ *
+ * @param code the instruction
+ * @param number receives the number it pushes
+ * @return false if the instruction is not OP_ZERO, OP_ONE or OP_SMALL_INT
+ */
+bool readInlineNumber(const uint8_t* code, double* number) {
+    switch (code[0]) {
+        case OP_ZERO:      *number = 0; return true;
+        case OP_ONE:       *number = 1; return true;
+        case OP_SMALL_INT: *number = (int8_t)code[1]; return true;
+        default:           return false;
+    }
+}
+
+/**
+ * Finds the number-specialized form of an arithmetic or comparison operator.
+ *
+ * The specialized form does the same as the operator, but is only fast when
+ * both operands are numbers. The compiler emits it when it can tell they
+ * will be, and run() quickens an operator into it once the operator has run
+ * on numbers.
+ *
+ * @param instruction the generic operator
+ * @return the specialized opcode, or -1 if the operator has none
+ */
+int numberInstruction(uint8_t instruction) {
+    switch (instruction) {
+        case OP_ADD:           return OP_ADD_NUMBER;
+        case OP_SUBTRACT:      return OP_SUBTRACT_NUMBER;
+        case OP_MULTIPLY:      return OP_MULTIPLY_NUMBER;
+        case OP_DIVIDE:        return OP_DIVIDE_NUMBER;
+        case OP_GREATER:       return OP_GREATER_NUMBER;
+        case OP_LESS:          return OP_LESS_NUMBER;
+        case OP_GREATER_EQUAL: return OP_GREATER_EQUAL_NUMBER;
+        case OP_LESS_EQUAL:    return OP_LESS_EQUAL_NUMBER;
+        default:               return -1;
+    }
+}
+
+/**
+ * Undoes numberInstruction().
+ *
+ * @param instruction any opcode
+ * @return the generic operator a number-specialized opcode was made from, or
+ *         the opcode itself if it is not specialized
+ */
+uint8_t genericInstruction(uint8_t instruction) {
+    switch (instruction) {
+        case OP_ADD_NUMBER:           return OP_ADD;
+        case OP_SUBTRACT_NUMBER:      return OP_SUBTRACT;
+        case OP_MULTIPLY_NUMBER:      return OP_MULTIPLY;
+        case OP_DIVIDE_NUMBER:        return OP_DIVIDE;
+        case OP_GREATER_NUMBER:       return OP_GREATER;
+        case OP_LESS_NUMBER:          return OP_LESS;
+        case OP_GREATER_EQUAL_NUMBER: return OP_GREATER_EQUAL;
+        case OP_LESS_EQUAL_NUMBER:    return OP_LESS_EQUAL;
+        default:                      return instruction;
+    }
+}
+
+/**
+ * Returns how many values an instruction takes off the stack.
+ *
+ * @param instruction the opcode of the instruction
+ * @return the number of operands the instruction pops
+ */
+static int stackPops(uint8_t instruction) {
+    switch (instruction) {
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_NOT_EQUAL:
+        case OP_GREATER_EQUAL:
+        case OP_LESS_EQUAL:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_ADD_NUMBER:
+        case OP_SUBTRACT_NUMBER:
+        case OP_MULTIPLY_NUMBER:
+        case OP_DIVIDE_NUMBER:
+        case OP_GREATER_NUMBER:
+        case OP_LESS_NUMBER:
+        case OP_GREATER_EQUAL_NUMBER:
+        case OP_LESS_EQUAL_NUMBER:
+            return 2;
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_ADD_CONSTANT:
+        case OP_SUBTRACT_CONSTANT:
+        case OP_MULTIPLY_CONSTANT:
+        case OP_DIVIDE_CONSTANT:
+        case OP_GREATER_CONSTANT:
+        case OP_LESS_CONSTANT:
+        case OP_ADD_SMALL_INT:
+        case OP_SUBTRACT_SMALL_INT:
+        case OP_MULTIPLY_SMALL_INT:
+        case OP_DIVIDE_SMALL_INT:
+        case OP_GREATER_SMALL_INT:
+        case OP_LESS_SMALL_INT:
+        case OP_RETURN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Returns how many values an instruction leaves on the stack.
+ *
+ * @param instruction the opcode of the instruction
+ * @return the number of results the instruction pushes
+ */
+static int stackPushes(uint8_t instruction) {
+    return instruction == OP_RETURN ? 0 : 1;
+}
+
+/**
+ * Computes the deepest the value stack gets while running a chunk.
+ *
+ * The code has no jumps yet, so one pass over the instructions in order sees
+ * every depth the stack can reach.
+ *
+ * @param chunk the chunk to measure
+ * @return the maximum stack depth, or -1 if the code would pop more values
+ *         than it has pushed or ends in the middle of an instruction
+ */
+int measureStack(Chunk* chunk) {
+    int depth = 0;
+    int maxDepth = 0;
+    for (int offset = 0; offset < chunk->count;) {
+        uint8_t instruction = chunk->code[offset];
+        if (depth < stackPops(instruction)) return -1;
+        depth += stackPushes(instruction) - stackPops(instruction);
+        if (depth > maxDepth) maxDepth = depth;
+
+        offset += instructionLength(instruction);
+        if (offset > chunk->count) return -1;
+    }
+    return maxDepth;
+}
+
+/**
+ * Returns the raw bits of a value. Two values share a constant slot only if
+ * their bits are identical (see sameConstant()), so 0 and -0 stay distinct
+ * and NaN can still be interned even though it is not equal to itself.
+ *
+ * @param value the value to read
+ * @return the bits identifying the value
+ */
+static uint64_t valueBits(Value value) {
+#ifdef NAN_BOXING
+    return value;
+#else
+    uint64_t bits = 0;
+    switch (value.type) {
+        case VAL_BOOL:   bits = AS_BOOL(value); break;
+        case VAL_NIL:    break;
+        case VAL_NUMBER: memcpy(&bits, &AS_NUMBER(value), sizeof(double)); break;
+    }
+    return bits ^ ((uint64_t)value.type << 61);
+#endif
+}
+
+/**
+ * Tells whether two values can share a constant slot: they must have the
+ * same type and the same bits. The bits alone are not enough, since the type
+ * is mixed into them and, say, false and 2 come out the same.
+ *
+ * @param a the first value
+ * @param b the second value
+ * @return true if the values are interchangeable as constants
+ */
+static bool sameConstant(Value a, Value b) {
+#ifdef NAN_BOXING
+    return a == b;
+#else
+    return a.type == b.type && valueBits(a) == valueBits(b);
+#endif
+}
+
+/**
+ * Finds the slot of the constant index where a value lives, or the empty
+ * slot where it would be inserted. Collisions are resolved by linear probing.
+ *
+ * @param chunk the chunk whose constant index is searched
+ * @param value the value to look up
+ * @return the position of the slot in the constant index
+ */
+static int findSlot(Chunk* chunk, Value value) {
+    ConstantIndex* index = &chunk->constantIndex;
+    // Small numbers only differ in their top bits, so those are folded down
+    // before the multiply spreads them over the bits the slot is taken from
+    uint64_t bits = valueBits(value);
+    uint64_t hash = (bits ^ (bits >> 32)) * 0x9e3779b97f4a7c15u;
+    int slot = (int)((hash >> 32) & (uint64_t)(index->capacity - 1));
+
+    for (;;) {
+        int constant = index->slots[slot];
+        if (constant == -1 ||
+            sameConstant(chunk->constants.values[constant], value)) {
+            return slot;
+        }
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+}
+
+/**
+ * Grows the constant index and reinserts every constant of the pool, in
+ * pool order.
+ *
+ * @param chunk the chunk whose constant index is grown
+ */
+static void growConstantIndex(Chunk* chunk) {
+    ConstantIndex* index = &chunk->constantIndex;
+    int oldCapacity = index->capacity;
+    FREE_ARRAY(int, index->slots, oldCapacity, MEMORY_CONSTANTS);
+
+    index->capacity = GROW_CAPACITY(oldCapacity);
+    index->slots = GROW_ARRAY(int, NULL, 0, index->capacity, MEMORY_CONSTANTS);
+    for (int i = 0; i < index->capacity; i++) index->slots[i] = -1;
+
+    for (int i = 0; i < chunk->constants.count; i++) {
+        int slot = findSlot(chunk, chunk->constants.values[i]);
+        index->slots[slot] = i;
+    }
 }
 
 /**
- * Adds a constant value to the chunk's constants array.
+ * Adds a constant value to the chunk's constants array, unless a constant
+ * with the same bits is already there.
  *
  * @param chunk the chunk to which the constant is added
  * @param value the constant value to add
- * @return the index of the added constant in the constants array
+ * @return the index of the constant in the constants array
  */
 int addConstant(Chunk* chunk, Value value) {
+    // Keeps the index at most half full so probe sequences stay short
+    if (chunk->constantIndex.capacity < (chunk->constants.count + 1) * 2) {
+        growConstantIndex(chunk);
+    }
+
+    int slot = findSlot(chunk, value);
+    int constant = chunk->constantIndex.slots[slot];
+    if (constant != -1) return constant;
+
     writeValueArray(&chunk->constants, value);
-    return chunk->constants.count - 1;
+    constant = chunk->constants.count - 1;
+    chunk->constantIndex.slots[slot] = constant;
+    return constant;
+}
+
+/**
+ * Drops every constant at or past the given index of the chunk's constants
+ * array.
+ *
+ * Constants are removed from the most recent one backwards. Every value
+ * probed past a constant's slot was inserted after it, so clearing slots in
+ * that order never breaks the probe sequence of a constant that is kept.
+ *
+ * @param chunk the chunk whose constants are truncated
+ * @param count the number of constants to keep
+ */
+void truncateConstants(Chunk* chunk, int count) {
+    while (chunk->constants.count > count) {
+        Value value = chunk->constants.values[chunk->constants.count - 1];
+        chunk->constantIndex.slots[findSlot(chunk, value)] = -1;
+        chunk->constants.count--;
+    }
 }
\ No newline at end of file
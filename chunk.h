@@ -4,34 +4,94 @@
 #include "common.h"
 #include "value.h"
 
+// The largest constant index an OP_CONSTANT_LONG operand can hold
+#define CONSTANT_LONG_MAX 0xffffff
+
 typedef enum {
     OP_CONSTANT,
+    OP_CONSTANT_LONG,
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
+    OP_ZERO,
+    OP_ONE,
+    OP_SMALL_INT, // Pushes its operand, a signed byte, as a number
+    OP_INPUT,
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
+    OP_NOT_EQUAL,
+    OP_GREATER_EQUAL,
+    OP_LESS_EQUAL,
     OP_ADD,
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,
+    // Superinstructions produced by optimizeChunk()
+    OP_ADD_CONSTANT,
+    OP_SUBTRACT_CONSTANT,
+    OP_MULTIPLY_CONSTANT,
+    OP_DIVIDE_CONSTANT,
+    OP_GREATER_CONSTANT,
+    OP_LESS_CONSTANT,
+    // The same, with an OP_SMALL_INT's signed byte as the right operand
+    OP_ADD_SMALL_INT,
+    OP_SUBTRACT_SMALL_INT,
+    OP_MULTIPLY_SMALL_INT,
+    OP_DIVIDE_SMALL_INT,
+    OP_GREATER_SMALL_INT,
+    OP_LESS_SMALL_INT,
+    // Operators specialized for numbers; see numberInstruction()
+    OP_ADD_NUMBER,
+    OP_SUBTRACT_NUMBER,
+    OP_MULTIPLY_NUMBER,
+    OP_DIVIDE_NUMBER,
+    OP_GREATER_NUMBER,
+    OP_LESS_NUMBER,
+    OP_GREATER_EQUAL_NUMBER,
+    OP_LESS_EQUAL_NUMBER,
     OP_RETURN,
 } OpCode;
 
+// The start of a run of bytecode that all comes from the same source line
+typedef struct {
+    int offset;
+    int line;
+} LineStart;
+
+// Open-addressed hash index from a constant's bits to its slot in the
+// chunk's constant pool, used to intern repeated constants
+typedef struct {
+    int capacity;
+    int* slots; // Index into the constant pool, or -1 if the slot is empty
+} ConstantIndex;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t* code;
-    int* lines;
+    int lineCount;
+    int lineCapacity;
+    LineStart* lines;
     ValueArray constants;
+    ConstantIndex constantIndex;
+    int maxStack; // The deepest the value stack gets while running the code
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
+void resetChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
+void truncateChunk(Chunk* chunk, int count);
+int getLine(Chunk* chunk, int offset);
+int instructionLength(uint8_t instruction);
+bool readInlineNumber(const uint8_t* code, double* number);
+int numberInstruction(uint8_t instruction);
+uint8_t genericInstruction(uint8_t instruction);
+int measureStack(Chunk* chunk);
 int addConstant(Chunk* chunk, Value value);
+void truncateConstants(Chunk* chunk, int count);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,460 @@
+#include <string.h>
+
+#include "columns.h"
+#include "memory.h"
+
+// What every row of a column holds. Types only depend on the types of the
+// operands, and every input is a number, so all rows of a column always
+// share one.
+typedef enum {
+    COLUMN_NIL,
+    COLUMN_BOOL,
+    COLUMN_NUMBER,
+} ColumnType;
+
+// One stack slot, holding a value for each row of the batch
+typedef struct {
+    ColumnType type;
+    bool uniform;   // Every row holds values[0], e.g. for a constant
+    double* values; // COLUMN_BATCH rows; booleans are stored as 0 or 1
+} Column;
+
+typedef struct {
+    VM* vm;
+    Chunk* chunk;
+    Column* stack;
+    const double* const* inputs;
+    int inputCount;
+    size_t row;   // The first row of the batch being run
+    int rows;     // How many rows of the batch are real
+} ColumnRun;
+
+/**
+ * Reports a runtime error the way runtimeError() in vm.c does.
+ *
+ * @param run the evaluation that failed
+ * @param offset the offset of the failing instruction
+ * @param message the error message
+ * @return false, so callers can return the result directly
+ */
+static bool columnError(ColumnRun* run, int offset, const char* message) {
+    fprintf(run->vm->err, "%s\n[line %d] in script\n", message,
+            getLine(run->chunk, offset));
+    return false;
+}
+
+/**
+ * Makes a column hold the same value for every row.
+ *
+ * @param column the column to set
+ * @param type the type of the value
+ * @param value the value, or 0 for nil
+ */
+static void setUniform(Column* column, ColumnType type, double value) {
+    column->type = type;
+    column->uniform = true;
+    column->values[0] = value;
+}
+
+/**
+ * Stores a constant of the chunk in a column.
+ */
+static void setConstant(Column* column, Value value) {
+    if (IS_NUMBER(value)) {
+        setUniform(column, COLUMN_NUMBER, AS_NUMBER(value));
+    } else if (IS_BOOL(value)) {
+        setUniform(column, COLUMN_BOOL, AS_BOOL(value) ? 1.0 : 0.0);
+    } else {
+        setUniform(column, COLUMN_NIL, 0.0);
+    }
+}
+
+/**
+ * Copies a uniform column's value to every row, so it can be combined row by
+ * row with a column that is not uniform.
+ */
+static void broadcast(Column* column) {
+    if (!column->uniform) return;
+    double value = column->values[0];
+    for (int i = 0; i < COLUMN_BATCH; i++) column->values[i] = value;
+    column->uniform = false;
+}
+
+// Defines a function applying expression, in terms of the doubles x and y,
+// to every row of two columns and leaving the results in the first. The
+// loops always cover a whole batch and their arrays cannot alias, so the
+// compiler can vectorize them; rows past the end of a short batch are
+// computed and ignored.
+#define COLUMN_BINARY(name, expression)                                 \
+    static void name(double* restrict out, const double* restrict in) { \
+        for (int i = 0; i < COLUMN_BATCH; i++) {                        \
+            double x = out[i];                                          \
+            double y = in[i];                                           \
+            out[i] = (expression);                                      \
+        }                                                               \
+    }
+
+// Defines a function applying expression, in terms of the double x and the
+// constant k, to every row of a column.
+#define COLUMN_CONSTANT(name, expression)                               \
+    static void name(double* restrict out, double k) {                  \
+        for (int i = 0; i < COLUMN_BATCH; i++) {                        \
+            double x = out[i];                                          \
+            out[i] = (expression);                                      \
+        }                                                               \
+    }
+
+// Defines a function applying expression, in terms of the double x, to every
+// row of a column.
+#define COLUMN_UNARY(name, expression)                                  \
+    static void name(double* restrict out) {                            \
+        for (int i = 0; i < COLUMN_BATCH; i++) {                        \
+            double x = out[i];                                          \
+            out[i] = (expression);                                      \
+        }                                                               \
+    }
+
+COLUMN_BINARY(equalColumns, (double)(x == y))
+COLUMN_BINARY(notEqualColumns, (double)(x != y))
+COLUMN_BINARY(greaterColumns, (double)(x > y))
+COLUMN_BINARY(lessColumns, (double)(x < y))
+// The negations of < and >, as in run(), written so they vectorize
+COLUMN_BINARY(greaterEqualColumns, 1.0 - (double)(x < y))
+COLUMN_BINARY(lessEqualColumns, 1.0 - (double)(x > y))
+COLUMN_BINARY(addColumns, x + y)
+COLUMN_BINARY(subtractColumns, x - y)
+COLUMN_BINARY(multiplyColumns, x * y)
+COLUMN_BINARY(divideColumns, x / y)
+COLUMN_CONSTANT(addToColumn, x + k)
+COLUMN_CONSTANT(subtractFromColumn, x - k)
+COLUMN_CONSTANT(multiplyColumn, x * k)
+COLUMN_CONSTANT(divideColumn, x / k)
+COLUMN_CONSTANT(greaterThanConstant, (double)(x > k))
+COLUMN_CONSTANT(lessThanConstant, (double)(x < k))
+COLUMN_UNARY(notColumn, (double)(x == 0.0))
+COLUMN_UNARY(negateColumn, -x)
+
+#undef COLUMN_BINARY
+#undef COLUMN_CONSTANT
+#undef COLUMN_UNARY
+
+typedef void (*BinaryLoop)(double* restrict out, const double* restrict in);
+typedef void (*ConstantLoop)(double* restrict out, double k);
+
+/**
+ * Applies a binary loop to two columns, leaving the result in the first.
+ *
+ * @param a the left operand, which receives the result
+ * @param b the right operand
+ * @param type the type of the result
+ * @param loop the operation
+ */
+static void applyBinary(Column* a, Column* b, ColumnType type,
+                        BinaryLoop loop) {
+    if (a->uniform && b->uniform) {
+        // Both operands are constants the compiler could not fold, so there
+        // is only one row's worth of work
+        double out[COLUMN_BATCH] = {a->values[0]};
+        double in[COLUMN_BATCH] = {b->values[0]};
+        loop(out, in);
+        setUniform(a, type, out[0]);
+        return;
+    }
+
+    broadcast(a);
+    broadcast(b);
+    loop(a->values, b->values);
+    a->type = type;
+}
+
+/**
+ * Applies a loop with a constant operand to a column, in place.
+ *
+ * @param a the column
+ * @param type the type of the result
+ * @param k the constant
+ * @param loop the operation
+ */
+static void applyConstant(Column* a, ColumnType type, double k,
+                          ConstantLoop loop) {
+    broadcast(a);
+    loop(a->values, k);
+    a->type = type;
+}
+
+/**
+ * Writes the values of the column an OP_RETURN hands back.
+ *
+ * @param run the evaluation
+ * @param column the column being returned
+ * @param results the results of the whole evaluation
+ */
+static void storeResults(ColumnRun* run, Column* column, Value* results) {
+    Value* out = results + run->row;
+    for (int i = 0; i < run->rows; i++) {
+        double value = column->values[column->uniform ? 0 : i];
+        switch (column->type) {
+            case COLUMN_NIL:    out[i] = NIL_VAL; break;
+            case COLUMN_BOOL:   out[i] = BOOL_VAL(value != 0.0); break;
+            case COLUMN_NUMBER: out[i] = NUMBER_VAL(value); break;
+        }
+    }
+}
+
+/**
+ * Runs a chunk over one batch of rows.
+ *
+ * Each instruction is dispatched once for the whole batch, and the types of
+ * its operands are checked once per column instead of once per row. A type
+ * error is therefore reported once, for the whole batch, where run() would
+ * have reported it on the batch's first row.
+ *
+ * @param run the evaluation, with row and rows set to the batch
+ * @param results where the values of the rows are stored
+ * @return false after reporting a runtime error
+ */
+static bool runColumnBatch(ColumnRun* run, Value* results) {
+    Chunk* chunk = run->chunk;
+    Column* top = run->stack;
+
+    for (int offset = 0; offset < chunk->count;
+         offset += instructionLength(chunk->code[offset])) {
+        uint8_t* code = &chunk->code[offset];
+        Column* a = top - 2;
+        Column* b = top - 1;
+
+        switch (genericInstruction(code[0])) {
+            case OP_CONSTANT:
+                setConstant(top++, chunk->constants.values[code[1]]);
+                break;
+            case OP_CONSTANT_LONG:
+                setConstant(top++, chunk->constants.values[
+                    code[1] | (code[2] << 8) | (code[3] << 16)]);
+                break;
+            case OP_NIL:   setUniform(top++, COLUMN_NIL, 0.0); break;
+            case OP_TRUE:  setUniform(top++, COLUMN_BOOL, 1.0); break;
+            case OP_FALSE: setUniform(top++, COLUMN_BOOL, 0.0); break;
+            case OP_ZERO:
+            case OP_ONE:
+            case OP_SMALL_INT: {
+                double number = 0;
+                readInlineNumber(code, &number);
+                setUniform(top++, COLUMN_NUMBER, number);
+                break;
+            }
+            case OP_INPUT: {
+                if (code[1] >= run->inputCount) {
+                    char message[64];
+                    snprintf(message, sizeof(message),
+                             "Input $%d was not given.", code[1]);
+                    return columnError(run, offset, message);
+                }
+                top->type = COLUMN_NUMBER;
+                top->uniform = false;
+                memcpy(top->values, run->inputs[code[1]] + run->row,
+                       sizeof(double) * (size_t)run->rows);
+                top++;
+                break;
+            }
+            case OP_EQUAL:
+            case OP_NOT_EQUAL: {
+                bool negate = code[0] == OP_NOT_EQUAL;
+                if (a->type != b->type) {
+                    setUniform(a, COLUMN_BOOL, negate ? 1.0 : 0.0);
+                } else if (a->type == COLUMN_NIL) {
+                    setUniform(a, COLUMN_BOOL, negate ? 0.0 : 1.0);
+                } else {
+                    applyBinary(a, b, COLUMN_BOOL,
+                                negate ? notEqualColumns : equalColumns);
+                }
+                top--;
+                break;
+            }
+            case OP_GREATER:
+            case OP_LESS:
+            case OP_GREATER_EQUAL:
+            case OP_LESS_EQUAL:
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+                if (a->type != COLUMN_NUMBER || b->type != COLUMN_NUMBER) {
+                    return columnError(run, offset,
+                                       "Operands must be numbers.");
+                }
+                switch (genericInstruction(code[0])) {
+                    case OP_GREATER:
+                        applyBinary(a, b, COLUMN_BOOL, greaterColumns); break;
+                    case OP_LESS:
+                        applyBinary(a, b, COLUMN_BOOL, lessColumns); break;
+                    case OP_GREATER_EQUAL:
+                        applyBinary(a, b, COLUMN_BOOL, greaterEqualColumns);
+                        break;
+                    case OP_LESS_EQUAL:
+                        applyBinary(a, b, COLUMN_BOOL, lessEqualColumns);
+                        break;
+                    case OP_ADD:
+                        applyBinary(a, b, COLUMN_NUMBER, addColumns); break;
+                    case OP_SUBTRACT:
+                        applyBinary(a, b, COLUMN_NUMBER, subtractColumns);
+                        break;
+                    case OP_MULTIPLY:
+                        applyBinary(a, b, COLUMN_NUMBER, multiplyColumns);
+                        break;
+                    default:
+                        applyBinary(a, b, COLUMN_NUMBER, divideColumns);
+                        break;
+                }
+                top--;
+                break;
+            case OP_ADD_CONSTANT:
+            case OP_SUBTRACT_CONSTANT:
+            case OP_MULTIPLY_CONSTANT:
+            case OP_DIVIDE_CONSTANT:
+            case OP_GREATER_CONSTANT:
+            case OP_LESS_CONSTANT:
+            case OP_ADD_SMALL_INT:
+            case OP_SUBTRACT_SMALL_INT:
+            case OP_MULTIPLY_SMALL_INT:
+            case OP_DIVIDE_SMALL_INT:
+            case OP_GREATER_SMALL_INT:
+            case OP_LESS_SMALL_INT: {
+                // The superinstructions take their constant or small integer
+                // as the right operand, and leave the left one in the top
+                // slot
+                a = top - 1;
+                // The *_SMALL_INT forms follow all of the *_CONSTANT ones
+                Value constant = code[0] >= OP_ADD_SMALL_INT
+                                     ? NUMBER_VAL((int8_t)code[1])
+                                     : chunk->constants.values[code[1]];
+                if (a->type != COLUMN_NUMBER || !IS_NUMBER(constant)) {
+                    return columnError(run, offset,
+                                       "Operands must be numbers.");
+                }
+                double k = AS_NUMBER(constant);
+                switch (code[0]) {
+                    case OP_ADD_CONSTANT:
+                    case OP_ADD_SMALL_INT:
+                        applyConstant(a, COLUMN_NUMBER, k, addToColumn); break;
+                    case OP_SUBTRACT_CONSTANT:
+                    case OP_SUBTRACT_SMALL_INT:
+                        applyConstant(a, COLUMN_NUMBER, k, subtractFromColumn);
+                        break;
+                    case OP_MULTIPLY_CONSTANT:
+                    case OP_MULTIPLY_SMALL_INT:
+                        applyConstant(a, COLUMN_NUMBER, k, multiplyColumn);
+                        break;
+                    case OP_DIVIDE_CONSTANT:
+                    case OP_DIVIDE_SMALL_INT:
+                        applyConstant(a, COLUMN_NUMBER, k, divideColumn);
+                        break;
+                    case OP_GREATER_CONSTANT:
+                    case OP_GREATER_SMALL_INT:
+                        applyConstant(a, COLUMN_BOOL, k, greaterThanConstant);
+                        break;
+                    default:
+                        applyConstant(a, COLUMN_BOOL, k, lessThanConstant); break;
+                }
+                break;
+            }
+            case OP_NOT:
+                a = top - 1;
+                if (a->type == COLUMN_NIL) {
+                    setUniform(a, COLUMN_BOOL, 1.0);
+                } else if (a->type == COLUMN_NUMBER) {
+                    setUniform(a, COLUMN_BOOL, 0.0);
+                } else {
+                    broadcast(a);
+                    notColumn(a->values);
+                }
+                break;
+            case OP_NEGATE:
+                a = top - 1;
+                if (a->type != COLUMN_NUMBER) {
+                    return columnError(run, offset,
+                                       "Operand must be a number.");
+                }
+                broadcast(a);
+                negateColumn(a->values);
+                break;
+            case OP_RETURN:
+                storeResults(run, top - 1, results);
+                return true;
+        }
+    }
+    return true;
+}
+
+/**
+ * Evaluates a program over many rows of inputs at once, as a columnar query
+ * engine would.
+ *
+ * Every stack slot holds a column of COLUMN_BATCH rows, so each instruction
+ * is dispatched and type checked once per batch, and its work is a loop over
+ * the batch that the compiler can vectorize. The results are the values
+ * evaluate() would return for each row.
+ *
+ * @param vm the virtual machine, which supplies the error stream
+ * @param program the program to evaluate; it is never modified
+ * @param inputs inputCount columns of rows numbers, so that inputs[j][i] is
+ *        the value of $j in row i
+ * @param inputCount the number of input columns
+ * @param rows the number of rows
+ * @param results where the value of each row is stored
+ * @return the result of the evaluation; after a runtime error, which is
+ *         reported once, the results are only valid for the batches before it
+ */
+InterpretResult evaluateColumns(VM* vm, const Program* program,
+                                const double* const* inputs, int inputCount,
+                                size_t rows, Value* results) {
+    // Running reads the chunk but never writes it
+    Chunk* chunk = (Chunk*)&program->chunk;
+
+    if (chunk->maxStack > COLUMN_STACK_MAX) {
+        Value row[UINT8_MAX + 1];
+        if (inputCount > UINT8_MAX + 1) inputCount = UINT8_MAX + 1;
+        for (size_t i = 0; i < rows; i++) {
+            for (int j = 0; j < inputCount; j++) {
+                row[j] = NUMBER_VAL(inputs[j][i]);
+            }
+            InterpretResult result = evaluate(vm, program, row, inputCount,
+                                              &results[i]);
+            if (result != INTERPRET_OK) return result;
+        }
+        return INTERPRET_OK;
+    }
+
+    // The buffers outlive any arena the VM has
+    const Allocator* previous = setAllocator(NULL);
+    int slots = chunk->maxStack;
+    size_t valueCount = (size_t)slots * COLUMN_BATCH;
+    Column* stack = GROW_ARRAY(Column, NULL, 0, slots, MEMORY_STACK);
+    double* values = GROW_ARRAY(double, NULL, 0, valueCount, MEMORY_STACK);
+    // Rows past the end of a short batch are still computed on
+    memset(values, 0, sizeof(double) * valueCount);
+    for (int i = 0; i < slots; i++) {
+        stack[i].values = values + (size_t)i * COLUMN_BATCH;
+    }
+
+    ColumnRun run;
+    run.vm = vm;
+    run.chunk = chunk;
+    run.stack = stack;
+    run.inputs = inputs;
+    run.inputCount = inputCount;
+
+    InterpretResult result = INTERPRET_OK;
+    for (run.row = 0; run.row < rows; run.row += COLUMN_BATCH) {
+        size_t remaining = rows - run.row;
+        run.rows = remaining < COLUMN_BATCH ? (int)remaining : COLUMN_BATCH;
+        if (!runColumnBatch(&run, results)) {
+            result = INTERPRET_RUNTIME_ERROR;
+            break;
+        }
+    }
+
+    FREE_ARRAY(double, values, valueCount, MEMORY_STACK);
+    FREE_ARRAY(Column, stack, slots, MEMORY_STACK);
+    setAllocator(previous);
+    return result;
+}
\ No newline at end of file
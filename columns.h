@@ -0,0 +1,19 @@
+#ifndef clox_columns_h
+#define clox_columns_h
+
+#include "common.h"
+#include "value.h"
+#include "vm.h"
+
+// How many rows evaluateColumns() runs through each instruction at a time
+#define COLUMN_BATCH 256
+
+// The deepest stack evaluateColumns() gives a column to every slot of;
+// deeper programs are evaluated a row at a time instead
+#define COLUMN_STACK_MAX 4096
+
+InterpretResult evaluateColumns(VM* vm, const Program* program,
+                                const double* const* inputs, int inputCount,
+                                size_t rows, Value* results);
+
+#endif
\ No newline at end of file
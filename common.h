@@ -5,7 +5,17 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
+// Define NAN_BOXING (e.g. -DNAN_BOXING) to pack every Value into 8 bytes.
+
+// The debug build profile (make PROFILE=debug) defines DEBUG_PRINT_CODE to
+// disassemble every compiled chunk and DEBUG_TRACE_EXECUTION to trace every VM
+// by default. Any build can still trace at runtime with --trace.
+
+// Threaded dispatch relies on the "labels as values" extension, so it is only
+// enabled on compilers known to provide it. Build with -DNO_COMPUTED_GOTO to
+// force the portable switch-based loop.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
 
 #endif
\ No newline at end of file
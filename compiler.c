@@ -1,19 +1,46 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "common.h"
 #include "compiler.h"
+#include "optimizer.h"
 #include "scanner.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
+// How deeply expressions may nest. The parser recurses once per level, so this
+// keeps huge generated inputs from exhausting the C stack.
+#define MAX_NESTING 16384
+
+// What the compiler knows about the value an expression produces
+typedef enum {
+    TYPE_UNKNOWN, // Only known when the code runs, e.g. an input
+    TYPE_NUMBER,
+    TYPE_BOOL,
+    TYPE_NIL,
+} StaticType;
+
+// All of the state of one compilation. Each call to compile() has its own
+// Parser on the stack, so separate threads can compile at the same time.
 typedef struct {
-    Token current;
-    Token previous;
+    const TokenBuffer* tokens; // The whole source scanned up front, or NULL
+                               // to scan it as parsing goes
+    int current;          // With tokens, the index of the current token
+    int previous;         // With tokens, the index of the token before it
+    Scanner scanner;      // Without tokens, where tokens come from
+    Token currentToken;   // Without tokens, the current token
+    Token previousToken;  // Without tokens, the token before it
+    Chunk* compilingChunk;
+    FILE* errors;
     bool hadError;
     bool panicMode;
+    int nesting;          // How many parsePrecedence() calls are active
+    int operandStart;     // Offset where the left operand of an infix rule begins
+    int operandConstants; // Size of the constant pool when that operand began
+    StaticType type;      // What the expression compiled last produces
 } Parser;
 
 typedef enum {
@@ -30,7 +57,7 @@ typedef enum {
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)();
+typedef void (*ParseFn)(Parser* parser);
 
 typedef struct {
     ParseFn prefix;
@@ -38,11 +65,33 @@ typedef struct {
     Precedence precedence;
 } ParseRule;
 
-Parser parser;
-Chunk* compilingChunk;
+static Chunk* currentChunk(Parser* parser) {
+    return parser->compilingChunk;
+}
+
+static TokenType currentType(Parser* parser) {
+    if (parser->tokens == NULL) return parser->currentToken.type;
+    return (TokenType)parser->tokens->types[parser->current];
+}
+
+static TokenType previousType(Parser* parser) {
+    if (parser->tokens == NULL) return parser->previousToken.type;
+    return (TokenType)parser->tokens->types[parser->previous];
+}
 
-static Chunk* currentChunk() {
-    return compilingChunk;
+static int previousLine(Parser* parser) {
+    if (parser->tokens == NULL) return parser->previousToken.line;
+    return parser->tokens->lines[parser->previous];
+}
+
+static Token currentToken(Parser* parser) {
+    if (parser->tokens == NULL) return parser->currentToken;
+    return getToken(parser->tokens, parser->current);
+}
+
+static Token previousToken(Parser* parser) {
+    if (parser->tokens == NULL) return parser->previousToken;
+    return getToken(parser->tokens, parser->previous);
 }
 
 /**
@@ -50,26 +99,26 @@ static Chunk* currentChunk() {
  *
  * The parser will only report one error at a time, so if the parser is in
  * panic mode, this function does nothing. Otherwise, it will print the error
- * message to stderr and set the parser's panic mode to true.
+ * message to the parser's error stream and set the parser's panic mode to true.
  *
  * @param token the token at which the error occurred
  * @param message the error message to report
  */
-static void errorAt(Token* token, const char* message) {
-    if (parser.panicMode) return;
-    parser.panicMode = true;
-    fprintf(stderr, "[line %d] Error", token->line);
+static void errorAt(Parser* parser, Token* token, const char* message) {
+    if (parser->panicMode) return;
+    parser->panicMode = true;
+    fprintf(parser->errors, "[line %d] Error", token->line);
 
     if (token->type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(parser->errors, " at end");
     } else if (token->type == TOKEN_ERROR) {
         // Nothing
     } else {
-        fprintf(stderr, " at '%.*s'", token->length, token->start);
+        fprintf(parser->errors, " at '%.*s'", token->length, token->start);
     }
 
-    fprintf(stderr, ": %s\n", message);
-    parser.hadError = true;
+    fprintf(parser->errors, ": %s\n", message);
+    parser->hadError = true;
 }
 
 /**
@@ -78,8 +127,9 @@ static void errorAt(Token* token, const char* message) {
  *
  * @param message the error message to report
  */
-static void error(const char* message) {
-    errorAt(&parser.previous, message);
+static void error(Parser* parser, const char* message) {
+    Token token = previousToken(parser);
+    errorAt(parser, &token, message);
 }
 
 /**
@@ -87,8 +137,9 @@ static void error(const char* message) {
  *
  * @param message the error message to report
  */
-static void errorAtCurrent(const char* message) {
-    errorAt(&parser.current, message);
+static void errorAtCurrent(Parser* parser, const char* message) {
+    Token token = currentToken(parser);
+    errorAt(parser, &token, message);
 }
 
 /**
@@ -99,25 +150,46 @@ static void errorAtCurrent(const char* message) {
  * found. The parser is then positioned at the first non-error token after the
  * last encountered error. If no errors are encountered, the parser is simply
  * positioned at the next token.
+ *
+ * With a token buffer, advancing only moves an index; the buffer ends with
+ * TOKEN_EOF, which the parser never moves past.
  */
-static void advance() {
-    parser.previous = parser.current;
+static void advance(Parser* parser) {
+    if (parser->tokens != NULL) {
+        const TokenBuffer* tokens = parser->tokens;
+        parser->previous = parser->current;
+        // The first call starts from before the first token
+        if (parser->current >= 0 &&
+            tokens->types[parser->current] == TOKEN_EOF) {
+            return;
+        }
+
+        parser->current++;
+        while (tokens->types[parser->current] == TOKEN_ERROR) {
+            errorAtCurrent(parser,
+                           tokens->messages[tokens->lengths[parser->current]]);
+            parser->current++;
+        }
+        return;
+    }
+
+    parser->previousToken = parser->currentToken;
 
     for (;;) {
-        parser.current = scanToken();
-        if (parser.current.type != TOKEN_ERROR) break;
+        parser->currentToken = scanToken(&parser->scanner);
+        if (parser->currentToken.type != TOKEN_ERROR) break;
 
-        errorAtCurrent(parser.current.start);
+        errorAtCurrent(parser, parser->currentToken.start);
     }
 }
 
-static void consume(TokenType type, const char* message) {
-    if (parser.current.type == type) {
-        advance();
+static void consume(Parser* parser, TokenType type, const char* message) {
+    if (currentType(parser) == type) {
+        advance(parser);
         return;
     }
 
-    errorAtCurrent(message);
+    errorAtCurrent(parser, message);
 }
 
 /**
@@ -129,8 +201,8 @@ static void consume(TokenType type, const char* message) {
  *
  * @param byte the byte to emit
  */
-static void emitByte(uint8_t byte) {
-    writeChunk(currentChunk(), byte, parser.previous.line);
+static void emitByte(Parser* parser, uint8_t byte) {
+    writeChunk(currentChunk(parser), byte, previousLine(parser));
 }
 
 /**
@@ -143,13 +215,13 @@ static void emitByte(uint8_t byte) {
  * @param byte1 the first byte of the instruction
  * @param byte2 the second byte of the instruction
  */
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
-    emitByte(byte1);
-    emitByte(byte2);
+static void emitBytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
+    emitByte(parser, byte1);
+    emitByte(parser, byte2);
 }
 
-static void emitReturn() {
-    emitByte(OP_RETURN);
+static void emitReturn(Parser* parser) {
+    emitByte(parser, OP_RETURN);
 }
 
 /**
@@ -157,33 +229,249 @@ static void emitReturn() {
  *
  * This function appends the provided constant value to the constants array
  * of the current chunk. If the number of constants exceeds the maximum 
- * allowable index for a single byte, an error is reported.
+ * index an OP_CONSTANT_LONG operand can hold, an error is reported.
  *
  * @param value the constant value to add
  * @return the index of the added constant in the constants array, or 0 if 
  *         an error occurred due to exceeding the maximum allowed constants
  */
-static uint8_t makeConstant(Value value) {
-    int constant = addConstant(currentChunk(), value);
-    if (constant > UINT8_MAX) {
-        error("Too many constants in one chunk.");
+static int makeConstant(Parser* parser, Value value) {
+    int constant = addConstant(currentChunk(parser), value);
+    if (constant > CONSTANT_LONG_MAX) {
+        error(parser, "Too many constants in one chunk.");
         return 0;
     }
 
-    return (uint8_t)constant;
+    return constant;
 }
 
 /**
- * Emits an OP_CONSTANT bytecode instruction with the given constant value.
+ * Emits an instruction that loads the given constant value.
  *
- * This function adds a value to the current chunk's constants array and
- * emits an OP_CONSTANT bytecode instruction with the index of the added
- * value. The instruction is emitted at the current position in the chunk.
+ * Integers from -128 to 127 are encoded in the instruction itself, as
+ * OP_ZERO, OP_ONE or OP_SMALL_INT, and take no constant. Any other value is
+ * added to the current chunk's constants array and loaded by index. Indexes
+ * that fit in a byte use the compact OP_CONSTANT; larger ones use
+ * OP_CONSTANT_LONG with a 24-bit little-endian operand.
  *
  * @param value the constant value to emit
  */
-static void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+static void emitConstant(Parser* parser, Value value) {
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        // -0 is not an integer here, since it would come back as 0
+        if (number >= INT8_MIN && number <= INT8_MAX &&
+            number == (int8_t)number && (number != 0 || !signbit(number))) {
+            if (number == 0) {
+                emitByte(parser, OP_ZERO);
+            } else if (number == 1) {
+                emitByte(parser, OP_ONE);
+            } else {
+                emitBytes(parser, OP_SMALL_INT, (uint8_t)(int8_t)number);
+            }
+            return;
+        }
+    }
+
+    int constant = makeConstant(parser, value);
+    if (constant <= UINT8_MAX) {
+        emitBytes(parser, OP_CONSTANT, (uint8_t)constant);
+        return;
+    }
+
+    emitByte(parser, OP_CONSTANT_LONG);
+    emitByte(parser, (uint8_t)(constant & 0xff));
+    emitByte(parser, (uint8_t)((constant >> 8) & 0xff));
+    emitByte(parser, (uint8_t)((constant >> 16) & 0xff));
+}
+
+/**
+ * Returns the constant index loaded by the instruction at the given offset.
+ *
+ * @param offset the offset of the instruction in the current chunk
+ * @param length receives the size of the instruction in bytes
+ * @return the constant index, or -1 if the instruction is not OP_CONSTANT or
+ *         OP_CONSTANT_LONG
+ */
+static int constantOperand(Parser* parser, int offset, int* length) {
+    uint8_t* code = currentChunk(parser)->code;
+    switch (code[offset]) {
+        case OP_CONSTANT:
+            *length = 2;
+            return code[offset + 1];
+        case OP_CONSTANT_LONG:
+            *length = 4;
+            return code[offset + 1] |
+                   (code[offset + 2] << 8) |
+                   (code[offset + 3] << 16);
+        default:
+            *length = 1;
+            return -1;
+    }
+}
+
+/**
+ * Decodes the code in [start, end) of the current chunk as a constant.
+ *
+ * The range is a constant only if it consists of exactly one instruction that
+ * pushes a value known at compile time: OP_CONSTANT, OP_CONSTANT_LONG, OP_NIL,
+ * OP_TRUE, OP_FALSE or one of the inline numbers.
+ *
+ * @param start the offset of the first byte of the range
+ * @param end the offset one past the last byte of the range
+ * @param value receives the constant when the range is one
+ * @return true if the range holds a single constant instruction
+ */
+static bool readConstant(Parser* parser, int start, int end, Value* value) {
+    Chunk* chunk = currentChunk(parser);
+    if (start < 0 || start >= end) return false;
+
+    int length;
+    int constant = constantOperand(parser, start, &length);
+    if (constant != -1) {
+        if (end - start != length) return false;
+        *value = chunk->constants.values[constant];
+        return true;
+    }
+
+    double number;
+    if (readInlineNumber(&chunk->code[start], &number)) {
+        if (end - start != instructionLength(chunk->code[start])) return false;
+        *value = NUMBER_VAL(number);
+        return true;
+    }
+
+    switch (chunk->code[start]) {
+        case OP_NIL:   *value = NIL_VAL; break;
+        case OP_TRUE:  *value = BOOL_VAL(true); break;
+        case OP_FALSE: *value = BOOL_VAL(false); break;
+        default: return false;
+    }
+
+    return end - start == 1;
+}
+
+/**
+ * Removes the code from start to the end of the current chunk.
+ *
+ * Every constant added to the pool since the discarded code began is only
+ * referenced by that code, so those constants are dropped as well and folded
+ * literals do not leave dead entries behind.
+ *
+ * @param start the offset of the first byte to remove
+ * @param constants the size of the constant pool when that code began
+ */
+static void discardCode(Parser* parser, int start, int constants) {
+    truncateChunk(currentChunk(parser), start);
+    truncateConstants(currentChunk(parser), constants);
+}
+
+/**
+ * Replaces the code from start to the end of the current chunk with a single
+ * instruction that pushes the given value.
+ *
+ * @param start the offset where the replaced code begins
+ * @param constants the size of the constant pool when that code began
+ * @param value the value the replacement instruction pushes
+ */
+static void replaceWithConstant(Parser* parser, int start, int constants,
+                                Value value) {
+    discardCode(parser, start, constants);
+
+    if (IS_NIL(value)) {
+        emitByte(parser, OP_NIL);
+    } else if (IS_BOOL(value)) {
+        emitByte(parser, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        emitConstant(parser, value);
+    }
+}
+
+/**
+ * Emits a unary instruction, folding it into a constant when its operand is
+ * one.
+ *
+ * Folding only happens when the VM would not raise a runtime error, so
+ * something like -true is still compiled and reported when it runs.
+ *
+ * @param op the unary instruction to emit
+ * @param operandStart the offset where the operand's code begins
+ * @param operandConstants the size of the constant pool when the operand began
+ */
+static void emitUnaryOp(Parser* parser, OpCode op, int operandStart,
+                        int operandConstants) {
+    Value operand;
+    if (!parser->hadError &&
+        readConstant(parser, operandStart, currentChunk(parser)->count, &operand)) {
+        switch (op) {
+            case OP_NOT:
+                replaceWithConstant(parser, operandStart, operandConstants,
+                                    BOOL_VAL(isFalsey(operand)));
+                return;
+            case OP_NEGATE:
+                if (!IS_NUMBER(operand)) break;
+                replaceWithConstant(parser, operandStart, operandConstants,
+                                    NUMBER_VAL(-AS_NUMBER(operand)));
+                return;
+            default: break;
+        }
+    }
+
+    emitByte(parser, op);
+}
+
+/**
+ * Emits a binary instruction, folding it into a constant when both of its
+ * operands are constants.
+ *
+ * The folded result is computed exactly as run() would compute it. Operations
+ * that would raise a runtime error, such as adding nil to a number, are left
+ * in the bytecode.
+ *
+ * @param op the binary instruction to emit, which may be number-specialized
+ * @param leftStart the offset where the left operand's code begins
+ * @param leftConstants the size of the constant pool when the left operand
+ *        began
+ * @param rightStart the offset where the right operand's code begins
+ */
+static void emitBinaryOp(Parser* parser, OpCode op, int leftStart,
+                         int leftConstants, int rightStart) {
+    Value a;
+    Value b;
+    if (parser->hadError ||
+        !readConstant(parser, leftStart, rightStart, &a) ||
+        !readConstant(parser, rightStart, currentChunk(parser)->count, &b)) {
+        emitByte(parser, op);
+        return;
+    }
+
+    Value result;
+    if (op == OP_EQUAL) {
+        result = BOOL_VAL(valuesEqual(a, b));
+    } else if (op == OP_NOT_EQUAL) {
+        result = BOOL_VAL(!valuesEqual(a, b));
+    } else if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+        emitByte(parser, op);
+        return;
+    } else {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        switch (genericInstruction(op)) {
+            case OP_GREATER:       result = BOOL_VAL(x > y); break;
+            case OP_LESS:          result = BOOL_VAL(x < y); break;
+            case OP_GREATER_EQUAL: result = BOOL_VAL(!(x < y)); break;
+            case OP_LESS_EQUAL:    result = BOOL_VAL(!(x > y)); break;
+            case OP_ADD:           result = NUMBER_VAL(x + y); break;
+            case OP_SUBTRACT:      result = NUMBER_VAL(x - y); break;
+            case OP_MULTIPLY:      result = NUMBER_VAL(x * y); break;
+            case OP_DIVIDE:        result = NUMBER_VAL(x / y); break;
+            default:
+                emitByte(parser, op);
+                return;
+        }
+    }
+
+    replaceWithConstant(parser, leftStart, leftConstants, result);
 }
 
 /**
@@ -191,48 +479,80 @@ static void emitConstant(Value value) {
  *
  * This function appends an OP_RETURN bytecode instruction to the current
  * chunk, signaling the end of the compiled code. It is typically called
- * after all expressions or statements have been compiled.
+ * after all expressions or statements have been compiled. The finished chunk
+ * is then handed to the peephole optimizer.
  */
-static void endCompiler() {
-    emitReturn();
+static void endCompiler(Parser* parser) {
+    emitReturn(parser);
+    if (!parser->hadError) {
+        optimizeChunk(currentChunk(parser));
+        currentChunk(parser)->maxStack = measureStack(currentChunk(parser));
+    }
 #ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) {
-        disassembleChunk(currentChunk(), "code");
+    if (!parser->hadError) {
+        disassembleChunk(currentChunk(parser), "code");
     }
 #endif
 }
 
-static void expression();
+static void expression(Parser* parser);
 static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Parser* parser, Precedence precedence);
 
-static void binary() {
-    TokenType operatorType = parser.previous.type;
+/**
+ * Compiles the right operand of a binary expression followed by its
+ * operator instruction.
+ *
+ * The left operand has already been compiled by the time this is called.
+ * When both operands turn out to be constants, the whole expression is
+ * folded into one. When both are known to be numbers, the number-specialized
+ * form of the operator is emitted, so run() does not have to quicken it.
+ */
+static void binary(Parser* parser) {
+    TokenType operatorType = previousType(parser);
+    StaticType leftType = parser->type;
+    int leftStart = parser->operandStart;
+    int leftConstants = parser->operandConstants;
     ParseRule* rule = getRule(operatorType);
-    parsePrecedence((Precedence)(rule->precedence + 1));
+    int rightStart = currentChunk(parser)->count;
+    parsePrecedence(parser, (Precedence)(rule->precedence + 1));
 
+    OpCode op;
     switch (operatorType) {
-        case TOKEN_BANG_EQUAL:    emitBytes(OP_EQUAL, OP_NOT); break;
-        case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL); break;
-        case TOKEN_GREATER:       emitByte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT); break;
-        case TOKEN_LESS:          emitByte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT); break;
-        case TOKEN_PLUS:          emitByte(OP_ADD); break;
-        case TOKEN_MINUS:         emitByte(OP_SUBTRACT); break;
-        case TOKEN_STAR:          emitByte(OP_MULTIPLY); break;
-        case TOKEN_SLASH:         emitByte(OP_DIVIDE); break;
+        case TOKEN_BANG_EQUAL:    op = OP_NOT_EQUAL; break;
+        case TOKEN_EQUAL_EQUAL:   op = OP_EQUAL; break;
+        case TOKEN_GREATER:       op = OP_GREATER; break;
+        case TOKEN_GREATER_EQUAL: op = OP_GREATER_EQUAL; break;
+        case TOKEN_LESS:          op = OP_LESS; break;
+        case TOKEN_LESS_EQUAL:    op = OP_LESS_EQUAL; break;
+        case TOKEN_PLUS:          op = OP_ADD; break;
+        case TOKEN_MINUS:         op = OP_SUBTRACT; break;
+        case TOKEN_STAR:          op = OP_MULTIPLY; break;
+        case TOKEN_SLASH:         op = OP_DIVIDE; break;
         default: return; // Unreachable
     }
+
+    bool arithmetic = op == OP_ADD || op == OP_SUBTRACT ||
+                      op == OP_MULTIPLY || op == OP_DIVIDE;
+    if (leftType == TYPE_NUMBER && parser->type == TYPE_NUMBER &&
+        numberInstruction(op) != -1) {
+        op = (OpCode)numberInstruction(op);
+    }
+    // An operator that fails raises a runtime error, so code after it only
+    // ever sees the type it produces on success
+    parser->type = arithmetic ? TYPE_NUMBER : TYPE_BOOL;
+
+    emitBinaryOp(parser, op, leftStart, leftConstants, rightStart);
 }
 
-static void literal() {
-    switch (parser.previous.type) {
-        case TOKEN_FALSE: emitByte(OP_FALSE); break;
-        case TOKEN_NIL: emitByte(OP_NIL); break;
-        case TOKEN_TRUE: emitByte(OP_TRUE); break;
+static void literal(Parser* parser) {
+    switch (previousType(parser)) {
+        case TOKEN_FALSE: emitByte(parser, OP_FALSE); break;
+        case TOKEN_NIL: emitByte(parser, OP_NIL); break;
+        case TOKEN_TRUE: emitByte(parser, OP_TRUE); break;
         default: return; // Unreachable
     }
+    parser->type = previousType(parser) == TOKEN_NIL ? TYPE_NIL : TYPE_BOOL;
 }
 
 /**
@@ -242,21 +562,44 @@ static void literal() {
  * right parenthesis token. If the closing parenthesis is not found, an error
  * message is reported. It assumes the current token is the opening parenthesis.
  */
-static void grouping() {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+static void grouping(Parser* parser) {
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
 /**
  * Compiles a number literal.
  *
  * This function assumes that the current token is a number literal. It emits
- * the number as a constant bytecode instruction. The value of the number is
- * converted to a double using strtod.
+ * the number as a constant bytecode instruction. The scanner has already
+ * worked out the value of the number.
  */
-static void number() {
-    double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+static void number(Parser* parser) {
+    double value = previousToken(parser).number;
+    emitConstant(parser, NUMBER_VAL(value));
+    parser->type = TYPE_NUMBER;
+}
+
+/**
+ * Compiles a reference to one of the inputs the expression is evaluated with.
+ *
+ * Inputs are only known when the code runs, so an expression using one is
+ * never folded into a constant.
+ */
+static void input(Parser* parser) {
+    // The token is a '$' followed by at least one digit
+    Token token = previousToken(parser);
+    int index = 0;
+    for (int i = 1; i < token.length; i++) {
+        index = index * 10 + (token.start[i] - '0');
+        if (index > UINT8_MAX) {
+            error(parser, "Input number must be at most 255.");
+            return;
+        }
+    }
+
+    emitBytes(parser, OP_INPUT, (uint8_t)index);
+    parser->type = TYPE_UNKNOWN;
 }
 
 /**
@@ -268,15 +611,23 @@ static void number() {
  * bytecode instruction: either OP_NOT for a logical negation or OP_NEGATE for
  * arithmetic negation.
  */
-static void unary() {
-    TokenType operatorType  = parser.previous.type;
+static void unary(Parser* parser) {
+    TokenType operatorType  = previousType(parser);
+    int operandStart = currentChunk(parser)->count;
+    int operandConstants = currentChunk(parser)->constants.count;
 
     // Gets the operand
-    parsePrecedence(PREC_UNARY);
+    parsePrecedence(parser, PREC_UNARY);
 
     switch (operatorType) {
-        case TOKEN_BANG: emitByte(OP_NOT); break;
-        case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+        case TOKEN_BANG:
+            emitUnaryOp(parser, OP_NOT, operandStart, operandConstants);
+            parser->type = TYPE_BOOL;
+            break;
+        case TOKEN_MINUS:
+            emitUnaryOp(parser, OP_NEGATE, operandStart, operandConstants);
+            parser->type = TYPE_NUMBER;
+            break;
         default: return; // Unreachable
     }
 }
@@ -304,6 +655,7 @@ ParseRule rules[] = {
     [TOKEN_IDENTIFIER]    = {NULL,     NULL,   PREC_NONE},
     [TOKEN_STRING]        = {NULL,     NULL,   PREC_NONE},
     [TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE},
+    [TOKEN_INPUT]         = {input,    NULL,   PREC_NONE},
     [TOKEN_AND]           = {NULL,     NULL,   PREC_NONE},
     [TOKEN_CLASS]         = {NULL,     NULL,   PREC_NONE},
     [TOKEN_ELSE]          = {NULL,     NULL,   PREC_NONE},
@@ -337,24 +689,41 @@ ParseRule rules[] = {
  * infix expressions until the precedence of the trailing expressions is
  * less than the given precedence. This is done by repeatedly advancing to the
  * next token and calling the infix rule associated with the current token.
+ * Before each infix rule runs, parser->operandStart and parser->operandConstants
+ * are set to where its left operand begins so that the rule can fold constant
+ * operands.
  *
  * @param precedence the precedence of the expressions to parse
  */
-static void parsePrecedence(Precedence precedence) {
-    advance();
-    ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+static void parsePrecedence(Parser* parser, Precedence precedence) {
+    if (parser->nesting == MAX_NESTING) {
+        errorAtCurrent(parser, "Expression nested too deeply.");
+        // Skip the rest of the input so the callers unwind without recursing
+        while (currentType(parser) != TOKEN_EOF) advance(parser);
+        return;
+    }
+    parser->nesting++;
+
+    advance(parser);
+    ParseFn prefixRule = getRule(previousType(parser))->prefix;
     if (prefixRule == NULL) {
-        error("Expect expression.");
+        error(parser, "Expect expression.");
+        parser->nesting--;
         return;
     }
 
-    prefixRule();
+    int start = currentChunk(parser)->count;
+    int startConstants = currentChunk(parser)->constants.count;
+    prefixRule(parser);
 
-    while (precedence <= getRule(parser.current.type)->precedence) {
-        advance();
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule();
+    while (precedence <= getRule(currentType(parser))->precedence) {
+        advance(parser);
+        ParseFn infixRule = getRule(previousType(parser))->infix;
+        parser->operandStart = start;
+        parser->operandConstants = startConstants;
+        infixRule(parser);
     }
+    parser->nesting--;
 }
 
 /**
@@ -375,8 +744,31 @@ static ParseRule* getRule(TokenType type) {
  * parsePrecedence with the PREC_ASSIGNMENT parameter. This will parse an
  * expression with any precedence since assignment has the lowest precedence.
  */
-static void expression() {
-    parsePrecedence(PREC_ASSIGNMENT);
+static void expression(Parser* parser) {
+    parsePrecedence(parser, PREC_ASSIGNMENT);
+}
+
+/**
+ * Compiles the tokens of the parser's token buffer, or else of its already
+ * initialized scanner, into the provided chunk.
+ *
+ * @param parser the parser whose token buffer or scanner holds the source
+ * @param chunk the chunk where the compiled bytecode will be stored
+ * @return true if the compilation was successful without errors, false otherwise
+ */
+static bool compileTokens(Parser* parser, Chunk* chunk) {
+    parser->compilingChunk = chunk;
+
+    parser->hadError = false;
+    parser->panicMode = false;
+    parser->nesting = 0;
+    parser->type = TYPE_UNKNOWN;
+
+    advance(parser);
+    expression(parser);
+    consume(parser, TOKEN_EOF, "Expect end of expression.");
+    endCompiler(parser);
+    return !parser->hadError;
 }
 
 /**
@@ -387,20 +779,86 @@ static void expression() {
  * end of the source is reached, at which point an OP_RETURN instruction is emitted.
  * Any errors encountered during compilation set the parser's hadError flag to true.
  *
- * @param source the source code to compile
+ * Tokens are scanned one at a time as the parser asks for them. To scan the
+ * whole source first, use compileTokenized().
+ *
+ * @param source the source code to compile, which need not be null-terminated
+ * @param length the length of the source code in bytes
+ * @param chunk the chunk where the compiled bytecode will be stored
+ * @param errors the stream compile errors are reported to
+ * @return true if the compilation was successful without errors, false otherwise
+ */
+bool compile(const char* source, size_t length, Chunk* chunk, FILE* errors) { 
+    Parser parser;
+    parser.tokens = NULL;
+    parser.errors = errors;
+    initScannerN(&parser.scanner, source, length);
+    return compileTokens(&parser, chunk);
+}
+
+/**
+ * Compiles a source that has already been scanned by tokenize().
+ *
+ * The parser steps through the buffer by index instead of copying tokens
+ * around, and the buffer is left as it was, so the same tokens can also be
+ * used for tooling or compiled again.
+ *
+ * @param tokens the tokens of the source, ending with TOKEN_EOF
+ * @param chunk the chunk where the compiled bytecode will be stored
+ * @param errors the stream compile errors are reported to
+ * @return true if the compilation was successful without errors, false otherwise
+ */
+bool compileTokenBuffer(const TokenBuffer* tokens, Chunk* chunk,
+                        FILE* errors) {
+    Parser parser;
+    parser.tokens = tokens;
+    parser.current = -1;
+    parser.previous = -1;
+    parser.errors = errors;
+    return compileTokens(&parser, chunk);
+}
+
+/**
+ * Compiles source code by scanning all of it into a token buffer with
+ * tokenize() first, and then compiling the buffer with compileTokenBuffer().
+ *
+ * The chunk is the same one compile() would produce. A source too long for a
+ * token buffer to address is left to compile().
+ *
+ * @param source the source code to compile, which need not be null-terminated
+ * @param length the length of the source code in bytes
+ * @param chunk the chunk where the compiled bytecode will be stored
+ * @param errors the stream compile errors are reported to
+ * @return true if the compilation was successful without errors, false otherwise
+ */
+bool compileTokenized(const char* source, size_t length, Chunk* chunk,
+                      FILE* errors) {
+    TokenBuffer tokens;
+    initTokenBuffer(&tokens);
+    bool success = tokenize(&tokens, source, length)
+                       ? compileTokenBuffer(&tokens, chunk, errors)
+                       : compile(source, length, chunk, errors);
+    freeTokenBuffer(&tokens);
+    return success;
+}
+
+/**
+ * Compiles source code that is read incrementally from a callback, so that
+ * the whole program never has to be held in memory at once.
+ *
+ * @param refill the callback that supplies the source; see ScannerRefill
+ * @param context an opaque pointer passed to every call of refill
  * @param chunk the chunk where the compiled bytecode will be stored
+ * @param errors the stream compile errors are reported to
  * @return true if the compilation was successful without errors, false otherwise
  */
-bool compile(const char* source, Chunk* chunk) { 
-    initScanner(source);
-    compilingChunk = chunk;
-
-    parser.hadError = false;
-    parser.panicMode = false;
-
-    advance();
-    expression();
-    consume(TOKEN_EOF, "Expect end of expression.");
-    endCompiler();
-    return !parser.hadError;
+bool compileStream(ScannerRefill refill, void* context, Chunk* chunk,
+                   FILE* errors) {
+    Parser parser;
+    parser.tokens = NULL;
+    parser.errors = errors;
+    initScannerStream(&parser.scanner, refill, context);
+    bool success = compileTokens(&parser, chunk);
+    freeScanner(&parser.scanner);
+    return success;
 }
\ No newline at end of file
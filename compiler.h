@@ -1,8 +1,17 @@
 #ifndef clox_compiler_h
 #define clox_compiler_h
 
+#include <stdio.h>
+
+#include "scanner.h"
 #include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+bool compile(const char* source, size_t length, Chunk* chunk, FILE* errors);
+bool compileTokenBuffer(const TokenBuffer* tokens, Chunk* chunk,
+                        FILE* errors);
+bool compileTokenized(const char* source, size_t length, Chunk* chunk,
+                      FILE* errors);
+bool compileStream(ScannerRefill refill, void* context, Chunk* chunk,
+                   FILE* errors);
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include <stdio.h>
 
 #include "debug.h"
+#include "registers.h"
 #include "value.h"
 
 /**
@@ -18,33 +19,149 @@ void disassembleChunk(Chunk* chunk, const char* name) {
     }
 }
 
+/**
+ * Names of the opcodes, indexed by OpCode.
+ */
+static const char* opNames[] = {
+    [OP_CONSTANT]          = "OP_CONSTANT",
+    [OP_CONSTANT_LONG]     = "OP_CONSTANT_LONG",
+    [OP_NIL]               = "OP_NIL",
+    [OP_TRUE]              = "OP_TRUE",
+    [OP_FALSE]             = "OP_FALSE",
+    [OP_ZERO]              = "OP_ZERO",
+    [OP_ONE]               = "OP_ONE",
+    [OP_SMALL_INT]         = "OP_SMALL_INT",
+    [OP_INPUT]             = "OP_INPUT",
+    [OP_EQUAL]             = "OP_EQUAL",
+    [OP_GREATER]           = "OP_GREATER",
+    [OP_LESS]              = "OP_LESS",
+    [OP_NOT_EQUAL]         = "OP_NOT_EQUAL",
+    [OP_GREATER_EQUAL]     = "OP_GREATER_EQUAL",
+    [OP_LESS_EQUAL]        = "OP_LESS_EQUAL",
+    [OP_ADD]               = "OP_ADD",
+    [OP_SUBTRACT]          = "OP_SUBTRACT",
+    [OP_MULTIPLY]          = "OP_MULTIPLY",
+    [OP_DIVIDE]            = "OP_DIVIDE",
+    [OP_NOT]               = "OP_NOT",
+    [OP_NEGATE]            = "OP_NEGATE",
+    [OP_ADD_CONSTANT]      = "OP_ADD_CONSTANT",
+    [OP_SUBTRACT_CONSTANT] = "OP_SUBTRACT_CONSTANT",
+    [OP_MULTIPLY_CONSTANT] = "OP_MULTIPLY_CONSTANT",
+    [OP_DIVIDE_CONSTANT]   = "OP_DIVIDE_CONSTANT",
+    [OP_GREATER_CONSTANT]  = "OP_GREATER_CONSTANT",
+    [OP_LESS_CONSTANT]     = "OP_LESS_CONSTANT",
+    [OP_ADD_SMALL_INT]      = "OP_ADD_SMALL_INT",
+    [OP_SUBTRACT_SMALL_INT] = "OP_SUBTRACT_SMALL_INT",
+    [OP_MULTIPLY_SMALL_INT] = "OP_MULTIPLY_SMALL_INT",
+    [OP_DIVIDE_SMALL_INT]   = "OP_DIVIDE_SMALL_INT",
+    [OP_GREATER_SMALL_INT]  = "OP_GREATER_SMALL_INT",
+    [OP_LESS_SMALL_INT]     = "OP_LESS_SMALL_INT",
+    [OP_ADD_NUMBER]           = "OP_ADD_NUMBER",
+    [OP_SUBTRACT_NUMBER]      = "OP_SUBTRACT_NUMBER",
+    [OP_MULTIPLY_NUMBER]      = "OP_MULTIPLY_NUMBER",
+    [OP_DIVIDE_NUMBER]        = "OP_DIVIDE_NUMBER",
+    [OP_GREATER_NUMBER]       = "OP_GREATER_NUMBER",
+    [OP_LESS_NUMBER]          = "OP_LESS_NUMBER",
+    [OP_GREATER_EQUAL_NUMBER] = "OP_GREATER_EQUAL_NUMBER",
+    [OP_LESS_EQUAL_NUMBER]    = "OP_LESS_EQUAL_NUMBER",
+    [OP_RETURN]            = "OP_RETURN",
+};
+
+/**
+ * Returns the name of an opcode, as printed in disassembly.
+ *
+ * @param instruction the opcode
+ * @return its name, or NULL if it is not a known opcode
+ */
+const char* opcodeName(uint8_t instruction) {
+    if (instruction > OP_RETURN) return NULL;
+    return opNames[instruction];
+}
+
 /**
  * Prints a bytecode instruction that has a single constant argument.
  *
+ * @param out the stream to print to
  * @param name the name of the instruction
  * @param chunk the chunk of bytecode that contains the instruction
  * @param offset the offset of the instruction in the chunk
  *
  * @return the offset of the instruction after the one that was disassembled
  */
-static int constantInstruction(const char* name, Chunk* chunk, int offset) {
+static int constantInstruction(FILE* out, const char* name, Chunk* chunk,
+                               int offset) {
     uint8_t constant = chunk->code[offset + 1];
-    printf("%-16s %4d '", name, constant);
-    printValue(chunk->constants.values[constant]);
-    printf("'\n");
+    fprintf(out, "%-16s %4d '", name, constant);
+    fprintValue(out, chunk->constants.values[constant]);
+    fprintf(out, "'\n");
+    return offset + 2;
+}
+
+/**
+ * Prints a bytecode instruction that has a single 24-bit constant argument.
+ *
+ * @param out the stream to print to
+ * @param name the name of the instruction
+ * @param chunk the chunk of bytecode that contains the instruction
+ * @param offset the offset of the instruction in the chunk
+ *
+ * @return the offset of the instruction after the one that was disassembled
+ */
+static int constantLongInstruction(FILE* out, const char* name, Chunk* chunk,
+                                   int offset) {
+    int constant = chunk->code[offset + 1] |
+                   (chunk->code[offset + 2] << 8) |
+                   (chunk->code[offset + 3] << 16);
+    fprintf(out, "%-16s %4d '", name, constant);
+    fprintValue(out, chunk->constants.values[constant]);
+    fprintf(out, "'\n");
+    return offset + 4;
+}
+
+/**
+ * Prints an OP_INPUT instruction along with the input it loads.
+ *
+ * @param out the stream to print to
+ * @param name the name of the instruction
+ * @param chunk the chunk of bytecode that contains the instruction
+ * @param offset the offset of the instruction in the chunk
+ *
+ * @return the offset of the instruction after the one that was disassembled
+ */
+static int inputInstruction(FILE* out, const char* name, Chunk* chunk,
+                            int offset) {
+    fprintf(out, "%-16s    $%d\n", name, chunk->code[offset + 1]);
+    return offset + 2;
+}
+
+/**
+ * Prints an instruction whose operand is a number held in the instruction
+ * itself, such as OP_SMALL_INT, along with that number.
+ *
+ * @param out the stream to print to
+ * @param name the name of the instruction
+ * @param chunk the chunk of bytecode that contains the instruction
+ * @param offset the offset of the instruction in the chunk
+ *
+ * @return the offset of the instruction after the one that was disassembled
+ */
+static int smallIntInstruction(FILE* out, const char* name, Chunk* chunk,
+                               int offset) {
+    fprintf(out, "%-16s %4d\n", name, (int8_t)chunk->code[offset + 1]);
     return offset + 2;
 }
 
 /**
  * Prints out a simple bytecode instruction with no additional arguments.
  *
+ * @param out the stream to print to
  * @param name the name of the instruction
  * @param offset the offset of the instruction in the chunk
  *
  * @return the offset of the instruction after the one that was disassembled
  */
-static int simpleInstruction(const char* name, int offset) {
-    printf("%s\n", name);
+static int simpleInstruction(FILE* out, const char* name, int offset) {
+    fprintf(out, "%s\n", name);
     return offset + 1;
 }
 
@@ -57,46 +174,204 @@ static int simpleInstruction(const char* name, int offset) {
  * @return the offset of the instruction after the one that was disassembled
  */
 int disassembleInstruction(Chunk* chunk, int offset) {
-    printf("%04d ", offset); // 04 -> outputs a 4 digit output (filled with 0s if necessary)
+    return fdisassembleInstruction(stdout, chunk, offset);
+}
+
+/**
+ * Disassembles a single bytecode instruction and prints it to a stream.
+ *
+ * @param out the stream to print to
+ * @param chunk the chunk of bytecode that contains the instruction
+ * @param offset the offset of the instruction in the chunk
+ *
+ * @return the offset of the instruction after the one that was disassembled
+ */
+int fdisassembleInstruction(FILE* out, Chunk* chunk, int offset) {
+    fprintf(out, "%04d ", offset); // 04 -> outputs a 4 digit output (filled with 0s if necessary)
     if (offset > 0 &&
-        chunk->lines[offset] == chunk->lines[offset - 1]) { // Does not print the line if repeated
-        printf("   | ");
+        getLine(chunk, offset) == getLine(chunk, offset - 1)) { // Does not print the line if repeated
+        fprintf(out, "   | ");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        fprintf(out, "%4d ", getLine(chunk, offset));
     }
 
     uint8_t instruction = chunk->code[offset];
+    const char* name = opcodeName(instruction);
+    if (name == NULL) {
+        fprintf(out, "Unknown opcode %d\n", instruction);
+        return offset + 1;
+    }
+
+    if (instruction == OP_INPUT) {
+        return inputInstruction(out, name, chunk, offset);
+    }
+    switch (instruction) {
+        case OP_SMALL_INT:
+        case OP_ADD_SMALL_INT:
+        case OP_SUBTRACT_SMALL_INT:
+        case OP_MULTIPLY_SMALL_INT:
+        case OP_DIVIDE_SMALL_INT:
+        case OP_GREATER_SMALL_INT:
+        case OP_LESS_SMALL_INT:
+            return smallIntInstruction(out, name, chunk, offset);
+        default:
+            break;
+    }
+    switch (instructionLength(instruction)) {
+        case 2:
+            return constantInstruction(out, name, chunk, offset);
+        case 4:
+            return constantLongInstruction(out, name, chunk, offset);
+        default:
+            return simpleInstruction(out, name, offset);
+    }
+}
+
+/**
+ * Disassembles a chunk of register code and prints it.
+ *
+ * @param chunk the chunk of register code to disassemble
+ * @param name the name of the chunk, used for display purposes
+ */
+void disassembleRegisterChunk(Chunk* chunk, const char* name) {
+    printf("== %s ==\n", name);
+
+    for (int offset = 0; offset < chunk->count;) {
+        offset = disassembleRegisterInstruction(chunk, offset);
+    }
+}
+
+/**
+ * Reads the 16-bit operand at the given offset of a register instruction.
+ *
+ * @param chunk the chunk of register code that contains the instruction
+ * @param offset the offset of the operand in the chunk
+ *
+ * @return the operand
+ */
+static int readOperand(Chunk* chunk, int offset) {
+    return chunk->code[offset] | (chunk->code[offset + 1] << 8);
+}
+
+/**
+ * Names of the register opcodes, indexed by RegisterOpCode.
+ */
+static const char* registerOpNames[] = {
+    [REG_LOAD]             = "REG_LOAD",
+    [REG_INPUT]            = "REG_INPUT",
+    [REG_EQUAL_RR]         = "REG_EQUAL_RR",
+    [REG_EQUAL_RK]         = "REG_EQUAL_RK",
+    [REG_NOT_EQUAL_RR]     = "REG_NOT_EQUAL_RR",
+    [REG_NOT_EQUAL_RK]     = "REG_NOT_EQUAL_RK",
+    [REG_GREATER_RR]       = "REG_GREATER_RR",
+    [REG_GREATER_RK]       = "REG_GREATER_RK",
+    [REG_LESS_RR]          = "REG_LESS_RR",
+    [REG_LESS_RK]          = "REG_LESS_RK",
+    [REG_GREATER_EQUAL_RR] = "REG_GREATER_EQUAL_RR",
+    [REG_GREATER_EQUAL_RK] = "REG_GREATER_EQUAL_RK",
+    [REG_LESS_EQUAL_RR]    = "REG_LESS_EQUAL_RR",
+    [REG_LESS_EQUAL_RK]    = "REG_LESS_EQUAL_RK",
+    [REG_ADD_RR]           = "REG_ADD_RR",
+    [REG_ADD_RK]           = "REG_ADD_RK",
+    [REG_SUBTRACT_RR]      = "REG_SUBTRACT_RR",
+    [REG_SUBTRACT_RK]      = "REG_SUBTRACT_RK",
+    [REG_SUBTRACT_KR]      = "REG_SUBTRACT_KR",
+    [REG_MULTIPLY_RR]      = "REG_MULTIPLY_RR",
+    [REG_MULTIPLY_RK]      = "REG_MULTIPLY_RK",
+    [REG_DIVIDE_RR]        = "REG_DIVIDE_RR",
+    [REG_DIVIDE_RK]        = "REG_DIVIDE_RK",
+    [REG_DIVIDE_KR]        = "REG_DIVIDE_KR",
+    [REG_NOT]              = "REG_NOT",
+    [REG_NEGATE]           = "REG_NEGATE",
+    [REG_RETURN]           = "REG_RETURN",
+    [REG_RETURN_CONSTANT]  = "REG_RETURN_CONSTANT",
+};
+
+/**
+ * Tells whether an operand of a register instruction names a constant
+ * rather than a register.
+ *
+ * @param instruction the opcode of the instruction
+ * @param operand the position of the operand, starting from 0
+ *
+ * @return true if the operand is a constant index
+ */
+static bool isConstantOperand(uint8_t instruction, int operand) {
     switch (instruction) {
-        case OP_CONSTANT:
-            return constantInstruction("OP_CONSTANT", chunk, offset);
-        case OP_NIL:
-            return simpleInstruction("OP_NIL", offset);
-        case OP_TRUE:
-            return simpleInstruction("OP_TRUE", offset);
-        case OP_FALSE:
-            return simpleInstruction("OP_FALSE", offset);
-        case OP_EQUAL:
-            return simpleInstruction("OP_EQUAL", offset);
-        case OP_GREATER:
-            return simpleInstruction("OP_GREATER", offset);
-        case OP_LESS:
-            return simpleInstruction("OP_LESS", offset);
-        case OP_ADD:
-            return simpleInstruction("OP_ADD", offset);
-        case OP_SUBTRACT:
-            return simpleInstruction("OP_SUBTRACT", offset);
-        case OP_MULTIPLY:
-            return simpleInstruction("OP_MULTIPLY", offset);
-        case OP_DIVIDE:
-            return simpleInstruction("OP_DIVIDE", offset);
-        case OP_NOT:
-            return simpleInstruction("OP_NOT", offset);
-        case OP_NEGATE:
-            return simpleInstruction("OP_NEGATE", offset);
-        case OP_RETURN:
-            return simpleInstruction("OP_RETURN", offset);
+        case REG_RETURN_CONSTANT:
+            return operand == 0;
+        case REG_LOAD:
+        case REG_SUBTRACT_KR:
+        case REG_DIVIDE_KR:
+            return operand == 1;
+        case REG_EQUAL_RK:
+        case REG_NOT_EQUAL_RK:
+        case REG_GREATER_RK:
+        case REG_LESS_RK:
+        case REG_GREATER_EQUAL_RK:
+        case REG_LESS_EQUAL_RK:
+        case REG_ADD_RK:
+        case REG_SUBTRACT_RK:
+        case REG_MULTIPLY_RK:
+        case REG_DIVIDE_RK:
+            return operand == 2;
         default:
-            printf("Unknown opcode %d\n", instruction);
-            return offset + 1;
+            return false;
+    }
+}
+
+/**
+ * Disassembles a single register instruction and prints it.
+ *
+ * @param chunk the chunk of register code that contains the instruction
+ * @param offset the offset of the instruction in the chunk
+ *
+ * @return the offset of the instruction after the one that was disassembled
+ */
+int disassembleRegisterInstruction(Chunk* chunk, int offset) {
+    return fdisassembleRegisterInstruction(stdout, chunk, offset);
+}
+
+/**
+ * Disassembles a single register instruction and prints it to a stream.
+ *
+ * Registers are printed as rN and constants as kN followed by their value.
+ *
+ * @param out the stream to print to
+ * @param chunk the chunk of register code that contains the instruction
+ * @param offset the offset of the instruction in the chunk
+ *
+ * @return the offset of the instruction after the one that was disassembled
+ */
+int fdisassembleRegisterInstruction(FILE* out, Chunk* chunk, int offset) {
+    fprintf(out, "%04d ", offset);
+    if (offset > 0 && getLine(chunk, offset) == getLine(chunk, offset - 1)) {
+        fprintf(out, "   | ");
+    } else {
+        fprintf(out, "%4d ", getLine(chunk, offset));
+    }
+
+    uint8_t instruction = chunk->code[offset];
+    if (instruction > REG_RETURN_CONSTANT) {
+        fprintf(out, "Unknown opcode %d\n", instruction);
+        return offset + 1;
+    }
+    fprintf(out, "%-20s", registerOpNames[instruction]);
+
+    int length = registerInstructionLength(instruction);
+    for (int i = 1; i < length; i += 2) {
+        int operand = readOperand(chunk, offset + i);
+        bool isConstant = isConstantOperand(instruction, i / 2);
+        if (instruction == REG_INPUT && i / 2 == 1) {
+            fprintf(out, " $%d", operand);
+        } else if (isConstant) {
+            fprintf(out, " k%d '", operand);
+            fprintValue(out, chunk->constants.values[operand]);
+            fprintf(out, "'");
+        } else {
+            fprintf(out, " r%d", operand);
+        }
     }
+    fprintf(out, "\n");
+    return offset + length;
 }
\ No newline at end of file
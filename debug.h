@@ -1,9 +1,16 @@
 #ifndef clox_debug_h
 #define clox_debug_h
 
+#include <stdio.h>
+
 #include "chunk.h"
 
 void disassembleChunk(Chunk* chunk, const char* name);
 int disassembleInstruction(Chunk* chunk, int offset);
+int fdisassembleInstruction(FILE* out, Chunk* chunk, int offset);
+const char* opcodeName(uint8_t instruction);
+void disassembleRegisterChunk(Chunk* chunk, const char* name);
+int disassembleRegisterInstruction(Chunk* chunk, int offset);
+int fdisassembleRegisterInstruction(FILE* out, Chunk* chunk, int offset);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,696 @@
+#include <stdatomic.h>
+#include <string.h>
+
+#include "jit.h"
+#include "memory.h"
+
+#ifdef JIT_X64
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// The most executable memory compiled chunks may hold, and how much they do
+static atomic_size_t jitLimit = JIT_DEFAULT_LIMIT;
+static atomic_size_t jitUsed = 0;
+
+/**
+ * Marks a JitCode as holding no native code.
+ *
+ * @param jit the code to initialize
+ */
+void initJit(JitCode* jit) {
+    jit->code = NULL;
+    jit->size = 0;
+    jit->resultSlot = 0;
+    jit->result = SLOT_NIL;
+}
+
+/**
+ * Sets how much executable memory compiled chunks may hold at once.
+ *
+ * Chunks compiled before the limit is lowered keep their code. Once the limit
+ * is reached, compileJit() fails until enough code is freed, so the chunks it
+ * was given are interpreted instead. A limit of 0 turns the JIT off.
+ *
+ * @param bytes the new limit
+ */
+void setJitLimit(size_t bytes) {
+    atomic_store_explicit(&jitLimit, bytes, memory_order_relaxed);
+}
+
+/**
+ * Returns how much executable memory compiled chunks hold, across all
+ * threads.
+ *
+ * @return the bytes mapped for native code
+ */
+size_t jitMemoryUsed(void) {
+    return atomic_load_explicit(&jitUsed, memory_order_relaxed);
+}
+
+#ifdef JIT_X64
+
+// Native code is called as
+//     int code(uint64_t* slots, const Value* inputs, int inputCount)
+// so slots is in rdi, inputs in rsi and inputCount in edx. Every stack slot
+// of the chunk has a fixed 8 byte home in slots, since chunks have no jumps
+// and so every instruction runs at a depth known while compiling. Numbers are
+// kept there as raw doubles and bools as 0 or 1; nil needs no storage. The
+// code returns 0 on success and 1 when it has to bail out to the interpreter.
+typedef int (*JitFunction)(uint64_t* slots, const Value* inputs,
+                           int inputCount);
+
+// Native code being assembled
+typedef struct {
+    uint8_t* code;
+    int count;
+    int capacity;
+    int* bails;      // Offsets of the jumps to the bail-out, to be patched
+    int bailCount;
+    int bailCapacity;
+    SlotType* types; // What each slot holds at the current instruction
+    int depth;
+    int typeCapacity;
+} Assembler;
+
+static void emitByte(Assembler* as, uint8_t byte) {
+    if (as->capacity < as->count + 1) {
+        int oldCapacity = as->capacity;
+        as->capacity = GROW_CAPACITY(oldCapacity);
+        as->code = GROW_ARRAY(uint8_t, as->code, oldCapacity, as->capacity,
+                              MEMORY_CODE);
+    }
+    as->code[as->count++] = byte;
+}
+
+static void emitBytes(Assembler* as, const uint8_t* bytes, int count) {
+    for (int i = 0; i < count; i++) emitByte(as, bytes[i]);
+}
+
+static void emit32(Assembler* as, uint32_t value) {
+    for (int i = 0; i < 4; i++) emitByte(as, (uint8_t)(value >> (i * 8)));
+}
+
+static void emit64(Assembler* as, uint64_t value) {
+    for (int i = 0; i < 8; i++) emitByte(as, (uint8_t)(value >> (i * 8)));
+}
+
+/**
+ * Emits a conditional jump to the bail-out at the end of the code.
+ *
+ * @param as the assembler
+ * @param condition the low nibble of the jcc opcode, e.g. 0x5 for jne
+ */
+static void emitBail(Assembler* as, uint8_t condition) {
+    emitByte(as, 0x0F);
+    emitByte(as, (uint8_t)(0x80 | condition));
+    if (as->bailCapacity < as->bailCount + 1) {
+        int oldCapacity = as->bailCapacity;
+        as->bailCapacity = GROW_CAPACITY(oldCapacity);
+        as->bails = GROW_ARRAY(int, as->bails, oldCapacity, as->bailCapacity,
+                               MEMORY_CODE);
+    }
+    as->bails[as->bailCount++] = as->count;
+    emit32(as, 0);
+}
+
+// The displacement of a slot from rdi
+#define SLOT(depth) ((uint32_t)(depth) * 8)
+
+// ModRM bytes for [rdi + disp32] and [rsi + disp32] with reg field 0
+#define RDI_DISP32 0x87
+#define RSI_DISP32 0x86
+
+// movsd xmm<reg>, [rdi + slot]
+static void loadNumber(Assembler* as, int reg, int depth) {
+    emitBytes(as, (const uint8_t[]){0xF2, 0x0F, 0x10}, 3);
+    emitByte(as, (uint8_t)(RDI_DISP32 | (reg << 3)));
+    emit32(as, SLOT(depth));
+}
+
+// movsd [rdi + slot], xmm<reg>
+static void storeNumber(Assembler* as, int reg, int depth) {
+    emitBytes(as, (const uint8_t[]){0xF2, 0x0F, 0x11}, 3);
+    emitByte(as, (uint8_t)(RDI_DISP32 | (reg << 3)));
+    emit32(as, SLOT(depth));
+}
+
+// mov rax, [rdi + slot]
+static void loadBits(Assembler* as, int depth) {
+    emitBytes(as, (const uint8_t[]){0x48, 0x8B, RDI_DISP32}, 3);
+    emit32(as, SLOT(depth));
+}
+
+// mov [rdi + slot], rax
+static void storeBits(Assembler* as, int depth) {
+    emitBytes(as, (const uint8_t[]){0x48, 0x89, RDI_DISP32}, 3);
+    emit32(as, SLOT(depth));
+}
+
+// mov qword [rdi + slot], imm32
+static void storeImmediate(Assembler* as, int depth, uint32_t value) {
+    emitBytes(as, (const uint8_t[]){0x48, 0xC7, RDI_DISP32}, 3);
+    emit32(as, SLOT(depth));
+    emit32(as, value);
+}
+
+// movzx eax, al, then stores rax to the slot
+static void storeFlag(Assembler* as, int depth) {
+    emitBytes(as, (const uint8_t[]){0x0F, 0xB6, 0xC0}, 3);
+    storeBits(as, depth);
+}
+
+// mov rax, imm64; movq xmm1, rax
+static void loadConstant(Assembler* as, double number) {
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    emitBytes(as, (const uint8_t[]){0x48, 0xB8}, 2);
+    emit64(as, bits);
+    emitBytes(as, (const uint8_t[]){0x66, 0x48, 0x0F, 0x6E, 0xC8}, 5);
+}
+
+/**
+ * Records what the next slot holds, pushing it.
+ *
+ * @param as the assembler
+ * @param type what the slot holds
+ */
+static void pushSlot(Assembler* as, SlotType type) {
+    if (as->typeCapacity < as->depth + 1) {
+        int oldCapacity = as->typeCapacity;
+        as->typeCapacity = GROW_CAPACITY(oldCapacity);
+        as->types = GROW_ARRAY(SlotType, as->types, oldCapacity,
+                               as->typeCapacity, MEMORY_CODE);
+    }
+    as->types[as->depth++] = type;
+}
+
+/**
+ * Emits a constant into the next slot.
+ *
+ * @param as the assembler
+ * @param value the constant
+ */
+static void pushConstant(Assembler* as, Value value) {
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        emitBytes(as, (const uint8_t[]){0x48, 0xB8}, 2);
+        emit64(as, bits);
+        storeBits(as, as->depth);
+        pushSlot(as, SLOT_NUMBER);
+    } else if (IS_BOOL(value)) {
+        storeImmediate(as, as->depth, AS_BOOL(value) ? 1 : 0);
+        pushSlot(as, SLOT_BOOL);
+    } else {
+        pushSlot(as, SLOT_NIL);
+    }
+}
+
+/**
+ * Emits $index into the next slot, bailing out unless it was given and is a
+ * number.
+ *
+ * @param as the assembler
+ * @param index the input to load
+ */
+static void pushInput(Assembler* as, int index) {
+    // cmp edx, index; jle bail
+    emitBytes(as, (const uint8_t[]){0x81, 0xFA}, 2);
+    emit32(as, (uint32_t)index);
+    emitBail(as, 0xE);
+
+    uint32_t address = (uint32_t)(index * sizeof(Value));
+#ifdef NAN_BOXING
+    // mov rax, [rsi + address]; mov rcx, rax; mov r8, QNAN
+    emitBytes(as, (const uint8_t[]){0x48, 0x8B, RSI_DISP32}, 3);
+    emit32(as, address);
+    emitBytes(as, (const uint8_t[]){0x48, 0x89, 0xC1, 0x49, 0xB8}, 5);
+    emit64(as, QNAN);
+    // and rcx, r8; cmp rcx, r8; je bail
+    emitBytes(as, (const uint8_t[]){0x4C, 0x21, 0xC1, 0x4C, 0x39, 0xC1}, 6);
+    emitBail(as, 0x4);
+#else
+    // cmp dword [rsi + address], VAL_NUMBER; jne bail
+    emitBytes(as, (const uint8_t[]){0x81, 0xBE}, 2);
+    emit32(as, address + (uint32_t)offsetof(Value, type));
+    emit32(as, VAL_NUMBER);
+    emitBail(as, 0x5);
+    // mov rax, [rsi + address]
+    emitBytes(as, (const uint8_t[]){0x48, 0x8B, RSI_DISP32}, 3);
+    emit32(as, address + (uint32_t)offsetof(Value, as));
+#endif
+    storeBits(as, as->depth);
+    pushSlot(as, SLOT_NUMBER);
+}
+
+/**
+ * Emits an arithmetic operator on the top two slots, or on the top slot and
+ * a constant.
+ *
+ * @param as the assembler
+ * @param opcode the low byte of the SSE2 scalar double instruction
+ * @param constant the right operand, or NULL to take it from the stack
+ * @return false if the operator would raise a runtime error
+ */
+static bool emitArithmetic(Assembler* as, uint8_t opcode,
+                           const Value* constant) {
+    int right = as->depth - 1;
+    int left = constant == NULL ? as->depth - 2 : right;
+    if (as->types[left] != SLOT_NUMBER) return false;
+    if (constant == NULL ? as->types[right] != SLOT_NUMBER
+                         : !IS_NUMBER(*constant)) {
+        return false;
+    }
+
+    loadNumber(as, 0, left);
+    if (constant == NULL) {
+        loadNumber(as, 1, right);
+    } else {
+        loadConstant(as, AS_NUMBER(*constant));
+    }
+    // <op>sd xmm0, xmm1
+    emitBytes(as, (const uint8_t[]){0xF2, 0x0F, opcode, 0xC1}, 4);
+    storeNumber(as, 0, left);
+    as->depth = left + 1;
+    return true;
+}
+
+/**
+ * Emits a numeric comparison of the top two slots, or of the top slot and a
+ * constant.
+ *
+ * @param as the assembler
+ * @param swap whether to compare right with left rather than left with right
+ * @param setcc the low byte of the setcc instruction that takes the result
+ * @param constant the right operand, or NULL to take it from the stack
+ * @return false if the comparison would raise a runtime error
+ */
+static bool emitComparison(Assembler* as, bool swap, uint8_t setcc,
+                           const Value* constant) {
+    int right = as->depth - 1;
+    int left = constant == NULL ? as->depth - 2 : right;
+    if (as->types[left] != SLOT_NUMBER) return false;
+    if (constant == NULL ? as->types[right] != SLOT_NUMBER
+                         : !IS_NUMBER(*constant)) {
+        return false;
+    }
+
+    loadNumber(as, 0, left);
+    if (constant == NULL) {
+        loadNumber(as, 1, right);
+    } else {
+        loadConstant(as, AS_NUMBER(*constant));
+    }
+    // ucomisd xmm0, xmm1 or ucomisd xmm1, xmm0, then set<cc> al. Unordered
+    // operands set CF and ZF, so seta is false and setbe true for NaN,
+    // matching a > b and !(a > b) in C.
+    emitBytes(as, (const uint8_t[]){0x66, 0x0F, 0x2E, swap ? 0xC8 : 0xC1},
+              4);
+    emitBytes(as, (const uint8_t[]){0x0F, setcc, 0xC0}, 3);
+    storeFlag(as, left);
+    as->types[left] = SLOT_BOOL;
+    as->depth = left + 1;
+    return true;
+}
+
+/**
+ * Emits OP_EQUAL or OP_NOT_EQUAL on the top two slots, which may hold any
+ * mix of types, with the same result as valuesEqual().
+ *
+ * @param as the assembler
+ * @param negate whether the instruction is OP_NOT_EQUAL
+ */
+static void emitEquality(Assembler* as, bool negate) {
+    int left = as->depth - 2;
+    int right = as->depth - 1;
+    SlotType type = as->types[left];
+
+    if (type != as->types[right]) {
+        storeImmediate(as, left, negate);
+    } else if (type == SLOT_NIL) {
+        storeImmediate(as, left, !negate);
+    } else if (type == SLOT_BOOL) {
+        // mov rax, [left]; cmp rax, [right]; sete/setne al
+        loadBits(as, left);
+        emitBytes(as, (const uint8_t[]){0x48, 0x3B, RDI_DISP32}, 3);
+        emit32(as, SLOT(right));
+        emitBytes(as, (const uint8_t[]){0x0F, negate ? 0x95 : 0x94, 0xC0}, 3);
+        storeFlag(as, left);
+    } else {
+        // ucomisd xmm0, xmm1, then equal is ZF && !PF and not equal is
+        // !ZF || PF, so NaN is unequal to everything
+        loadNumber(as, 0, left);
+        loadNumber(as, 1, right);
+        emitBytes(as, (const uint8_t[]){0x66, 0x0F, 0x2E, 0xC1}, 4);
+        if (negate) {
+            // setne al; setp cl; or al, cl
+            emitBytes(as, (const uint8_t[]){0x0F, 0x95, 0xC0, 0x0F, 0x9A,
+                                            0xC1, 0x08, 0xC8}, 8);
+        } else {
+            // sete al; setnp cl; and al, cl
+            emitBytes(as, (const uint8_t[]){0x0F, 0x94, 0xC0, 0x0F, 0x9B,
+                                            0xC1, 0x20, 0xC8}, 8);
+        }
+        storeFlag(as, left);
+    }
+    as->types[left] = SLOT_BOOL;
+    as->depth = left + 1;
+}
+
+/**
+ * Emits OP_NOT on the top slot.
+ *
+ * @param as the assembler
+ */
+static void emitNot(Assembler* as) {
+    int top = as->depth - 1;
+    switch (as->types[top]) {
+        case SLOT_NIL:    storeImmediate(as, top, 1); break;
+        case SLOT_NUMBER: storeImmediate(as, top, 0); break;
+        case SLOT_BOOL:
+            // xor rax, 1
+            loadBits(as, top);
+            emitBytes(as, (const uint8_t[]){0x48, 0x83, 0xF0, 0x01}, 4);
+            storeBits(as, top);
+            break;
+    }
+    as->types[top] = SLOT_BOOL;
+}
+
+/**
+ * Emits OP_NEGATE on the top slot.
+ *
+ * @param as the assembler
+ * @return false if the slot does not hold a number
+ */
+static bool emitNegate(Assembler* as) {
+    int top = as->depth - 1;
+    if (as->types[top] != SLOT_NUMBER) return false;
+
+    // mov rcx, sign bit; xor rax, rcx
+    loadBits(as, top);
+    emitBytes(as, (const uint8_t[]){0x48, 0xB9}, 2);
+    emit64(as, (uint64_t)1 << 63);
+    emitBytes(as, (const uint8_t[]){0x48, 0x31, 0xC8}, 3);
+    storeBits(as, top);
+    return true;
+}
+
+/**
+ * Emits one of the *_SMALL_INT superinstructions. Its number is built into
+ * the native code just as a constant operand would be.
+ *
+ * @param as the assembler
+ * @param instruction the superinstruction
+ * @param operand its right operand
+ * @return false if the operator would raise a runtime error
+ */
+static bool emitSmallInt(Assembler* as, uint8_t instruction, int8_t operand) {
+    Value number = NUMBER_VAL(operand);
+    switch (instruction) {
+        case OP_ADD_SMALL_INT:      return emitArithmetic(as, 0x58, &number);
+        case OP_SUBTRACT_SMALL_INT: return emitArithmetic(as, 0x5C, &number);
+        case OP_MULTIPLY_SMALL_INT: return emitArithmetic(as, 0x59, &number);
+        case OP_DIVIDE_SMALL_INT:   return emitArithmetic(as, 0x5E, &number);
+        case OP_GREATER_SMALL_INT:
+            return emitComparison(as, false, 0x97, &number);
+        default:
+            return emitComparison(as, true, 0x97, &number);
+    }
+}
+
+/**
+ * Assembles one instruction.
+ *
+ * @param as the assembler
+ * @param chunk the chunk being compiled
+ * @param ip the instruction
+ * @return false if it cannot be compiled
+ */
+static bool assembleInstruction(Assembler* as, Chunk* chunk,
+                                const uint8_t* ip) {
+    Value* constants = chunk->constants.values;
+    uint8_t instruction = ip[0];
+    switch (instruction) {
+        case OP_CONSTANT: pushConstant(as, constants[ip[1]]); return true;
+        case OP_CONSTANT_LONG:
+            pushConstant(as, constants[ip[1] | (ip[2] << 8) | (ip[3] << 16)]);
+            return true;
+        case OP_NIL:   pushConstant(as, NIL_VAL); return true;
+        case OP_TRUE:  pushConstant(as, BOOL_VAL(true)); return true;
+        case OP_FALSE: pushConstant(as, BOOL_VAL(false)); return true;
+        case OP_ZERO:
+        case OP_ONE:
+        case OP_SMALL_INT: {
+            double number;
+            readInlineNumber(ip, &number);
+            pushConstant(as, NUMBER_VAL(number));
+            return true;
+        }
+        case OP_INPUT: pushInput(as, ip[1]); return true;
+        case OP_NOT:   emitNot(as); return true;
+        case OP_NEGATE: return emitNegate(as);
+        case OP_EQUAL:     emitEquality(as, false); return true;
+        case OP_NOT_EQUAL: emitEquality(as, true); return true;
+        case OP_ADD_CONSTANT:
+            return emitArithmetic(as, 0x58, &constants[ip[1]]);
+        case OP_SUBTRACT_CONSTANT:
+            return emitArithmetic(as, 0x5C, &constants[ip[1]]);
+        case OP_MULTIPLY_CONSTANT:
+            return emitArithmetic(as, 0x59, &constants[ip[1]]);
+        case OP_DIVIDE_CONSTANT:
+            return emitArithmetic(as, 0x5E, &constants[ip[1]]);
+        case OP_GREATER_CONSTANT:
+            return emitComparison(as, false, 0x97, &constants[ip[1]]);
+        case OP_LESS_CONSTANT:
+            return emitComparison(as, true, 0x97, &constants[ip[1]]);
+        case OP_ADD_SMALL_INT:
+        case OP_SUBTRACT_SMALL_INT:
+        case OP_MULTIPLY_SMALL_INT:
+        case OP_DIVIDE_SMALL_INT:
+        case OP_GREATER_SMALL_INT:
+        case OP_LESS_SMALL_INT:
+            return emitSmallInt(as, instruction, (int8_t)ip[1]);
+        default:
+            break;
+    }
+
+    switch (genericInstruction(instruction)) {
+        case OP_ADD:           return emitArithmetic(as, 0x58, NULL);
+        case OP_SUBTRACT:      return emitArithmetic(as, 0x5C, NULL);
+        case OP_MULTIPLY:      return emitArithmetic(as, 0x59, NULL);
+        case OP_DIVIDE:        return emitArithmetic(as, 0x5E, NULL);
+        // seta after ucomisd a, b is a > b, and after ucomisd b, a is a < b;
+        // setbe gives their negations
+        case OP_GREATER:       return emitComparison(as, false, 0x97, NULL);
+        case OP_LESS:          return emitComparison(as, true, 0x97, NULL);
+        case OP_GREATER_EQUAL: return emitComparison(as, true, 0x96, NULL);
+        case OP_LESS_EQUAL:    return emitComparison(as, false, 0x96, NULL);
+        default:               return false;
+    }
+}
+
+/**
+ * Assembles a whole chunk, up to its first OP_RETURN.
+ *
+ * @param as the assembler, empty
+ * @param jit where the result slot is recorded
+ * @param chunk the chunk to compile
+ * @return false if any instruction cannot be compiled
+ */
+static bool assembleChunk(Assembler* as, JitCode* jit, Chunk* chunk) {
+    int offset = 0;
+    for (;;) {
+        if (offset >= chunk->count) return false;
+        uint8_t instruction = chunk->code[offset];
+        if (instruction > OP_RETURN) return false;
+        int length = instructionLength(instruction);
+        if (offset + length > chunk->count) return false;
+
+        // Stack code never underflows, but bytecode read from a cache is
+        // only as good as the file it came from
+        int pops = 0;
+        switch (genericInstruction(instruction)) {
+            case OP_EQUAL: case OP_NOT_EQUAL:
+            case OP_GREATER: case OP_LESS:
+            case OP_GREATER_EQUAL: case OP_LESS_EQUAL:
+            case OP_ADD: case OP_SUBTRACT:
+            case OP_MULTIPLY: case OP_DIVIDE:
+                pops = 2;
+                break;
+            case OP_CONSTANT: case OP_CONSTANT_LONG:
+            case OP_NIL: case OP_TRUE: case OP_FALSE: case OP_INPUT:
+            case OP_ZERO: case OP_ONE: case OP_SMALL_INT:
+                break;
+            default:
+                pops = 1;
+                break;
+        }
+        if (as->depth < pops) return false;
+
+        if (instruction == OP_RETURN) {
+            jit->resultSlot = as->depth - 1;
+            jit->result = as->types[as->depth - 1];
+            // xor eax, eax; ret
+            emitBytes(as, (const uint8_t[]){0x31, 0xC0, 0xC3}, 3);
+            break;
+        }
+        if (!assembleInstruction(as, chunk, &chunk->code[offset])) {
+            return false;
+        }
+        offset += length;
+    }
+
+    // The bail-out: mov eax, 1; ret
+    int bail = as->count;
+    emitBytes(as, (const uint8_t[]){0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3}, 6);
+    for (int i = 0; i < as->bailCount; i++) {
+        int from = as->bails[i] + 4;
+        uint32_t distance = (uint32_t)(bail - from);
+        for (int j = 0; j < 4; j++) {
+            as->code[as->bails[i] + j] = (uint8_t)(distance >> (j * 8));
+        }
+    }
+    return true;
+}
+
+/**
+ * Copies assembled code into freshly mapped executable memory, if the JIT
+ * limit allows it.
+ *
+ * The memory is never writable and executable at the same time.
+ *
+ * @param jit where the code is stored
+ * @param as the assembled code
+ * @return false if the limit was reached or the memory could not be mapped
+ */
+static bool installCode(JitCode* jit, Assembler* as) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = ((size_t)as->count + page - 1) / page * page;
+
+    size_t used = atomic_fetch_add_explicit(&jitUsed, size,
+                                            memory_order_relaxed);
+    if (used + size > atomic_load_explicit(&jitLimit, memory_order_relaxed)) {
+        atomic_fetch_sub_explicit(&jitUsed, size, memory_order_relaxed);
+        return false;
+    }
+
+    void* code = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        atomic_fetch_sub_explicit(&jitUsed, size, memory_order_relaxed);
+        return false;
+    }
+    memcpy(code, as->code, (size_t)as->count);
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size);
+        atomic_fetch_sub_explicit(&jitUsed, size, memory_order_relaxed);
+        return false;
+    }
+
+    jit->code = code;
+    jit->size = size;
+    return true;
+}
+
+#endif
+
+/**
+ * Compiles a chunk to native code.
+ *
+ * Each instruction becomes a fixed template of machine code with its operands
+ * patched in, so nothing is dispatched at run time. What every stack slot
+ * holds is worked out while compiling, since inputs are the only values not
+ * known then and the code checks they are numbers as it loads them. An
+ * instruction that would always raise a runtime error, such as adding nil to
+ * a number, stops the chunk from being compiled at all.
+ *
+ * @param jit where the native code goes; it holds none if this fails
+ * @param chunk the chunk to compile, which must end with OP_RETURN
+ * @return false if the chunk cannot be compiled on this platform, contains
+ *         an instruction that always fails, or does not fit under the limit
+ *         set by setJitLimit()
+ */
+bool compileJit(JitCode* jit, Chunk* chunk) {
+    initJit(jit);
+#ifdef JIT_X64
+    if (atomic_load_explicit(&jitLimit, memory_order_relaxed) == 0) {
+        return false;
+    }
+
+    Assembler as;
+    memset(&as, 0, sizeof(as));
+    bool compiled = assembleChunk(&as, jit, chunk) && installCode(jit, &as);
+
+    FREE_ARRAY(uint8_t, as.code, as.capacity, MEMORY_CODE);
+    FREE_ARRAY(int, as.bails, as.bailCapacity, MEMORY_CODE);
+    FREE_ARRAY(SlotType, as.types, as.typeCapacity, MEMORY_CODE);
+    if (!compiled) initJit(jit);
+    return compiled;
+#else
+    (void)chunk;
+    return false;
+#endif
+}
+
+/**
+ * Runs native code made by compileJit().
+ *
+ * @param jit the compiled chunk, which must hold code
+ * @param slots scratch space for at least as many values as the chunk's
+ *        maxStack
+ * @param inputs the values $0, $1, ... load
+ * @param inputCount the number of inputs
+ * @param result where the value of the chunk is stored on success
+ * @return false if the code bailed out because an input was missing or was
+ *         not a number; the chunk must then be run by the interpreter, which
+ *         either handles the input or reports the error
+ */
+bool runJit(const JitCode* jit, Value* slots, const Value* inputs,
+            int inputCount, Value* result) {
+#ifdef JIT_X64
+    JitFunction function;
+    memcpy(&function, &jit->code, sizeof(function));
+    uint64_t* bits = (uint64_t*)(void*)slots;
+    if (function(bits, inputs, inputCount) != 0) return false;
+
+    uint64_t slot = bits[jit->resultSlot];
+    switch (jit->result) {
+        case SLOT_NIL:  *result = NIL_VAL; break;
+        case SLOT_BOOL: *result = BOOL_VAL(slot != 0); break;
+        case SLOT_NUMBER: {
+            double number;
+            memcpy(&number, &slot, sizeof(number));
+            *result = NUMBER_VAL(number);
+            break;
+        }
+    }
+    return true;
+#else
+    (void)jit;
+    (void)slots;
+    (void)inputs;
+    (void)inputCount;
+    (void)result;
+    return false;
+#endif
+}
+
+/**
+ * Frees native code made by compileJit(), returning its memory to the JIT
+ * limit.
+ *
+ * @param jit the code to free; it may hold none
+ */
+void freeJit(JitCode* jit) {
+#ifdef JIT_X64
+    if (jit->code != NULL) {
+        munmap(jit->code, jit->size);
+        atomic_fetch_sub_explicit(&jitUsed, jit->size, memory_order_relaxed);
+    }
+#endif
+    initJit(jit);
+}
\ No newline at end of file
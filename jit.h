@@ -0,0 +1,41 @@
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "chunk.h"
+#include "value.h"
+
+// Native code is only generated for x86-64 with the System V calling
+// convention (Linux, macOS and the BSDs). Elsewhere, or when built with
+// -DNO_JIT, compileJit() always fails and every chunk is interpreted.
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(NO_JIT)
+#define JIT_X64
+#endif
+
+// How many bytes of executable memory compiled chunks may hold at once,
+// unless setJitLimit() changes it
+#define JIT_DEFAULT_LIMIT (16 * 1024 * 1024)
+
+// What a stack slot of compiled code is known to hold
+typedef enum {
+    SLOT_NIL,
+    SLOT_BOOL,
+    SLOT_NUMBER,
+} SlotType;
+
+// A chunk compiled to native code by compileJit()
+typedef struct {
+    void* code;       // Executable memory; NULL if the chunk is not compiled
+    size_t size;      // The bytes mapped at code
+    int resultSlot;   // The slot OP_RETURN returns
+    SlotType result;  // What that slot holds
+} JitCode;
+
+void initJit(JitCode* jit);
+bool compileJit(JitCode* jit, Chunk* chunk);
+bool runJit(const JitCode* jit, Value* slots, const Value* inputs,
+            int inputCount, Value* result);
+void freeJit(JitCode* jit);
+void setJitLimit(size_t bytes);
+size_t jitMemoryUsed(void);
+
+#endif
\ No newline at end of file
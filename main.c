@@ -3,98 +3,328 @@
 #include <string.h>
 
 #include "common.h"
+#include "batch.h"
+#include "bytecode.h"
 #include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
+#include "jit.h"
+#include "memory.h"
+#include "profiler.h"
+#include "source.h"
 #include "vm.h"
 
+/**
+ * Reads one line of any length, without its newline.
+ *
+ * @param stream the stream to read from
+ * @param line the buffer to read into, grown as needed and reused across calls
+ * @param capacity the size of the buffer, updated when it grows
+ * @return the length of the line, or -1 at the end of the stream
+ */
+static long readLine(FILE* stream, char** line, size_t* capacity) {
+    size_t length = 0;
+    for (;;) {
+        if (*capacity - length < 2) {
+            size_t oldCapacity = *capacity;
+            *capacity = GROW_CAPACITY(oldCapacity);
+            *line = GROW_ARRAY(char, *line, oldCapacity, *capacity,
+                               MEMORY_OTHER);
+        }
+
+        if (!fgets(*line + length, (int)(*capacity - length), stream)) {
+            if (length == 0) return -1;
+            break;
+        }
+        length += strlen(*line + length);
+        if ((*line)[length - 1] == '\n') {
+            (*line)[--length] = '\0';
+            break;
+        }
+    }
+    return (long)length;
+}
+
+/**
+ * Compiles a whole source with the front end the VM was set up for.
+ *
+ * @param vm the virtual machine the chunk is for, which gets the errors
+ * @param source the source code, which does not need to be null-terminated
+ * @param length the length of the source code in bytes
+ * @param chunk the chunk to compile into
+ * @return false if the source had compile errors
+ */
+static bool compileSource(VM* vm, const char* source, size_t length,
+                          Chunk* chunk) {
+    if (vm->scanAhead) return compileTokenized(source, length, chunk, vm->err);
+    return compile(source, length, chunk, vm->err);
+}
+
 /**
  * Enters an interactive REPL mode where the user is prompted to enter code
  * which is then interpreted.
+ *
+ * Lines may be any length. Every line is compiled into the same chunk, which
+ * is reset rather than freed in between, so once the chunk and the line
+ * buffer have grown to fit the input no line allocates anything.
  */
-static void repl() {
-    char line[1024];
+static void repl(VM* vm) {
+    Chunk chunk;
+    initChunk(&chunk);
+    char* line = NULL;
+    size_t capacity = 0;
+
     for (;;) {
         printf("> ");
 
-        if (!fgets(line, sizeof(line), stdin)) {
+        long length = readLine(stdin, &line, &capacity);
+        if (length < 0) {
             printf("\n");
             break;
         }
 
-        interpret(line);
+        resetChunk(&chunk);
+        if (compileSource(vm, line, (size_t)length, &chunk)) {
+            interpretChunk(vm, &chunk);
+        }
     }
+
+    FREE_ARRAY(char, line, capacity, MEMORY_OTHER);
+    freeChunk(&chunk);
 }
 
 /**
- * Reads the contents of a file and returns a null-terminated string.
+ * Loads a file of source code, exiting with status 74 if it cannot be read.
  *
  * @param path the path to the file to read
+ * @return the contents of the file, to be released with closeSource()
+ */
+static SourceFile readFile(const char* path) {
+    SourceFile file;
+    if (!openSource(path, &file, stderr)) exit(74);
+    return file;
+}
+
+/**
+ * Runs a file of source code.
  *
- * @return a null-terminated string containing the contents of the file
+ * @param vm the virtual machine to run the file on
+ * @param path the path to the file to run
  *
- * The returned string is allocated using malloc and the caller is responsible
- * for freeing it. If the file cannot be opened, a message is printed to stderr
- * and the program exits with status 74. If there is not enough memory to read
- * the file, a message is printed to stderr and the program exits with status
- * 74. If the file could not be read (e.g. it is not a regular file), a message
- * is printed to stderr.
+ * Reads the file, interprets it, and exits with an appropriate status code based
+ * on the result of the interpretation.
  */
-static char* readFile(const char* path) {
-    FILE* file = fopen(path, "rb");
-    if (file == NULL) {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(74);
+static void runFile(VM* vm, const char* path) {
+    SourceFile file = readFile(path);
+    InterpretResult result = interpretN(vm, file.source, file.length);
+    closeSource(&file);
+
+    if (result == INTERPRET_COMPILE_ERROR) exit(65);
+    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+}
+
+/**
+ * Supplies source code to the scanner straight from a stdio stream.
+ *
+ * @param context the FILE* to read from
+ * @param buffer the buffer to fill
+ * @param capacity the size of the buffer
+ * @return the number of bytes read, or 0 at the end of the stream
+ */
+static size_t readStream(void* context, char* buffer, size_t capacity) {
+    return fread(buffer, sizeof(char), capacity, (FILE*)context);
+}
+
+/**
+ * Runs source code read from standard input as it arrives.
+ *
+ * Unlike runFile(), the program is never buffered as a whole, so it works for
+ * pipes and sockets of any size. Exits with the same status codes as runFile().
+ */
+static void runStdin(VM* vm) {
+    Chunk chunk;
+    initChunk(&chunk);
+
+    if (!compileStream(readStream, stdin, &chunk, vm->err)) {
+        freeChunk(&chunk);
+        exit(65);
     }
 
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
+    InterpretResult result = interpretChunk(vm, &chunk);
+    freeChunk(&chunk);
+
+    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+}
+
+/**
+ * Runs a file of source code through its bytecode cache.
+ *
+ * @param vm the virtual machine to run the file on
+ * @param path the path to the file to run
+ *
+ * The cache lives next to the source, at the same path with a "c" appended.
+ * If it exists and was compiled from the current contents of the source, the
+ * chunk is loaded from it and compiling is skipped. Otherwise the source is
+ * compiled and the cache is rewritten before running. Failing to write the
+ * cache is not an error.
+ */
+static void runFileCached(VM* vm, const char* path) {
+    SourceFile file = readFile(path);
+    uint64_t hash = hashSource(file.source, file.length);
 
-    char* buffer = (char*)malloc(fileSize + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+    size_t pathLength = strlen(path);
+    char* cachePath = (char*)malloc(pathLength + 2);
+    if (cachePath == NULL) {
+        fprintf(stderr, "Not enough memory to run \"%s\".\n", path);
         exit(74);
     }
+    memcpy(cachePath, path, pathLength);
+    cachePath[pathLength] = 'c';
+    cachePath[pathLength + 1] = '\0';
 
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    if (bytesRead < fileSize) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
+    Chunk chunk;
+    initChunk(&chunk);
+    if (!readBytecode(&chunk, cachePath, hash)) {
+        if (!compileSource(vm, file.source, file.length, &chunk)) {
+            freeChunk(&chunk);
+            free(cachePath);
+            closeSource(&file);
+            exit(65);
+        }
+        writeBytecode(&chunk, cachePath, hash);
     }
+    free(cachePath);
+    closeSource(&file);
+
+    InterpretResult result = interpretChunk(vm, &chunk);
+    freeChunk(&chunk);
 
-    buffer[bytesRead] = '\0';
-    fclose(file);
-    return buffer;
+    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
 /**
- * Runs a file of source code.
+ * Prints how to invoke clox and exits with status 64.
+ */
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: clox [options] [--cache] [path | -]\n"
+            "       clox [options] --batch [-j jobs] (path | @manifest)...\n"
+            "Options:\n"
+            "  --mem-stats         print memory statistics on exit\n"
+            "  --profile[=cycles]  print an opcode profile on exit, optionally\n"
+            "                      timing each instruction (stack backend only)\n"
+            "  --jit               compile to native code where possible\n"
+            "  --jit-limit=BYTES   cap the executable memory --jit may use\n"
+            "  --registers         run on the register backend\n"
+            "  --tokens            scan the whole source before parsing it\n"
+            "  --trace             print each instruction as it runs\n"
+            "--profile and --trace do not apply to --batch, and turn --jit\n"
+            "off. --tokens does not apply to --batch or to standard input,\n"
+            "which is always compiled as it is read.\n");
+    exit(64);
+}
+
+/**
+ * Runs the scripts named after "--batch" on a pool of worker threads.
  *
- * @param path the path to the file to run
+ * @param argc the number of command line arguments
+ * @param argv the command line arguments
  *
- * Reads the file, interprets it, and exits with an appropriate status code based
- * on the result of the interpretation.
+ * @param backend the backend every worker runs the scripts on
+ *
+ * Accepts an optional "-j N" to choose the number of workers, then any mix of
+ * script paths and "@manifest" arguments. Exits with the status returned by
+ * runBatch().
  */
-static void runFile(const char* path) {
-    char* source = readFile(path);
-    InterpretResult result = interpret(source);
-    free(source);
+static void batchMode(int argc, const char* argv[], Backend backend) {
+    int first = 2;
+    int jobs = 0;
+    if (argc > 3 && strcmp(argv[2], "-j") == 0) {
+        jobs = atoi(argv[3]);
+        first = 4;
+    }
 
-    if (result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    if (first == argc) usage();
+
+    exit(runBatch(argv + first, argc - first, jobs, backend));
+}
+
+/**
+ * Prints the memory statistics to stderr when the program exits.
+ */
+static void printStatsAtExit(void) {
+    printMemoryStats(stderr);
+}
+
+// What --profile records into
+static Profile profile;
+
+/**
+ * Prints the profile to stderr when the program exits.
+ */
+static void printProfileAtExit(void) {
+    printProfile(&profile, stderr);
+    freeProfile(&profile);
 }
 
 int main(int argc, const char* argv[]) {
-    initVM();
+    Backend backend = BACKEND_STACK;
+    bool trace = false;
+    bool profiling = false;
+    bool scanAhead = false;
+
+    // Options that apply to every mode come before it
+    while (argc >= 2) {
+        if (strcmp(argv[1], "--mem-stats") == 0) {
+            // Nothing has been allocated yet, so nothing goes uncounted
+            enableMemoryStats();
+            atexit(printStatsAtExit);
+        } else if (strcmp(argv[1], "--registers") == 0) {
+            backend = BACKEND_REGISTER;
+        } else if (strcmp(argv[1], "--jit") == 0) {
+            backend = BACKEND_JIT;
+        } else if (strncmp(argv[1], "--jit-limit=", 12) == 0) {
+            setJitLimit((size_t)strtoull(argv[1] + 12, NULL, 10));
+        } else if (strcmp(argv[1], "--tokens") == 0) {
+            scanAhead = true;
+        } else if (strcmp(argv[1], "--trace") == 0) {
+            trace = true;
+        } else if (strcmp(argv[1], "--profile") == 0 ||
+                   strcmp(argv[1], "--profile=cycles") == 0) {
+            if (!profiling) atexit(printProfileAtExit);
+            profiling = true;
+            initProfile(&profile, argv[1][9] == '=');
+        } else {
+            break;
+        }
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        batchMode(argc, argv, backend);
+    }
+
+    VM vm;
+    initVM(&vm);
+    vm.backend = backend;
+    if (trace) vm.trace = true;
+    vm.scanAhead = scanAhead;
+    if (profiling) vm.profile = &profile;
 
     if (argc == 1) {
-        repl();
+        repl(&vm);
+    } else if (argc == 2 && strcmp(argv[1], "-") == 0) {
+        runStdin(&vm);
     } else if (argc == 2) {
-        runFile(argv[1]);
+        runFile(&vm, argv[1]);
+    } else if (argc == 3 && strcmp(argv[1], "--cache") == 0) {
+        runFileCached(&vm, argv[2]);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        usage();
     }
 
-    freeVM();
+    freeVM(&vm);
     return 0;
 }
\ No newline at end of file
@@ -1,7 +1,88 @@
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "memory.h"
 
+// Every arena allocation is aligned for any type, as malloc's are.
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+#define ALIGN_UP(size) \
+    (((size) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t size; // The number of usable bytes following the header
+};
+
+// The header is padded so that the bytes following it are aligned.
+#define BLOCK_HEADER ALIGN_UP(sizeof(ArenaBlock))
+#define BLOCK_START(block) ((uint8_t*)(block) + BLOCK_HEADER)
+
+// The allocator reallocate() delegates to on this thread, or NULL for the
+// system allocator. Each thread picks its own, so arenas need no locking.
+static _Thread_local const Allocator* currentAllocator = NULL;
+
+typedef struct {
+    atomic_size_t liveBytes;
+    atomic_size_t peakBytes;
+    atomic_size_t allocations;
+} MemoryCounter;
+
+// Indexes of the counters that follow the per-category ones
+#define COUNTER_TOTAL MEMORY_CATEGORY_COUNT
+#define COUNTER_ARENAS (MEMORY_CATEGORY_COUNT + 1)
+
+// Shared by every thread, so a batch run is accounted as a whole.
+static MemoryCounter counters[MEMORY_CATEGORY_COUNT + 2];
+
+// Whether the counters are kept at all; see enableMemoryStats()
+static atomic_bool statsEnabled = false;
+
+static const char* categoryNames[MEMORY_CATEGORY_COUNT] = {
+    [MEMORY_CODE]      = "code",
+    [MEMORY_LINES]     = "lines",
+    [MEMORY_CONSTANTS] = "constants",
+    [MEMORY_SCANNER]   = "scanner",
+    [MEMORY_STACK]     = "stack",
+    [MEMORY_OTHER]     = "other",
+};
+
+/**
+ * Records a change in the size of an allocation.
+ *
+ * @param counter the counter to update
+ * @param oldSize the old size of the allocation, 0 if it is new
+ * @param newSize the new size of the allocation, 0 if it is being freed
+ */
+static void countAllocation(MemoryCounter* counter, size_t oldSize,
+                            size_t newSize) {
+    if (!atomic_load_explicit(&statsEnabled, memory_order_relaxed)) return;
+
+    if (oldSize == 0 && newSize > 0) {
+        atomic_fetch_add_explicit(&counter->allocations, 1,
+                                  memory_order_relaxed);
+    }
+
+    if (newSize < oldSize) {
+        atomic_fetch_sub_explicit(&counter->liveBytes, oldSize - newSize,
+                                  memory_order_relaxed);
+        return;
+    }
+
+    size_t live = atomic_fetch_add_explicit(&counter->liveBytes,
+                                            newSize - oldSize,
+                                            memory_order_relaxed)
+                + (newSize - oldSize);
+    size_t peak = atomic_load_explicit(&counter->peakBytes,
+                                       memory_order_relaxed);
+    while (live > peak &&
+           !atomic_compare_exchange_weak_explicit(&counter->peakBytes, &peak,
+                                                  live, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+        // peak now holds the latest value; retry while ours is larger
+    }
+}
 
 /**
  * Reallocates a block of memory to be of a different size.
@@ -9,13 +90,24 @@
  * @param pointer the block of memory to reallocate
  * @param oldSize the old size of the block of memory
  * @param newSize the new size of the block of memory
+ * @param category what the memory is for, for the statistics
  *
  * If newSize is 0, the memory is freed and NULL is returned. If the
- * reallocation fails, the program exits with status 1.
+ * reallocation fails, the program exits with status 1. The memory comes from
+ * the allocator installed with setAllocator(), if any.
  *
  * @return the reallocated block of memory
  */
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+void* reallocate(void* pointer, size_t oldSize, size_t newSize,
+                 MemoryCategory category) {
+    countAllocation(&counters[category], oldSize, newSize);
+    countAllocation(&counters[COUNTER_TOTAL], oldSize, newSize);
+
+    if (currentAllocator != NULL) {
+        return currentAllocator->reallocate(currentAllocator->context,
+                                            pointer, oldSize, newSize);
+    }
+
     if (newSize == 0) {
         free(pointer);
         return NULL;
@@ -24,4 +116,213 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     void* result = realloc(pointer, newSize);
     if (result == NULL) exit(1);
     return result;
+}
+
+/**
+ * Makes reallocate() use another allocator on the calling thread.
+ *
+ * @param allocator the allocator to use, or NULL for the system allocator
+ * @return the allocator that was in use, so that it can be restored
+ *
+ * Memory must be freed through the same allocator that allocated it.
+ */
+const Allocator* setAllocator(const Allocator* allocator) {
+    const Allocator* previous = currentAllocator;
+    currentAllocator = allocator;
+    return previous;
+}
+
+/**
+ * Starts a new block for an arena and makes it the one allocations come from.
+ *
+ * @param arena the arena to grow
+ * @param size the smallest number of bytes the block must hold
+ *
+ * Requests larger than ARENA_BLOCK_SIZE get a block of their own size. If the
+ * block cannot be allocated, the program exits with status 1.
+ */
+static void addArenaBlock(Arena* arena, size_t size) {
+    if (size < ARENA_BLOCK_SIZE) size = ARENA_BLOCK_SIZE;
+
+    ArenaBlock* block = (ArenaBlock*)malloc(BLOCK_HEADER + size);
+    if (block == NULL) exit(1);
+    countAllocation(&counters[COUNTER_ARENAS], 0, BLOCK_HEADER + size);
+
+    block->next = arena->blocks;
+    block->size = size;
+    arena->blocks = block;
+    arena->top = BLOCK_START(block);
+    arena->limit = arena->top + size;
+}
+
+/**
+ * Implements reallocate() for an arena.
+ *
+ * @param context the Arena to allocate from
+ * @param pointer the block of memory to reallocate
+ * @param oldSize the old size of the block of memory
+ * @param newSize the new size of the block of memory
+ * @return the reallocated block of memory, or NULL if newSize is 0
+ *
+ * The most recent allocation grows, shrinks and is freed in place, which is
+ * the common case for an array being filled. Anything else is copied to a new
+ * allocation and its old bytes are only reclaimed when the arena is reset.
+ */
+static void* arenaReallocate(void* context, void* pointer, size_t oldSize,
+                             size_t newSize) {
+    Arena* arena = (Arena*)context;
+    uint8_t* bytes = (uint8_t*)pointer;
+    bool isLast = bytes != NULL && bytes == arena->last;
+
+    if (newSize == 0) {
+        if (isLast) {
+            arena->top = bytes;
+            arena->last = NULL;
+        }
+        return NULL;
+    }
+
+    size_t size = ALIGN_UP(newSize);
+    if (isLast && (size_t)(arena->limit - bytes) >= size) {
+        arena->top = bytes + size;
+        return bytes;
+    }
+
+    if ((size_t)(arena->limit - arena->top) < size) addArenaBlock(arena, size);
+
+    uint8_t* result = arena->top;
+    arena->top += size;
+    arena->last = result;
+    if (bytes != NULL) {
+        memcpy(result, bytes, oldSize < newSize ? oldSize : newSize);
+    }
+    return result;
+}
+
+/**
+ * Initializes an empty arena. No memory is allocated until it is first used.
+ *
+ * @param arena the arena to initialize
+ *
+ * Pass &arena->allocator to setAllocator() to allocate from it.
+ */
+void initArena(Arena* arena) {
+    arena->blocks = NULL;
+    arena->top = NULL;
+    arena->limit = NULL;
+    arena->last = NULL;
+    arena->allocator.reallocate = arenaReallocate;
+    arena->allocator.context = arena;
+}
+
+/**
+ * Releases every allocation made from an arena in a single step.
+ *
+ * @param arena the arena to reset
+ *
+ * The newest block is kept for the next round of allocations, so an arena
+ * reset after each use settles into making no system allocations at all.
+ */
+void resetArena(Arena* arena) {
+    ArenaBlock* kept = arena->blocks;
+    if (kept == NULL) return;
+
+    ArenaBlock* block = kept->next;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        countAllocation(&counters[COUNTER_ARENAS], BLOCK_HEADER + block->size,
+                        0);
+        free(block);
+        block = next;
+    }
+
+    kept->next = NULL;
+    arena->top = BLOCK_START(kept);
+    arena->limit = arena->top + kept->size;
+    arena->last = NULL;
+}
+
+/**
+ * Releases an arena and all of its blocks.
+ *
+ * @param arena the arena to free
+ */
+void freeArena(Arena* arena) {
+    resetArena(arena);
+    if (arena->blocks != NULL) {
+        countAllocation(&counters[COUNTER_ARENAS],
+                        BLOCK_HEADER + arena->blocks->size, 0);
+        free(arena->blocks);
+    }
+    initArena(arena);
+}
+
+/**
+ * Starts keeping the memory statistics. Until then reallocate() and the
+ * arenas count nothing, so that allocating costs no contended atomic updates
+ * unless the numbers are wanted.
+ *
+ * It must be called before anything is allocated, since memory allocated
+ * uncounted would be counted as it is freed.
+ */
+void enableMemoryStats(void) {
+    atomic_store_explicit(&statsEnabled, true, memory_order_relaxed);
+}
+
+/**
+ * Takes a snapshot of the memory statistics of the whole process.
+ *
+ * @param stats where the snapshot is stored
+ *
+ * Sizes are those requested through reallocate(), so memory freed inside an
+ * arena counts as freed even though the arena only reclaims it on reset; the
+ * blocks the arenas actually hold are reported separately. Every number is 0
+ * unless enableMemoryStats() was called.
+ */
+void getMemoryStats(MemoryStats* stats) {
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT + 2; i++) {
+        MemoryUsage* usage = i == COUNTER_TOTAL ? &stats->total
+                           : i == COUNTER_ARENAS ? &stats->arenas
+                           : &stats->categories[i];
+        usage->liveBytes = atomic_load(&counters[i].liveBytes);
+        usage->peakBytes = atomic_load(&counters[i].peakBytes);
+        usage->allocations = atomic_load(&counters[i].allocations);
+    }
+}
+
+/**
+ * Starts a new measurement: every peak is lowered to the current live bytes
+ * and the allocation counts start again from zero.
+ *
+ * Live bytes are kept, so memory allocated before the reset is still
+ * accounted for when it is freed.
+ */
+void resetMemoryPeaks(void) {
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT + 2; i++) {
+        atomic_store(&counters[i].peakBytes, atomic_load(&counters[i].liveBytes));
+        atomic_store(&counters[i].allocations, 0);
+    }
+}
+
+/**
+ * Prints a table of the memory statistics of the whole process.
+ *
+ * @param file the stream to print to
+ */
+void printMemoryStats(FILE* file) {
+    MemoryStats stats;
+    getMemoryStats(&stats);
+
+    fprintf(file, "%-10s %12s %12s %12s\n", "memory", "live", "peak",
+            "allocations");
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+        MemoryUsage* usage = &stats.categories[i];
+        fprintf(file, "%-10s %12zu %12zu %12zu\n", categoryNames[i],
+                usage->liveBytes, usage->peakBytes, usage->allocations);
+    }
+    fprintf(file, "%-10s %12zu %12zu %12zu\n", "total", stats.total.liveBytes,
+            stats.total.peakBytes, stats.total.allocations);
+    fprintf(file, "%-10s %12zu %12zu %12zu\n", "arenas",
+            stats.arenas.liveBytes, stats.arenas.peakBytes,
+            stats.arenas.allocations);
 }
\ No newline at end of file
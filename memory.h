@@ -1,18 +1,78 @@
 #ifndef clox_memory_h
 #define clox_memory_h
 
+#include <stdio.h>
+
 #include "common.h"
 
 #define GROW_CAPACITY(capacity) \
     ((capacity) < 8 ? 8 : (capacity) * 2)
 
-#define GROW_ARRAY(type, pointer, oldCount, newCount) \
+#define GROW_ARRAY(type, pointer, oldCount, newCount, category) \
     (type*)reallocate(pointer, sizeof(type) * (oldCount), \
-        sizeof(type) * (newCount))
+        sizeof(type) * (newCount), category)
+
+#define FREE_ARRAY(type, pointer, oldCount, category) \
+    reallocate(pointer, sizeof(type) * (oldCount), 0, category)
+
+// What an allocation is for, so that memory use can be broken down by it
+typedef enum {
+    MEMORY_CODE,      // Chunk bytecode
+    MEMORY_LINES,     // Chunk line tables
+    MEMORY_CONSTANTS, // Constant pools and their indexes
+    MEMORY_SCANNER,   // Blocks of streamed source and token buffers
+    MEMORY_STACK,     // VM value stacks
+    MEMORY_OTHER,     // Anything else, e.g. batch bookkeeping
+    MEMORY_CATEGORY_COUNT
+} MemoryCategory;
+
+typedef struct {
+    size_t liveBytes;
+    size_t peakBytes;
+    size_t allocations; // Allocations made, not counting resizes
+} MemoryUsage;
+
+typedef struct {
+    MemoryUsage categories[MEMORY_CATEGORY_COUNT];
+    MemoryUsage total;  // All categories together
+    MemoryUsage arenas; // Blocks arenas hold from the system allocator
+} MemoryStats;
+
+// The size of the blocks an arena carves its allocations out of
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+// A strategy for reallocate(). It has the same contract as reallocate(), with
+// context passed back to it on every call.
+typedef struct {
+    void* (*reallocate)(void* context, void* pointer, size_t oldSize,
+                        size_t newSize);
+    void* context;
+} Allocator;
+
+typedef struct ArenaBlock ArenaBlock;
+
+// A bump allocator whose allocations are all released at once by
+// resetArena() or freeArena(). Freeing a single allocation only reclaims it
+// if it was the most recent one.
+typedef struct {
+    ArenaBlock* blocks; // Newest first; allocations come from the newest
+    uint8_t* top;       // The next free byte of the newest block
+    uint8_t* limit;     // The end of the newest block
+    uint8_t* last;      // The most recent allocation, which can grow in place
+    Allocator allocator;
+} Arena;
+
+void* reallocate(void* pointer, size_t oldSize, size_t newSize,
+                 MemoryCategory category);
+const Allocator* setAllocator(const Allocator* allocator);
 
-#define FREE_ARRAY(type, pointer, oldCount) \
-    reallocate(pointer, sizeof(type) * (oldCount), 0)
+void initArena(Arena* arena);
+void resetArena(Arena* arena);
+void freeArena(Arena* arena);
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void enableMemoryStats(void);
+void getMemoryStats(MemoryStats* stats);
+void resetMemoryPeaks(void);
+void printMemoryStats(FILE* file);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include "optimizer.h"
+
+/**
+ * Finds the superinstruction that applies an operator to a constant right
+ * operand, i.e. the fusion of OP_CONSTANT followed by the given operator.
+ *
+ * @param instruction the operator following the OP_CONSTANT
+ * @return the fused opcode, or -1 if the pair cannot be fused
+ */
+static int fuseConstant(uint8_t instruction) {
+    switch (instruction) {
+        case OP_ADD:      return OP_ADD_CONSTANT;
+        case OP_SUBTRACT: return OP_SUBTRACT_CONSTANT;
+        case OP_MULTIPLY: return OP_MULTIPLY_CONSTANT;
+        case OP_DIVIDE:   return OP_DIVIDE_CONSTANT;
+        case OP_GREATER:  return OP_GREATER_CONSTANT;
+        case OP_LESS:     return OP_LESS_CONSTANT;
+        default:          return -1;
+    }
+}
+
+/**
+ * Finds the superinstruction that applies an operator to a small integer
+ * right operand held in the instruction, i.e. the fusion of an inline number
+ * followed by the given operator.
+ *
+ * @param instruction the operator following the inline number
+ * @return the fused opcode, or -1 if the pair cannot be fused
+ */
+static int fuseSmallInt(uint8_t instruction) {
+    switch (instruction) {
+        case OP_ADD:      return OP_ADD_SMALL_INT;
+        case OP_SUBTRACT: return OP_SUBTRACT_SMALL_INT;
+        case OP_MULTIPLY: return OP_MULTIPLY_SMALL_INT;
+        case OP_DIVIDE:   return OP_DIVIDE_SMALL_INT;
+        case OP_GREATER:  return OP_GREATER_SMALL_INT;
+        case OP_LESS:     return OP_LESS_SMALL_INT;
+        default:          return -1;
+    }
+}
+
+/**
+ * Finds the single instruction equivalent to the given instruction followed
+ * by an OP_NOT.
+ *
+ * @param instruction the instruction preceding the OP_NOT
+ * @return the fused opcode, or -1 if the pair cannot be fused
+ */
+static int fuseNot(uint8_t instruction) {
+    switch (instruction) {
+        case OP_EQUAL:         return OP_NOT_EQUAL;
+        case OP_NOT_EQUAL:     return OP_EQUAL;
+        case OP_GREATER:       return OP_LESS_EQUAL;
+        case OP_LESS:          return OP_GREATER_EQUAL;
+        case OP_GREATER_EQUAL: return OP_LESS;
+        case OP_LESS_EQUAL:    return OP_GREATER;
+        default:               return -1;
+    }
+}
+
+/**
+ * Rewrites common instruction pairs of a finished chunk into single
+ * superinstructions.
+ *
+ * An OP_CONSTANT followed by an arithmetic or comparison operator becomes
+ * the operator's *_CONSTANT form, and a comparison followed by OP_NOT becomes
+ * the negated comparison. An inline number such as OP_ONE followed by one of
+ * those operators becomes its *_SMALL_INT form, which keeps the number in
+ * its operand byte rather than in the constant pool. The fused instruction
+ * takes the line of the operator so runtime errors are still reported where
+ * they were before.
+ *
+ * The rewritten code is written into a fresh chunk, which rebuilds the line
+ * table as it goes, and then replaces the code of the original chunk. The
+ * chunk must not contain jumps, since offsets change as it is compacted.
+ *
+ * @param chunk the chunk to optimize
+ */
+void optimizeChunk(Chunk* chunk) {
+    Chunk optimized;
+    initChunk(&optimized);
+
+    int read = 0;
+    while (read < chunk->count) {
+        uint8_t instruction = chunk->code[read];
+        int length = instructionLength(instruction);
+        int next = read + length;
+
+        if (next < chunk->count) {
+            uint8_t following = chunk->code[next];
+            int fused = -1;
+            int operand = -1; // The fused instruction's operand byte, if any
+            int operator = next; // Where the operator being fused sits
+            double number;
+            if (instruction == OP_CONSTANT) {
+                // The superinstruction checks its operand itself
+                fused = fuseConstant(genericInstruction(following));
+                operand = chunk->code[read + 1];
+            } else if (readInlineNumber(&chunk->code[read], &number)) {
+                fused = fuseSmallInt(genericInstruction(following));
+                operand = (uint8_t)(int8_t)number;
+            } else if (following == OP_NOT) {
+                uint8_t generic = genericInstruction(instruction);
+                fused = fuseNot(generic);
+                operator = read;
+                // A specialized comparison stays specialized when negated
+                if (fused != -1 && generic != instruction) {
+                    fused = numberInstruction((uint8_t)fused);
+                }
+            }
+
+            if (fused != -1) {
+                int line = getLine(chunk, operator);
+                writeChunk(&optimized, (uint8_t)fused, line);
+                if (operand != -1) {
+                    writeChunk(&optimized, (uint8_t)operand, line);
+                } else {
+                    for (int i = 1; i < length; i++) {
+                        writeChunk(&optimized, chunk->code[read + i], line);
+                    }
+                }
+                read = next + 1;
+                continue;
+            }
+        }
+
+        for (int i = 0; i < length; i++) {
+            writeChunk(&optimized, chunk->code[read + i],
+                       getLine(chunk, read + i));
+        }
+        read = next;
+    }
+
+    // Swaps the rewritten code into the chunk and frees the old code
+    Chunk old = *chunk;
+    chunk->count = optimized.count;
+    chunk->capacity = optimized.capacity;
+    chunk->code = optimized.code;
+    chunk->lineCount = optimized.lineCount;
+    chunk->lineCapacity = optimized.lineCapacity;
+    chunk->lines = optimized.lines;
+
+    optimized.count = old.count;
+    optimized.capacity = old.capacity;
+    optimized.code = old.code;
+    optimized.lineCount = old.lineCount;
+    optimized.lineCapacity = old.lineCapacity;
+    optimized.lines = old.lines;
+    freeChunk(&optimized);
+}
\ No newline at end of file
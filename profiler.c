@@ -0,0 +1,293 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "memory.h"
+#include "profiler.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+
+/**
+ * Reads the processor's time stamp counter.
+ *
+ * @return the number of cycles since an arbitrary point
+ */
+static uint64_t readCycles(void) {
+    return __rdtsc();
+}
+#else
+#include <time.h>
+
+/**
+ * Reads a clock in place of a cycle counter, on processors without one that
+ * can be read portably. The profile then reports nanoseconds as cycles.
+ *
+ * @return the number of nanoseconds since an arbitrary point
+ */
+static uint64_t readCycles(void) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+#endif
+
+/**
+ * Initializes an empty profile.
+ *
+ * @param profile the profile to initialize
+ * @param cycles whether to time instructions as well as count them
+ */
+void initProfile(Profile* profile, bool cycles) {
+    memset(profile, 0, sizeof(Profile));
+    profile->cycles = cycles;
+    profile->previous = -1;
+}
+
+/**
+ * Releases everything a profile holds, leaving it empty.
+ *
+ * @param profile the profile to free
+ */
+void freeProfile(Profile* profile) {
+    const Allocator* previous = setAllocator(NULL);
+    FREE_ARRAY(ProfileCounter, profile->lines, profile->lineCapacity,
+               MEMORY_OTHER);
+    FREE_ARRAY(ProfileCounter, profile->instructions,
+               profile->instructionCapacity, MEMORY_OTHER);
+    setAllocator(previous);
+
+    if (profile->listings != NULL) fclose(profile->listings);
+    initProfile(profile, profile->cycles);
+}
+
+/**
+ * Grows an array of counters to hold at least the given number, with the
+ * new ones zeroed.
+ *
+ * The profile outlives the chunks it records, so its arrays always come from
+ * the system allocator rather than the VM's arena.
+ *
+ * @param counters the array to grow
+ * @param capacity the current size of the array, updated in place
+ * @param needed the number of counters it must hold
+ * @return the grown array
+ */
+static ProfileCounter* growCounters(ProfileCounter* counters, int* capacity,
+                                    int needed) {
+    if (needed <= *capacity) return counters;
+
+    int newCapacity = *capacity;
+    while (newCapacity < needed) newCapacity = GROW_CAPACITY(newCapacity);
+
+    const Allocator* previous = setAllocator(NULL);
+    counters = GROW_ARRAY(ProfileCounter, counters, *capacity, newCapacity,
+                          MEMORY_OTHER);
+    setAllocator(previous);
+
+    memset(counters + *capacity, 0,
+           sizeof(ProfileCounter) * (size_t)(newCapacity - *capacity));
+    *capacity = newCapacity;
+    return counters;
+}
+
+/**
+ * Prepares to record a run of a chunk.
+ *
+ * @param profile the profile to record into
+ * @param chunk the chunk about to be run
+ */
+void beginProfile(Profile* profile, Chunk* chunk) {
+    profile->instructions = growCounters(profile->instructions,
+                                         &profile->instructionCapacity,
+                                         chunk->count);
+    memset(profile->instructions, 0,
+           sizeof(ProfileCounter) * (size_t)chunk->count);
+    profile->previous = -1;
+    if (profile->cycles) profile->stamp = readCycles();
+}
+
+/**
+ * Records that the instruction at the given offset is about to run.
+ *
+ * When timing, the cycles since the last call are charged to the instruction
+ * it recorded, and the counter is read again afterwards so the profiler's own
+ * bookkeeping is left out.
+ *
+ * @param profile the profile to record into
+ * @param offset the offset of the instruction in the running chunk
+ */
+void profileInstruction(Profile* profile, int offset) {
+    profile->instructions[offset].count++;
+    if (!profile->cycles) return;
+
+    uint64_t now = readCycles();
+    if (profile->previous >= 0) {
+        profile->instructions[profile->previous].cycles += now - profile->stamp;
+    }
+    profile->previous = offset;
+    profile->stamp = readCycles();
+}
+
+/**
+ * Finishes recording a run of a chunk: charges the last instruction, adds the
+ * counters of every instruction to its opcode and source line, and appends an
+ * annotated disassembly of the chunk to the listings.
+ *
+ * @param profile the profile to record into
+ * @param chunk the chunk that was run
+ */
+void endProfile(Profile* profile, Chunk* chunk) {
+    if (profile->cycles && profile->previous >= 0) {
+        profile->instructions[profile->previous].cycles +=
+            readCycles() - profile->stamp;
+        profile->previous = -1;
+    }
+
+    profile->chunks++;
+    if (profile->listings == NULL) profile->listings = tmpfile();
+    if (profile->listings != NULL) {
+        fprintf(profile->listings, "== chunk %d ==\n", profile->chunks);
+    }
+
+    for (int offset = 0; offset < chunk->count;) {
+        ProfileCounter* counter = &profile->instructions[offset];
+        uint8_t instruction = chunk->code[offset];
+        if (instruction <= OP_RETURN) {
+            profile->opcodes[instruction].count += counter->count;
+            profile->opcodes[instruction].cycles += counter->cycles;
+        }
+
+        int line = getLine(chunk, offset);
+        if (line >= 0) {
+            profile->lines = growCounters(profile->lines,
+                                          &profile->lineCapacity, line + 1);
+            profile->lines[line].count += counter->count;
+            profile->lines[line].cycles += counter->cycles;
+        }
+
+        if (profile->listings == NULL) {
+            offset += instructionLength(instruction);
+            continue;
+        }
+        fprintf(profile->listings, "%12" PRIu64 " ", counter->count);
+        if (profile->cycles) {
+            fprintf(profile->listings, "%14" PRIu64 " ", counter->cycles);
+        }
+        offset = fdisassembleInstruction(profile->listings, chunk, offset);
+    }
+}
+
+/**
+ * Tells what share of a total a part is.
+ *
+ * @param part the part
+ * @param total the total
+ * @return the part as a percentage of the total, or 0 if the total is 0
+ */
+static double percent(uint64_t part, uint64_t total) {
+    return total == 0 ? 0.0 : 100.0 * (double)part / (double)total;
+}
+
+/**
+ * Prints one row of the opcode or line table.
+ *
+ * @param out the stream to print to
+ * @param profile the profile being printed
+ * @param label the name of the row
+ * @param counter the counter the row is for
+ * @param total the sum of all counters in the table
+ */
+static void printRow(FILE* out, Profile* profile, const char* label,
+                     ProfileCounter* counter, ProfileCounter* total) {
+    fprintf(out, "%-22s %12" PRIu64 " %6.2f%%", label, counter->count,
+            percent(counter->count, total->count));
+    if (profile->cycles) {
+        fprintf(out, " %14" PRIu64 " %6.2f%% %10.1f", counter->cycles,
+                percent(counter->cycles, total->cycles),
+                counter->count == 0 ? 0.0
+                    : (double)counter->cycles / (double)counter->count);
+    }
+    fprintf(out, "\n");
+}
+
+/**
+ * Prints the header of the opcode or line table.
+ *
+ * @param out the stream to print to
+ * @param profile the profile being printed
+ * @param label the heading of the first column
+ */
+static void printHeader(FILE* out, Profile* profile, const char* label) {
+    fprintf(out, "%-22s %12s %7s", label, "count", "%");
+    if (profile->cycles) {
+        fprintf(out, " %14s %7s %10s", "cycles", "%", "cycles/op");
+    }
+    fprintf(out, "\n");
+}
+
+// The opcode counters being sorted by compareOpcodes()
+static const ProfileCounter* sortedOpcodes;
+
+/**
+ * Orders opcodes from the most to the least executed, for qsort().
+ */
+static int compareOpcodes(const void* a, const void* b) {
+    uint64_t countA = sortedOpcodes[*(const uint8_t*)a].count;
+    uint64_t countB = sortedOpcodes[*(const uint8_t*)b].count;
+    if (countA != countB) return countA < countB ? 1 : -1;
+    return (int)*(const uint8_t*)a - (int)*(const uint8_t*)b;
+}
+
+/**
+ * Prints the report: every opcode that ran, hottest first, every source line
+ * that ran, and the annotated disassembly of each chunk profiled.
+ *
+ * @param profile the profile to print
+ * @param out the stream to print to
+ */
+void printProfile(Profile* profile, FILE* out) {
+    ProfileCounter total = {0, 0};
+    uint8_t order[OP_RETURN + 1];
+    int opcodes = 0;
+    for (int i = 0; i <= OP_RETURN; i++) {
+        total.count += profile->opcodes[i].count;
+        total.cycles += profile->opcodes[i].cycles;
+        if (profile->opcodes[i].count > 0) order[opcodes++] = (uint8_t)i;
+    }
+    sortedOpcodes = profile->opcodes;
+    qsort(order, (size_t)opcodes, sizeof(uint8_t), compareOpcodes);
+
+    fprintf(out, "== profile of %d chunk%s ==\n", profile->chunks,
+            profile->chunks == 1 ? "" : "s");
+    printHeader(out, profile, "opcode");
+    for (int i = 0; i < opcodes; i++) {
+        printRow(out, profile, opcodeName(order[i]),
+                 &profile->opcodes[order[i]], &total);
+    }
+    printRow(out, profile, "total", &total, &total);
+
+    fprintf(out, "\n");
+    printHeader(out, profile, "line");
+    for (int line = 0; line < profile->lineCapacity; line++) {
+        if (profile->lines[line].count == 0) continue;
+        char label[16];
+        snprintf(label, sizeof(label), "%d", line);
+        printRow(out, profile, label, &profile->lines[line], &total);
+    }
+
+    if (profile->listings == NULL) return;
+    fprintf(out, "\n%12s ", "count");
+    if (profile->cycles) fprintf(out, "%14s ", "cycles");
+    fprintf(out, "disassembly\n");
+
+    rewind(profile->listings);
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), profile->listings)) > 0) {
+        fwrite(buffer, 1, read, out);
+    }
+    fseek(profile->listings, 0, SEEK_END);
+}
\ No newline at end of file
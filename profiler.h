@@ -0,0 +1,38 @@
+#ifndef clox_profiler_h
+#define clox_profiler_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "chunk.h"
+
+// What one instruction, opcode or line has cost so far
+typedef struct {
+    uint64_t count;
+    uint64_t cycles; // Only measured when Profile.cycles is set
+} ProfileCounter;
+
+// Everything recorded by --profile. run() bumps the counter of each
+// instruction of the chunk it is running as it dispatches it, and
+// endProfile() folds those into the totals once the chunk returns.
+typedef struct {
+    bool cycles; // Read the cycle counter around every instruction
+    ProfileCounter opcodes[OP_RETURN + 1];
+    ProfileCounter* lines; // Indexed by source line
+    int lineCapacity;
+    ProfileCounter* instructions; // Indexed by offset in the running chunk
+    int instructionCapacity;
+    int previous; // Offset of the instruction being timed, or -1
+    uint64_t stamp; // Cycle counter when it was dispatched
+    int chunks; // Number of chunks profiled
+    FILE* listings; // Annotated disassembly of every chunk profiled
+} Profile;
+
+void initProfile(Profile* profile, bool cycles);
+void freeProfile(Profile* profile);
+void beginProfile(Profile* profile, Chunk* chunk);
+void profileInstruction(Profile* profile, int offset);
+void endProfile(Profile* profile, Chunk* chunk);
+void printProfile(Profile* profile, FILE* out);
+
+#endif
\ No newline at end of file
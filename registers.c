@@ -0,0 +1,318 @@
+#include "memory.h"
+#include "registers.h"
+
+// A value on the stack of the stack code being translated, which is either
+// already in a register or still a constant that has not been loaded.
+typedef struct {
+    bool isConstant;
+    int index; // Register or constant index in the register chunk
+} Operand;
+
+// The register opcodes an operator of the stack code translates to.
+typedef struct {
+    int rr;      // Both operands in registers
+    int rk;      // A register on the left and a constant on the right
+    int kr;      // A constant on the left, or -1 if the operator has no such form
+    int swapped; // The _RK opcode used with swapped operands when kr is -1
+} BinaryForms;
+
+typedef struct {
+    Chunk* chunk;      // The stack code
+    Chunk* registers;  // The register code being written
+    Operand* operands; // Mirrors the value stack of the stack code
+    int depth;
+    int line;          // The line of the instruction being translated
+    bool ok;           // Cleared when an operand index does not fit
+} Translator;
+
+/**
+ * Returns the number of bytes taken by a register instruction, including its
+ * operands.
+ *
+ * @param instruction the opcode of the instruction
+ * @return the size of the instruction in bytes
+ */
+int registerInstructionLength(uint8_t instruction) {
+    switch (instruction) {
+        case REG_RETURN:
+        case REG_RETURN_CONSTANT:
+            return 3;
+        case REG_LOAD:
+        case REG_INPUT:
+        case REG_NOT:
+        case REG_NEGATE:
+            return 5;
+        default:
+            return 7;
+    }
+}
+
+/**
+ * Finds the register forms of a binary operator of the stack code.
+ *
+ * @param instruction the stack opcode, either an operator or its *_CONSTANT
+ *                    superinstruction
+ * @param forms where the forms are stored
+ * @return true if the instruction is a binary operator
+ */
+static bool binaryForms(uint8_t instruction, BinaryForms* forms) {
+    switch (instruction) {
+        case OP_EQUAL:
+            *forms = (BinaryForms){REG_EQUAL_RR, REG_EQUAL_RK, -1,
+                                   REG_EQUAL_RK};
+            return true;
+        case OP_NOT_EQUAL:
+            *forms = (BinaryForms){REG_NOT_EQUAL_RR, REG_NOT_EQUAL_RK, -1,
+                                   REG_NOT_EQUAL_RK};
+            return true;
+        // k > r is r < k and so on. >= and <= are defined as the negations
+        // of < and >, so their mirrors keep the same NaN behaviour.
+        case OP_GREATER:
+        case OP_GREATER_CONSTANT:
+        case OP_GREATER_SMALL_INT:
+            *forms = (BinaryForms){REG_GREATER_RR, REG_GREATER_RK, -1,
+                                   REG_LESS_RK};
+            return true;
+        case OP_LESS:
+        case OP_LESS_CONSTANT:
+        case OP_LESS_SMALL_INT:
+            *forms = (BinaryForms){REG_LESS_RR, REG_LESS_RK, -1,
+                                   REG_GREATER_RK};
+            return true;
+        case OP_GREATER_EQUAL:
+            *forms = (BinaryForms){REG_GREATER_EQUAL_RR, REG_GREATER_EQUAL_RK,
+                                   -1, REG_LESS_EQUAL_RK};
+            return true;
+        case OP_LESS_EQUAL:
+            *forms = (BinaryForms){REG_LESS_EQUAL_RR, REG_LESS_EQUAL_RK, -1,
+                                   REG_GREATER_EQUAL_RK};
+            return true;
+        case OP_ADD:
+        case OP_ADD_CONSTANT:
+        case OP_ADD_SMALL_INT:
+            *forms = (BinaryForms){REG_ADD_RR, REG_ADD_RK, -1, REG_ADD_RK};
+            return true;
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_CONSTANT:
+        case OP_SUBTRACT_SMALL_INT:
+            *forms = (BinaryForms){REG_SUBTRACT_RR, REG_SUBTRACT_RK,
+                                   REG_SUBTRACT_KR, -1};
+            return true;
+        case OP_MULTIPLY:
+        case OP_MULTIPLY_CONSTANT:
+        case OP_MULTIPLY_SMALL_INT:
+            *forms = (BinaryForms){REG_MULTIPLY_RR, REG_MULTIPLY_RK, -1,
+                                   REG_MULTIPLY_RK};
+            return true;
+        case OP_DIVIDE:
+        case OP_DIVIDE_CONSTANT:
+        case OP_DIVIDE_SMALL_INT:
+            *forms = (BinaryForms){REG_DIVIDE_RR, REG_DIVIDE_RK,
+                                   REG_DIVIDE_KR, -1};
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Writes a byte of register code, on the line of the stack instruction it was
+ * translated from.
+ */
+static void emitByte(Translator* translator, uint8_t byte) {
+    writeChunk(translator->registers, byte, translator->line);
+}
+
+/**
+ * Writes a 16-bit operand, little-endian.
+ */
+static void emitOperand(Translator* translator, int operand) {
+    emitByte(translator, (uint8_t)(operand & 0xff));
+    emitByte(translator, (uint8_t)(operand >> 8));
+}
+
+/**
+ * Writes an instruction with a destination and two source operands.
+ */
+static void emitThree(Translator* translator, int op, int a, int b, int c) {
+    emitByte(translator, (uint8_t)op);
+    emitOperand(translator, a);
+    emitOperand(translator, b);
+    emitOperand(translator, c);
+}
+
+/**
+ * Pushes a constant of the stack code, interning it in the register chunk's
+ * own constant pool.
+ */
+static void pushConstant(Translator* translator, Value value) {
+    int constant = addConstant(translator->registers, value);
+    if (constant > REGISTER_OPERAND_MAX) translator->ok = false;
+    translator->operands[translator->depth++] = (Operand){true, constant};
+}
+
+/**
+ * Makes sure an operand is in a register, loading it if it is a constant.
+ *
+ * @param operand the operand, which is updated to name the register
+ * @param reg the register to load a constant into
+ */
+static void toRegister(Translator* translator, Operand* operand, int reg) {
+    if (!operand->isConstant) return;
+    emitByte(translator, REG_LOAD);
+    emitOperand(translator, reg);
+    emitOperand(translator, operand->index);
+    *operand = (Operand){false, reg};
+}
+
+/**
+ * Translates a binary operator. Its result goes to the register of its left
+ * operand's stack slot, so registers are just the slots of the stack code.
+ */
+static void translateBinary(Translator* translator, BinaryForms* forms) {
+    Operand b = translator->operands[--translator->depth];
+    Operand a = translator->operands[--translator->depth];
+    int dst = translator->depth;
+
+    // The compiler folds these away, but they can still appear when folding
+    // failed, e.g. in nil + nil
+    if (a.isConstant && b.isConstant) toRegister(translator, &a, dst);
+
+    if (!a.isConstant && !b.isConstant) {
+        emitThree(translator, forms->rr, dst, a.index, b.index);
+    } else if (!a.isConstant) {
+        emitThree(translator, forms->rk, dst, a.index, b.index);
+    } else if (forms->kr != -1) {
+        emitThree(translator, forms->kr, dst, a.index, b.index);
+    } else {
+        emitThree(translator, forms->swapped, dst, b.index, a.index);
+    }
+    translator->operands[translator->depth++] = (Operand){false, dst};
+}
+
+/**
+ * Translates an OP_INPUT, loading the input into the register of the slot it
+ * is pushed to.
+ */
+static void translateInput(Translator* translator, int input) {
+    int dst = translator->depth;
+    emitByte(translator, REG_INPUT);
+    emitOperand(translator, dst);
+    emitOperand(translator, input);
+    translator->operands[translator->depth++] = (Operand){false, dst};
+}
+
+/**
+ * Translates a unary operator, which works in place on its operand's slot.
+ */
+static void translateUnary(Translator* translator, RegisterOpCode op) {
+    Operand* operand = &translator->operands[translator->depth - 1];
+    int dst = translator->depth - 1;
+    toRegister(translator, operand, dst);
+    emitByte(translator, (uint8_t)op);
+    emitOperand(translator, dst);
+    emitOperand(translator, operand->index);
+}
+
+/**
+ * Translates the stack code of a chunk into three-address register code.
+ *
+ * Stack slots become registers: the value the stack code would keep in slot
+ * n is kept in register n. Constants are not pushed anywhere; they are kept
+ * as pending operands and folded into the instruction that uses them, so
+ * "a + 1" is a single REG_ADD_RK rather than a push and an add.
+ *
+ * @param chunk the stack code, with its maxStack measured
+ * @param registers an initialized, empty chunk that receives the register
+ *                  code; its maxStack is the number of registers used
+ * @return true if the chunk was translated; false if it uses more registers
+ *         or constants than an operand can name, in which case it should be
+ *         run on the stack backend instead
+ */
+bool translateRegisters(Chunk* chunk, Chunk* registers) {
+    if (chunk->maxStack > REGISTER_OPERAND_MAX) return false;
+
+    Translator translator;
+    translator.chunk = chunk;
+    translator.registers = registers;
+    // A *_CONSTANT superinstruction briefly pushes its constant one slot
+    // past the depth the stack code itself reaches
+    int operandCount = chunk->maxStack + 1;
+    translator.operands = GROW_ARRAY(Operand, NULL, 0, operandCount,
+                                     MEMORY_OTHER);
+    translator.depth = 0;
+    translator.ok = true;
+
+    for (int offset = 0; offset < chunk->count && translator.ok;) {
+        uint8_t instruction = chunk->code[offset];
+        uint8_t* operand = &chunk->code[offset + 1];
+        translator.line = getLine(chunk, offset);
+
+        BinaryForms forms;
+        // Registers are checked the same way whatever the compiler knew
+        switch (genericInstruction(instruction)) {
+            case OP_CONSTANT:
+                pushConstant(&translator, chunk->constants.values[operand[0]]);
+                break;
+            case OP_CONSTANT_LONG: {
+                int constant = operand[0] | (operand[1] << 8) |
+                               (operand[2] << 16);
+                pushConstant(&translator, chunk->constants.values[constant]);
+                break;
+            }
+            case OP_NIL:   pushConstant(&translator, NIL_VAL); break;
+            case OP_TRUE:  pushConstant(&translator, BOOL_VAL(true)); break;
+            case OP_FALSE: pushConstant(&translator, BOOL_VAL(false)); break;
+            case OP_ZERO:
+            case OP_ONE:
+            case OP_SMALL_INT: {
+                double number = 0;
+                readInlineNumber(&chunk->code[offset], &number);
+                pushConstant(&translator, NUMBER_VAL(number));
+                break;
+            }
+            case OP_INPUT: translateInput(&translator, operand[0]); break;
+            case OP_NOT:    translateUnary(&translator, REG_NOT); break;
+            case OP_NEGATE: translateUnary(&translator, REG_NEGATE); break;
+            case OP_ADD_CONSTANT:
+            case OP_SUBTRACT_CONSTANT:
+            case OP_MULTIPLY_CONSTANT:
+            case OP_DIVIDE_CONSTANT:
+            case OP_GREATER_CONSTANT:
+            case OP_LESS_CONSTANT:
+                pushConstant(&translator, chunk->constants.values[operand[0]]);
+                binaryForms(instruction, &forms);
+                translateBinary(&translator, &forms);
+                break;
+            case OP_ADD_SMALL_INT:
+            case OP_SUBTRACT_SMALL_INT:
+            case OP_MULTIPLY_SMALL_INT:
+            case OP_DIVIDE_SMALL_INT:
+            case OP_GREATER_SMALL_INT:
+            case OP_LESS_SMALL_INT:
+                pushConstant(&translator, NUMBER_VAL((int8_t)operand[0]));
+                binaryForms(instruction, &forms);
+                translateBinary(&translator, &forms);
+                break;
+            case OP_RETURN: {
+                Operand result = translator.operands[--translator.depth];
+                emitByte(&translator, result.isConstant ? REG_RETURN_CONSTANT
+                                                        : REG_RETURN);
+                emitOperand(&translator, result.index);
+                break;
+            }
+            default:
+                if (!binaryForms(genericInstruction(instruction), &forms)) {
+                    translator.ok = false;
+                    break;
+                }
+                translateBinary(&translator, &forms);
+                break;
+        }
+        offset += instructionLength(instruction);
+    }
+
+    FREE_ARRAY(Operand, translator.operands, operandCount, MEMORY_OTHER);
+    registers->maxStack = chunk->maxStack;
+    return translator.ok;
+}
\ No newline at end of file
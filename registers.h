@@ -0,0 +1,51 @@
+#ifndef clox_registers_h
+#define clox_registers_h
+
+#include "chunk.h"
+
+// The largest register or constant index a register instruction can name
+#define REGISTER_OPERAND_MAX 0xffff
+
+// Opcodes of the register backend. Every operand is a 16-bit little-endian
+// index: rX names a register, kX a constant. The first operand of every
+// instruction but the returns is the register receiving the result.
+//
+// An operator with a constant operand has an _RK form taking the constant on
+// the right. Only the operators that cannot swap their operands also have a
+// _KR form; the others are emitted with their operands swapped, comparisons
+// being mirrored.
+typedef enum {
+    REG_LOAD,                 // rA = kB
+    REG_INPUT,                // rA = input B
+    REG_EQUAL_RR,             // rA = rB == rC
+    REG_EQUAL_RK,             // rA = rB == kC
+    REG_NOT_EQUAL_RR,
+    REG_NOT_EQUAL_RK,
+    REG_GREATER_RR,
+    REG_GREATER_RK,
+    REG_LESS_RR,
+    REG_LESS_RK,
+    REG_GREATER_EQUAL_RR,
+    REG_GREATER_EQUAL_RK,
+    REG_LESS_EQUAL_RR,
+    REG_LESS_EQUAL_RK,
+    REG_ADD_RR,
+    REG_ADD_RK,
+    REG_SUBTRACT_RR,
+    REG_SUBTRACT_RK,
+    REG_SUBTRACT_KR,          // rA = kB - rC
+    REG_MULTIPLY_RR,
+    REG_MULTIPLY_RK,
+    REG_DIVIDE_RR,
+    REG_DIVIDE_RK,
+    REG_DIVIDE_KR,
+    REG_NOT,                  // rA = !rB
+    REG_NEGATE,               // rA = -rB
+    REG_RETURN,               // return rA
+    REG_RETURN_CONSTANT,      // return kA
+} RegisterOpCode;
+
+bool translateRegisters(Chunk* chunk, Chunk* registers);
+int registerInstructionLength(uint8_t instruction);
+
+#endif
\ No newline at end of file
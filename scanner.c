@@ -1,26 +1,377 @@
+#include <float.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "common.h"
+#include "memory.h"
 #include "scanner.h"
 
-typedef struct {
-    const char* start;
-    const char* current;
-    int line;
-} Scanner;
+// The smallest amount of input requested from a refill callback at once
+#define SCAN_BLOCK_SIZE 4096
+
+// A buffer of streamed input. Blocks are kept in a list from oldest to
+// newest and are freed as soon as no live token points into them.
+struct ScanBlock {
+    struct ScanBlock* next;
+    size_t capacity;
+    char bytes[];
+};
+
+/**
+ * Initializes a scanner with a source string.
+ *
+ * Each Scanner holds all of its own state, so separate scanners can run on
+ * separate threads.
+ *
+ * @param scanner the scanner to initialize
+ * @param source the null-terminated source string to tokenize
+ */
+void initScanner(Scanner* scanner, const char* source) {
+    initScannerN(scanner, source, strlen(source));
+}
+
+/**
+ * Initializes a scanner with a source buffer of a known length.
+ *
+ * The buffer does not need to be null-terminated; the scanner never reads
+ * past source + length, so it can scan a memory-mapped file in place.
+ *
+ * @param scanner the scanner to initialize
+ * @param source the source buffer to tokenize
+ * @param length the number of bytes in the buffer
+ */
+void initScannerN(Scanner* scanner, const char* source, size_t length) {
+    scanner->start = source;
+    scanner->current = source;
+    scanner->end = source + length;
+    scanner->line = 1;
+    scanner->refill = NULL;
+    scanner->refillContext = NULL;
+    scanner->oldestBlock = NULL;
+    scanner->newestBlock = NULL;
+    scanner->tokenBlocks[0] = NULL;
+    scanner->tokenBlocks[1] = NULL;
+}
+
+/**
+ * Initializes the scanner to read its source incrementally from a callback.
+ *
+ * The callback is asked for more input whenever the scanner runs out, so a
+ * program can be compiled while it is still arriving. Only the text of the
+ * last two tokens returned is kept alive, which is all the parser looks at.
+ * The scanner must be released with freeScanner() once compiling is done.
+ *
+ * @param scanner the scanner to initialize
+ * @param refill the callback that supplies input; it returns 0 at the end
+ * @param context an opaque pointer passed to every call of refill
+ */
+void initScannerStream(Scanner* scanner, ScannerRefill refill, void* context) {
+    initScannerN(scanner, "", 0);
+    scanner->refill = refill;
+    scanner->refillContext = context;
+}
+
+/**
+ * Frees every block of streamed input held by the scanner. Tokens returned
+ * by the scanner must not be used afterwards.
+ *
+ * @param scanner the scanner to free
+ */
+void freeScanner(Scanner* scanner) {
+    ScanBlock* block = scanner->oldestBlock;
+    while (block != NULL) {
+        ScanBlock* next = block->next;
+        reallocate(block, sizeof(ScanBlock) + block->capacity + 1, 0,
+                   MEMORY_SCANNER);
+        block = next;
+    }
+    initScannerN(scanner, "", 0);
+}
+
+/**
+ * Reads more input from the refill callback into a new block.
+ *
+ * The text of the token being scanned is copied to the front of the new
+ * block so tokens are always contiguous. The block is null-terminated just
+ * past its data, as a source string would be.
+ *
+ * @return true if any input was read, false at the end of the stream
+ */
+static bool refillScanner(Scanner* scanner) {
+    size_t kept = (size_t)(scanner->end - scanner->start);
+    size_t capacity = SCAN_BLOCK_SIZE;
+    while (capacity < kept * 2) capacity *= 2;
+
+    ScanBlock* block = (ScanBlock*)reallocate(NULL, 0,
+                                              sizeof(ScanBlock) + capacity + 1,
+                                              MEMORY_SCANNER);
+    block->next = NULL;
+    block->capacity = capacity;
+    memcpy(block->bytes, scanner->start, kept);
+
+    size_t read = scanner->refill(scanner->refillContext, block->bytes + kept,
+                                 capacity - kept);
+    if (read == 0) {
+        reallocate(block, sizeof(ScanBlock) + capacity + 1, 0, MEMORY_SCANNER);
+        scanner->refill = NULL;
+        return false;
+    }
+    block->bytes[kept + read] = '\0';
+
+    size_t current = (size_t)(scanner->current - scanner->start);
+    scanner->start = block->bytes;
+    scanner->current = block->bytes + current;
+    scanner->end = block->bytes + kept + read;
+
+    if (scanner->newestBlock == NULL) {
+        scanner->oldestBlock = block;
+    } else {
+        scanner->newestBlock->next = block;
+    }
+    scanner->newestBlock = block;
+    return true;
+}
+
+/**
+ * Records that a token has been handed to the parser and frees the blocks
+ * that no live token points into anymore.
+ */
+static void retainToken(Scanner* scanner) {
+    scanner->tokenBlocks[0] = scanner->tokenBlocks[1];
+    scanner->tokenBlocks[1] = scanner->newestBlock;
+
+    while (scanner->oldestBlock != NULL &&
+           scanner->oldestBlock != scanner->newestBlock &&
+           scanner->oldestBlock != scanner->tokenBlocks[0] &&
+           scanner->oldestBlock != scanner->tokenBlocks[1]) {
+        ScanBlock* block = scanner->oldestBlock;
+        scanner->oldestBlock = block->next;
+        reallocate(block, sizeof(ScanBlock) + block->capacity + 1, 0,
+                   MEMORY_SCANNER);
+    }
+}
+
+/**
+ * Checks that at least the given number of bytes can be read from the
+ * current position, asking a stream for more input if needed.
+ *
+ * @param count the number of bytes needed
+ * @return true if that many bytes are available
+ */
+static bool hasBytes(Scanner* scanner, size_t count) {
+    while (scanner->end - scanner->current < (ptrdiff_t)count) {
+        if (scanner->refill == NULL || !refillScanner(scanner)) return false;
+    }
+    return true;
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SCANNER_SIMD
+
+// One 16-byte block of source; a lane mask has one bit per byte
+typedef __m128i ByteBlock;
+#define BLOCK_BITS_PER_BYTE 1
+#define BLOCK_FULL_MASK ((uint64_t)0xffff)
+
+static inline ByteBlock loadBlock(const char* p) {
+    return _mm_loadu_si128((const __m128i*)p);
+}
 
-Scanner scanner;
+static inline ByteBlock equalTo(ByteBlock block, char c) {
+    return _mm_cmpeq_epi8(block, _mm_set1_epi8(c));
+}
+
+static inline ByteBlock inRange(ByteBlock block, char low, char high) {
+    // (c - low) <= (high - low) as unsigned bytes, via max since SSE2 has no
+    // unsigned compare
+    ByteBlock offset = _mm_sub_epi8(block, _mm_set1_epi8(low));
+    ByteBlock limit = _mm_set1_epi8((char)(high - low));
+    return _mm_cmpeq_epi8(_mm_max_epu8(offset, limit), limit);
+}
+
+static inline ByteBlock either(ByteBlock a, ByteBlock b) {
+    return _mm_or_si128(a, b);
+}
+
+static inline ByteBlock toLower(ByteBlock block) {
+    return _mm_or_si128(block, _mm_set1_epi8(0x20));
+}
+
+static inline uint64_t laneMask(ByteBlock block) {
+    return (uint32_t)_mm_movemask_epi8(block);
+}
+
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SCANNER_SIMD
+
+// One 16-byte block of source; a lane mask has four bits per byte
+typedef uint8x16_t ByteBlock;
+#define BLOCK_BITS_PER_BYTE 4
+#define BLOCK_FULL_MASK UINT64_MAX
+
+static inline ByteBlock loadBlock(const char* p) {
+    return vld1q_u8((const uint8_t*)p);
+}
+
+static inline ByteBlock equalTo(ByteBlock block, char c) {
+    return vceqq_u8(block, vdupq_n_u8((uint8_t)c));
+}
+
+static inline ByteBlock inRange(ByteBlock block, char low, char high) {
+    ByteBlock offset = vsubq_u8(block, vdupq_n_u8((uint8_t)low));
+    return vcleq_u8(offset, vdupq_n_u8((uint8_t)(high - low)));
+}
+
+static inline ByteBlock either(ByteBlock a, ByteBlock b) {
+    return vorrq_u8(a, b);
+}
+
+static inline ByteBlock toLower(ByteBlock block) {
+    return vorrq_u8(block, vdupq_n_u8(0x20));
+}
+
+static inline uint64_t laneMask(ByteBlock block) {
+    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(block), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+#endif
+
+#ifdef SCANNER_SIMD
+#define BLOCK_SIZE 16
+
+static inline ByteBlock blankLanes(ByteBlock block) {
+    return either(either(equalTo(block, ' '), equalTo(block, '\t')),
+                  equalTo(block, '\r'));
+}
+
+static inline ByteBlock digitLanes(ByteBlock block) {
+    return inRange(block, '0', '9');
+}
+
+static inline ByteBlock identifierLanes(ByteBlock block) {
+    // Setting bit 0x20 maps 'A'-'Z' onto 'a'-'z' without creating new letters
+    return either(either(inRange(toLower(block), 'a', 'z'), digitLanes(block)),
+                  equalTo(block, '_'));
+}
+
+/**
+ * Skips whole blocks of bytes that all belong to a character class and
+ * returns the first byte that does not, or the start of the last partial
+ * block. The scalar loops of the scanner finish off whatever is left.
+ *
+ * @param p the first byte to check
+ * @param end the end of the available source
+ * @param lanes the function marking the bytes of a block in the class
+ * @return the first byte not skipped
+ */
+static inline const char* skipBlocks(const char* p, const char* end,
+                                     ByteBlock (*lanes)(ByteBlock)) {
+    while (end - p >= BLOCK_SIZE) {
+        uint64_t outside = ~laneMask(lanes(loadBlock(p))) & BLOCK_FULL_MASK;
+        if (outside != 0) {
+            return p + __builtin_ctzll(outside) / BLOCK_BITS_PER_BYTE;
+        }
+        p += BLOCK_SIZE;
+    }
+    return p;
+}
+#endif
+
+/**
+ * Skips spaces, tabs and carriage returns from p onwards.
+ *
+ * @param p the first byte to check
+ * @param end the end of the available source
+ * @return the first byte that is not skipped
+ */
+static const char* skipBlanks(const char* p, const char* end) {
+#ifdef SCANNER_SIMD
+    return skipBlocks(p, end, blankLanes);
+#else
+    (void)end;
+    return p;
+#endif
+}
+
+/**
+ * Skips identifier characters (letters, digits and underscores) from p
+ * onwards.
+ *
+ * @param p the first byte to check
+ * @param end the end of the available source
+ * @return the first byte that is not skipped
+ */
+static const char* skipIdentifierChars(const char* p, const char* end) {
+#ifdef SCANNER_SIMD
+    return skipBlocks(p, end, identifierLanes);
+#else
+    (void)end;
+    return p;
+#endif
+}
+
+/**
+ * Skips decimal digits from p onwards.
+ *
+ * @param p the first byte to check
+ * @param end the end of the available source
+ * @return the first byte that is not skipped
+ */
+static const char* skipDigits(const char* p, const char* end) {
+#ifdef SCANNER_SIMD
+    return skipBlocks(p, end, digitLanes);
+#else
+    (void)end;
+    return p;
+#endif
+}
+
+/**
+ * Skips the body of a string up to its closing quote, counting the line
+ * feeds skipped over.
+ *
+ * @param p the first byte to check
+ * @param end the end of the available source
+ * @param lines incremented once for every line feed skipped
+ * @return the first byte that is not skipped
+ */
+static const char* skipStringBody(const char* p, const char* end, int* lines) {
+#ifdef SCANNER_SIMD
+    while (end - p >= BLOCK_SIZE) {
+        ByteBlock block = loadBlock(p);
+        uint64_t quotes = laneMask(equalTo(block, '"'));
+        uint64_t newlines = laneMask(equalTo(block, '\n'));
+        if (quotes != 0) {
+            uint64_t beforeQuote = (quotes & (~quotes + 1)) - 1;
+            *lines += __builtin_popcountll(newlines & beforeQuote) /
+                      BLOCK_BITS_PER_BYTE;
+            return p + __builtin_ctzll(quotes) / BLOCK_BITS_PER_BYTE;
+        }
+        *lines += __builtin_popcountll(newlines) / BLOCK_BITS_PER_BYTE;
+        p += BLOCK_SIZE;
+    }
+#else
+    (void)end;
+    (void)lines;
+#endif
+    return p;
+}
 
 /**
- * Initializes the scanner with a source string.
+ * Skips the body of a line comment, stopping at its line feed. memchr is
+ * already vectorized by the C library on every platform worth caring about.
  *
- * @param source the source string to tokenize
+ * @param p the first byte of the comment
+ * @param end the end of the available source
+ * @return the line feed ending the comment, or end if it is not in sight
  */
-void initScanner(const char* source) {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+static const char* skipCommentBody(const char* p, const char* end) {
+    if (p >= end) return p;
+    const char* newline = memchr(p, '\n', (size_t)(end - p));
+    return newline == NULL ? end : newline;
 }
 
 /**
@@ -52,8 +403,8 @@ static bool isDigit(char c) {
  *
  * @return true if the scanner is at the end of the source string, false otherwise
  */
-static bool isAtEnd() {
-    return *scanner.current == '\0';
+static bool isAtEnd(Scanner* scanner) {
+    return scanner->current >= scanner->end && !hasBytes(scanner, 1);
 }
 
 /**
@@ -61,28 +412,29 @@ static bool isAtEnd() {
  *
  * @return the current character
  */
-static char advance() {
-    scanner.current++;
-    return scanner.current[-1];
+static char advance(Scanner* scanner) {
+    scanner->current++;
+    return scanner->current[-1];
 }
 
 /**
  * Returns the current character without advancing the scanner.
  *
- * @return the current character
+ * @return the current character or '\0' if at the end of the source string
  */
-static char peek() {
-    return *scanner.current;
+static char peek(Scanner* scanner) {
+    if (isAtEnd(scanner)) return '\0';
+    return *scanner->current;
 }
 
 /**
  * Returns the next character in the source string without advancing the scanner.
  *
- * @return the next character or '\0' if at the end of the source string
+ * @return the next character or '\0' if it is past the end of the source string
  */
-static char peekNext() {
-    if (isAtEnd()) return '\0';
-    return scanner.current[1];
+static char peekNext(Scanner* scanner) {
+    if (scanner->current + 1 >= scanner->end && !hasBytes(scanner, 2)) return '\0';
+    return scanner->current[1];
 }
 
 /**
@@ -95,11 +447,11 @@ static char peekNext() {
  * @param expected the expected character
  * @return true if the characters match, false otherwise
  */
-static bool match(char expected) {
-    if (isAtEnd()) return false;
-    // since advance() move current to the next character, *scanner.current = next character
-    if (*scanner.current != expected) return false;
-    scanner.current++;
+static bool match(Scanner* scanner, char expected) {
+    if (isAtEnd(scanner)) return false;
+    // since advance() move current to the next character, *scanner->current = next character
+    if (*scanner->current != expected) return false;
+    scanner->current++;
     return true;
 }
 
@@ -110,12 +462,12 @@ static bool match(char expected) {
  * @param type the type of the token
  * @return a newly created Token
  */
-static Token makeToken(TokenType type) {
+static Token makeToken(Scanner* scanner, TokenType type) {
     Token token;
     token.type = type;
-    token.start = scanner.start;
-    token.length = (int)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (int)(scanner->current - scanner->start);
+    token.line = scanner->line;
     return token;
 }
 
@@ -125,12 +477,12 @@ static Token makeToken(TokenType type) {
  * @param message the error message to be associated with the token
  * @return a Token with type TOKEN_ERROR, containing the provided message, its length, and the current line number from the scanner
  */
-static Token errorToken(const char* message) {
+static Token errorToken(Scanner* scanner, const char* message) {
     Token token;
     token.type = TOKEN_ERROR;
     token.start = message;
     token.length = (int)strlen(message);
-    token.line = scanner.line;
+    token.line = scanner->line;
     return token;
 }
 
@@ -140,24 +492,33 @@ static Token errorToken(const char* message) {
  * scanner.
  *
  * Whitespace characters include spaces, tabs, carriage returns, and line feeds.
- * Line comments are also skipped.
+ * Line comments are also skipped. Long runs of blanks and comment bodies are
+ * skipped a block at a time before the scalar loop takes over. The start of the scanner follows along so
+ * that skipped text is never carried over when a stream is refilled.
  */
-static void skipWhitespace() {
+static void skipWhitespace(Scanner* scanner) {
     for (;;) {
-        char c = peek();
+        scanner->start = scanner->current;
+        char c = peek(scanner);
         switch (c) {
             case ' ':
             case '\r':
             case '\t':
-                advance();
+                advance(scanner);
+                scanner->current = skipBlanks(scanner->current, scanner->end);
                 break;
             case '\n':
-                scanner.line++;
-                advance();
+                scanner->line++;
+                advance(scanner);
                 break;
             case '/':
-                if (peekNext() == '/') {
-                    while (peek() != '\n' && !isAtEnd()) advance();
+                if (peekNext(scanner) == '/') {
+                    scanner->current = skipCommentBody(scanner->current, scanner->end);
+                    scanner->start = scanner->current;
+                    while (peek(scanner) != '\n' && !isAtEnd(scanner)) {
+                        advance(scanner);
+                        scanner->start = scanner->current;
+                    }
                 } else {
                     return;
                 }
@@ -168,72 +529,87 @@ static void skipWhitespace() {
     }
 }
 
-/**
- * Checks if the current identifier is a keyword by comparing it with the
- * given string. If the identifier matches the keyword, the function returns
- * the associated TokenType. Otherwise, it returns TOKEN_IDENTIFIER.
- *
- * @param start the starting index of the identifier
- * @param length the length of the keyword
- * @param rest the characters of the keyword
- * @param type the TokenType associated with the keyword
- * @return the TokenType of the keyword, or TOKEN_IDENTIFIER if the identifier
- *         does not match the keyword
- */
-static TokenType checkKeyword(int start, int length, const char* rest, TokenType type) {
-    if (scanner.current - scanner.start == start + length &&
-        memcmp(scanner.start + start, rest, length) == 0) {
-            return type;
-        }
-    
-    return TOKEN_IDENTIFIER;
-}
+// Where a keyword of the given length, first and last character sits in
+// keywords[]. The multiplier was searched for so that no two keywords share a
+// slot; -Wextra warns about an overridden initializer if they ever do.
+#define KEYWORD_HASH(length, first, last) \
+    (((length) + (first) + (last) * 5) & 31)
+
+// A keyword, zero-padded to one 8-byte word
+typedef struct {
+    char text[8];
+    TokenType type;
+} Keyword;
+
+static const Keyword keywords[32] = {
+    [KEYWORD_HASH(3, 'a', 'd')] = {"and",    TOKEN_AND},
+    [KEYWORD_HASH(5, 'c', 's')] = {"class",  TOKEN_CLASS},
+    [KEYWORD_HASH(4, 'e', 'e')] = {"else",   TOKEN_ELSE},
+    [KEYWORD_HASH(5, 'f', 'e')] = {"false",  TOKEN_FALSE},
+    [KEYWORD_HASH(3, 'f', 'r')] = {"for",    TOKEN_FOR},
+    [KEYWORD_HASH(3, 'f', 'n')] = {"fun",    TOKEN_FUN},
+    [KEYWORD_HASH(2, 'i', 'f')] = {"if",     TOKEN_IF},
+    [KEYWORD_HASH(3, 'n', 'l')] = {"nil",    TOKEN_NIL},
+    [KEYWORD_HASH(2, 'o', 'r')] = {"or",     TOKEN_OR},
+    [KEYWORD_HASH(5, 'p', 't')] = {"print",  TOKEN_PRINT},
+    [KEYWORD_HASH(6, 'r', 'n')] = {"return", TOKEN_RETURN},
+    [KEYWORD_HASH(5, 's', 'r')] = {"super",  TOKEN_SUPER},
+    [KEYWORD_HASH(4, 't', 's')] = {"this",   TOKEN_THIS},
+    [KEYWORD_HASH(4, 't', 'e')] = {"true",   TOKEN_TRUE},
+    [KEYWORD_HASH(3, 'v', 'r')] = {"var",    TOKEN_VAR},
+    [KEYWORD_HASH(5, 'w', 'e')] = {"while",  TOKEN_WHILE},
+};
+
+// For each length up to 8, the bytes of a word that hold that many characters
+static const uint8_t keywordMasks[9][8] = {
+    {0},
+    {0xff},
+    {0xff, 0xff},
+    {0xff, 0xff, 0xff},
+    {0xff, 0xff, 0xff, 0xff},
+    {0xff, 0xff, 0xff, 0xff, 0xff},
+    {0xff, 0xff, 0xff, 0xff, 0xff, 0xff},
+    {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff},
+    {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff},
+};
 
 /**
  * Determines the TokenType of a given identifier by checking if it matches
  * any known keyword. If the identifier is a keyword, the corresponding 
  * TokenType is returned. Otherwise, TOKEN_IDENTIFIER is returned.
  *
- * The function inspects the first character of the identifier and checks
- * subsequent characters to identify keywords such as "and", "class", "else",
- * etc.
+ * The identifier's length and first and last characters pick the only
+ * keyword it could be, and a single word compare settles it. The keyword is
+ * zero-padded and identifier characters never are, so the compare also
+ * fails when the lengths differ. Words are built with memcpy on both sides,
+ * so the compare does not depend on byte order.
  *
  * @return the TokenType corresponding to the keyword if it matches, or
  *         TOKEN_IDENTIFIER if it does not.
  */
-static TokenType identifierType() {
-    switch (scanner.start[0]) {
-        case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-        case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-        case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-        case 'f':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-                    case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-                    case 'u': return checkKeyword(2, 1, "n", TOKEN_FUN);
-                }
-            }
-            break;
-        case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-        case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-        case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-        case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-        case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
-        case 't':
-            if (scanner.current - scanner.start > 1) {
-                switch (scanner.start[1]) {
-                    case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-                    case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-                }
-            }
-            break;
-        case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-        case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+static TokenType identifierType(Scanner* scanner) {
+    const char* start = scanner->start;
+    size_t length = (size_t)(scanner->current - start);
+    if (length > 8) return TOKEN_IDENTIFIER;
+
+    const Keyword* keyword = &keywords[KEYWORD_HASH(
+        length, (unsigned char)start[0], (unsigned char)start[length - 1])];
+
+    uint64_t word;
+    if (scanner->end - start >= 8) {
+        memcpy(&word, start, sizeof(word));
+    } else {
+        // Too close to the end of the source to read a whole word
+        char bytes[8] = {0};
+        memcpy(bytes, start, length);
+        memcpy(&word, bytes, sizeof(word));
     }
+    uint64_t mask;
+    memcpy(&mask, keywordMasks[length], sizeof(mask));
+    uint64_t text;
+    memcpy(&text, keyword->text, sizeof(text));
 
-    return TOKEN_IDENTIFIER;
+    return (word & mask) == text ? keyword->type : TOKEN_IDENTIFIER;
 }
 
 /**
@@ -248,9 +624,138 @@ static TokenType identifierType() {
  *
  * @return a Token representing the scanned identifier
  */
-static Token identifier() {
-    while (isAlpha(peek()) || isDigit(peek())) advance();
-    return makeToken(identifierType());
+static Token identifier(Scanner* scanner) {
+    scanner->current = skipIdentifierChars(scanner->current, scanner->end);
+    while (isAlpha(peek(scanner)) || isDigit(peek(scanner))) advance(scanner);
+    return makeToken(scanner, identifierType(scanner));
+}
+
+// Powers of ten a double holds exactly, so scaling by one rounds just once
+static const double exactPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// The largest integer below which every integer is exactly a double
+#define EXACT_INTEGER_LIMIT (UINT64_C(1) << 53)
+
+/**
+ * Checks whether the eight bytes of a word are all ASCII digits.
+ *
+ * @param word eight bytes of source, loaded with memcpy
+ * @return true if every byte is '0' through '9'
+ */
+static bool isEightDigits(uint64_t word) {
+    return (((word & UINT64_C(0xf0f0f0f0f0f0f0f0)) |
+             (((word + UINT64_C(0x0606060606060606)) &
+               UINT64_C(0xf0f0f0f0f0f0f0f0)) >> 4)) ==
+            UINT64_C(0x3333333333333333));
+}
+
+/**
+ * Converts eight ASCII digits, loaded little-endian into a word, to their
+ * value with three multiplies rather than eight.
+ *
+ * @param word eight digits, the first in the lowest byte
+ * @return the value of the digits as a decimal number
+ */
+static uint32_t parseEightDigits(uint64_t word) {
+    const uint64_t mask = UINT64_C(0x000000ff000000ff);
+    const uint64_t mul1 = UINT64_C(0x000f424000000064); // 100 + (1000000 << 32)
+    const uint64_t mul2 = UINT64_C(0x0000271000000001); // 1 + (10000 << 32)
+    word -= UINT64_C(0x3030303030303030);
+    word = (word * 10) + (word >> 8);
+    return (uint32_t)((((word & mask) * mul1) +
+                       (((word >> 16) & mask) * mul2)) >> 32);
+}
+
+/**
+ * Converts a number literal with strtod, for the literals the fast path in
+ * parseNumber() cannot round exactly.
+ *
+ * The literal is copied out first, since the source is not always
+ * null-terminated after it.
+ *
+ * @param start the first character of the literal
+ * @param length the number of characters in the literal
+ * @return the nearest double to the literal
+ */
+static double parseNumberSlow(const char* start, size_t length) {
+    char small[64];
+    char* text = small;
+    if (length >= sizeof(small)) {
+        text = (char*)reallocate(NULL, 0, length + 1, MEMORY_SCANNER);
+    }
+    memcpy(text, start, length);
+    text[length] = '\0';
+
+    double value = strtod(text, NULL);
+    if (text != small) reallocate(text, length + 1, 0, MEMORY_SCANNER);
+    return value;
+}
+
+/**
+ * Converts a number literal to the nearest double.
+ *
+ * The digits are gathered into a 64-bit integer, eight at a time where
+ * there are eight in a row, and the decimal point becomes a power of ten to
+ * divide by. When the integer and that power are both exact as doubles, one
+ * correctly rounded multiply or divide gives the nearest double (Clinger's
+ * fast path), which covers the literals that come up in practice. Longer
+ * literals fall back to strtod.
+ *
+ * @param start the first character of the literal, a digit
+ * @param length the number of characters in the literal: digits, optionally
+ *        with a '.' between two of them
+ * @return the nearest double to the literal
+ */
+static double parseNumber(const char* start, size_t length) {
+    const char* p = start;
+    const char* end = start + length;
+    // Trailing zeros after the decimal point add nothing but scale
+    if (memchr(start, '.', length) != NULL) {
+        while (end[-1] == '0') end--;
+        if (end[-1] == '.') end--;
+    }
+    while (p < end && *p == '0') p++;
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int scale = 0;
+    bool fraction = false;
+    while (p < end) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // Eight more digits must leave the mantissa below 10^19
+        if (end - p >= 8 && digits <= 11) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            if (isEightDigits(word)) {
+                mantissa = mantissa * 100000000 + parseEightDigits(word);
+                if (mantissa != 0) digits += 8;
+                if (fraction) scale += 8;
+                p += 8;
+                continue;
+            }
+        }
+#endif
+        if (*p == '.') {
+            fraction = true;
+        } else {
+            if (digits == 19) return parseNumberSlow(start, length);
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            if (mantissa != 0) digits++;
+            if (fraction) scale++;
+        }
+        p++;
+    }
+
+    if (scale == 0) return (double)mantissa;
+    // With wider intermediates the division would round twice
+    if (FLT_EVAL_METHOD == 0 && mantissa <= EXACT_INTEGER_LIMIT &&
+        scale <= 22) {
+        return (double)mantissa / exactPowersOfTen[scale];
+    }
+    return parseNumberSlow(start, length);
 }
 
 /**
@@ -263,19 +768,42 @@ static Token identifier() {
  * encounters a decimal point, it will continue to advance the scanner until it
  * encounters a non-digit character.
  *
+ * The value is worked out here, while the digits are still in cache, so
+ * the compiler does not parse them a second time.
+ *
  * @return a Token with type TOKEN_NUMBER, containing the number value, its
  *         length, and the current line number from the scanner
  */
-static Token number() {
-    while (isDigit(peek())) advance();
+static Token number(Scanner* scanner) {
+    scanner->current = skipDigits(scanner->current, scanner->end);
+    while (isDigit(peek(scanner))) advance(scanner);
+
+    if (peek(scanner) == '.' && isDigit(peekNext(scanner))) {
+        advance(scanner);
+
+        scanner->current = skipDigits(scanner->current, scanner->end);
+        while (isDigit(peek(scanner))) advance(scanner);
+    }
 
-    if (peek() == '.' && isDigit(peekNext())) {
-        advance();
+    Token token = makeToken(scanner, TOKEN_NUMBER);
+    token.number = parseNumber(token.start, (size_t)token.length);
+    return token;
+}
 
-        while (isDigit(peek())) advance();
+/**
+ * Scans an input reference, a '$' followed by the number of the input: $0 is
+ * the first input an expression is evaluated with.
+ *
+ * @return a Token with type TOKEN_INPUT spanning the '$' and the digits, or
+ *         an error token if no digits follow the '$'
+ */
+static Token input(Scanner* scanner) {
+    if (!isDigit(peek(scanner))) {
+        return errorToken(scanner, "Expect input number after '$'.");
     }
+    while (isDigit(peek(scanner))) advance(scanner);
 
-    return makeToken(TOKEN_NUMBER);
+    return makeToken(scanner, TOKEN_INPUT);
 }
 
 /**
@@ -288,17 +816,18 @@ static Token number() {
  * @return a Token with type TOKEN_STRING, containing the string value,
  *         its length, and the line number at the beginning of the string
  */
-static Token string() {
-    while (peek() != '"' && !isAtEnd()) {
-        if (peek() == '\n') scanner.line++;
-        advance();
+static Token string(Scanner* scanner) {
+    scanner->current = skipStringBody(scanner->current, scanner->end, &scanner->line);
+    while (peek(scanner) != '"' && !isAtEnd(scanner)) {
+        if (peek(scanner) == '\n') scanner->line++;
+        advance(scanner);
     }
 
-    if (!isAtEnd()) return errorToken("Unterminated string.");
+    if (isAtEnd(scanner)) return errorToken(scanner, "Unterminated string.");
 
     // The closing quote
-    advance();
-    return makeToken(TOKEN_STRING);
+    advance(scanner);
+    return makeToken(scanner, TOKEN_STRING);
 }
 
 /**
@@ -315,47 +844,204 @@ static Token string() {
  *
  * @return a Token representing the scanned token
  */
-Token scanToken() {
-    skipWhitespace();
-    scanner.start = scanner.current;
+static Token scanNextToken(Scanner* scanner) {
+    skipWhitespace(scanner);
+    scanner->start = scanner->current;
 
-    if (isAtEnd()) return makeToken(TOKEN_EOF);
+    if (isAtEnd(scanner)) return makeToken(scanner, TOKEN_EOF);
 
-    char c = advance();
-    if (isAlpha(c)) return identifier();
-    if (isDigit(c)) return number();
+    char c = advance(scanner);
+    if (isAlpha(c)) return identifier(scanner);
+    if (isDigit(c)) return number(scanner);
 
     switch (c) {
         // Single character tokens
-        case '(': return makeToken(TOKEN_LEFT_PAREN);
-        case ')': return makeToken(TOKEN_RIGHT_PAREN);
-        case '{': return makeToken(TOKEN_LEFT_BRACE);
-        case '}': return makeToken(TOKEN_RIGHT_BRACE);
-        case ';': return makeToken(TOKEN_SEMICOLON);
-        case ',': return makeToken(TOKEN_COMMA);
-        case '.': return makeToken(TOKEN_DOT);
-        case '-': return makeToken(TOKEN_MINUS);
-        case '+': return makeToken(TOKEN_PLUS);
-        case '/': return makeToken(TOKEN_SLASH);
-        case '*': return makeToken(TOKEN_STAR);
+        case '(': return makeToken(scanner, TOKEN_LEFT_PAREN);
+        case ')': return makeToken(scanner, TOKEN_RIGHT_PAREN);
+        case '{': return makeToken(scanner, TOKEN_LEFT_BRACE);
+        case '}': return makeToken(scanner, TOKEN_RIGHT_BRACE);
+        case ';': return makeToken(scanner, TOKEN_SEMICOLON);
+        case ',': return makeToken(scanner, TOKEN_COMMA);
+        case '.': return makeToken(scanner, TOKEN_DOT);
+        case '-': return makeToken(scanner, TOKEN_MINUS);
+        case '+': return makeToken(scanner, TOKEN_PLUS);
+        case '/': return makeToken(scanner, TOKEN_SLASH);
+        case '*': return makeToken(scanner, TOKEN_STAR);
 
         // One or two tokens
-        case '!': return makeToken(
-            match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG
+        case '!': return makeToken(scanner, 
+            match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG
         );
-        case '=': return makeToken(
-            match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL
+        case '=': return makeToken(scanner, 
+            match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL
         );
-        case '<': return makeToken(
-            match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS
+        case '<': return makeToken(scanner, 
+            match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS
         );
-        case '>': return makeToken(
-            match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER
+        case '>': return makeToken(scanner, 
+            match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER
         );
 
         // Literals
-        case '"': return string();
+        case '"': return string(scanner);
+        case '$': return input(scanner);
+    }
+
+    return errorToken(scanner, "Unexpected character.");
+}
+
+/**
+ * Scans the next token from the source.
+ *
+ * When scanning a stream, the returned token stays valid until two more
+ * tokens have been scanned.
+ *
+ * @param scanner the scanner to read from
+ * @return a Token representing the scanned token
+ */
+Token scanToken(Scanner* scanner) {
+    Token token = scanNextToken(scanner);
+    if (scanner->oldestBlock != NULL) retainToken(scanner);
+    return token;
+}
+
+/**
+ * Initializes an empty token buffer.
+ *
+ * @param tokens the buffer to initialize
+ */
+void initTokenBuffer(TokenBuffer* tokens) {
+    tokens->source = NULL;
+    tokens->types = NULL;
+    tokens->offsets = NULL;
+    tokens->lengths = NULL;
+    tokens->lines = NULL;
+    tokens->numbers = NULL;
+    tokens->count = 0;
+    tokens->capacity = 0;
+    tokens->messages = NULL;
+    tokens->messageCount = 0;
+    tokens->messageCapacity = 0;
+}
+
+/**
+ * Frees the arrays of a token buffer and leaves it empty.
+ *
+ * @param tokens the buffer to free
+ */
+void freeTokenBuffer(TokenBuffer* tokens) {
+    FREE_ARRAY(uint8_t, tokens->types, tokens->capacity, MEMORY_SCANNER);
+    FREE_ARRAY(uint32_t, tokens->offsets, tokens->capacity, MEMORY_SCANNER);
+    FREE_ARRAY(uint32_t, tokens->lengths, tokens->capacity, MEMORY_SCANNER);
+    FREE_ARRAY(int, tokens->lines, tokens->capacity, MEMORY_SCANNER);
+    FREE_ARRAY(double, tokens->numbers, tokens->capacity, MEMORY_SCANNER);
+    FREE_ARRAY(const char*, tokens->messages, tokens->messageCapacity,
+               MEMORY_SCANNER);
+    initTokenBuffer(tokens);
+}
+
+/**
+ * Grows every array of a token buffer to hold at least one more token.
+ *
+ * @param tokens the buffer to grow
+ */
+static void growTokenBuffer(TokenBuffer* tokens) {
+    int oldCapacity = tokens->capacity;
+    tokens->capacity = GROW_CAPACITY(oldCapacity);
+    tokens->types = GROW_ARRAY(uint8_t, tokens->types, oldCapacity,
+                               tokens->capacity, MEMORY_SCANNER);
+    tokens->offsets = GROW_ARRAY(uint32_t, tokens->offsets, oldCapacity,
+                                 tokens->capacity, MEMORY_SCANNER);
+    tokens->lengths = GROW_ARRAY(uint32_t, tokens->lengths, oldCapacity,
+                                 tokens->capacity, MEMORY_SCANNER);
+    tokens->lines = GROW_ARRAY(int, tokens->lines, oldCapacity,
+                               tokens->capacity, MEMORY_SCANNER);
+    tokens->numbers = GROW_ARRAY(double, tokens->numbers, oldCapacity,
+                                 tokens->capacity, MEMORY_SCANNER);
+}
+
+/**
+ * Records the message of an error token.
+ *
+ * @param tokens the buffer the error token goes into
+ * @param message the message
+ * @return the index of the message in tokens->messages
+ */
+static uint32_t addMessage(TokenBuffer* tokens, const char* message) {
+    if (tokens->messageCapacity < tokens->messageCount + 1) {
+        int oldCapacity = tokens->messageCapacity;
+        tokens->messageCapacity = GROW_CAPACITY(oldCapacity);
+        tokens->messages = GROW_ARRAY(const char*, tokens->messages,
+                                      oldCapacity, tokens->messageCapacity,
+                                      MEMORY_SCANNER);
+    }
+    tokens->messages[tokens->messageCount] = message;
+    return (uint32_t)tokens->messageCount++;
+}
+
+/**
+ * Scans a whole source into a token buffer, replacing what it held.
+ *
+ * The buffer ends with the TOKEN_EOF token, and refers to the source rather
+ * than copying it, so the source must outlive it. Being filled in one pass
+ * over the source, with no parsing in between, keeps the scanner's loop tight
+ * and the tokens packed together for the parser.
+ *
+ * @param tokens the buffer to fill; it must have been initialized
+ * @param source the source buffer to tokenize, which need not be
+ *        null-terminated
+ * @param length the number of bytes in the buffer
+ * @return false, leaving the buffer empty, if the source is too long for an
+ *         offset to address; scanToken() has no such limit
+ */
+bool tokenize(TokenBuffer* tokens, const char* source, size_t length) {
+    tokens->source = source;
+    tokens->count = 0;
+    tokens->messageCount = 0;
+    if (length > UINT32_MAX) return false;
+
+    Scanner scanner;
+    initScannerN(&scanner, source, length);
+    for (;;) {
+        Token token = scanNextToken(&scanner);
+        if (tokens->capacity < tokens->count + 1) growTokenBuffer(tokens);
+
+        int index = tokens->count++;
+        tokens->types[index] = (uint8_t)token.type;
+        tokens->lines[index] = token.line;
+        if (token.type == TOKEN_ERROR) {
+            tokens->offsets[index] = (uint32_t)(scanner.start - source);
+            tokens->lengths[index] = addMessage(tokens, token.start);
+        } else {
+            tokens->offsets[index] = (uint32_t)(token.start - source);
+            tokens->lengths[index] = (uint32_t)token.length;
+            if (token.type == TOKEN_NUMBER) {
+                tokens->numbers[index] = token.number;
+            }
+        }
+
+        if (token.type == TOKEN_EOF) return true;
     }
+}
 
-    return errorToken("Unexpected character.");
+/**
+ * Rebuilds a Token from a token buffer.
+ *
+ * @param tokens the buffer
+ * @param index the index of the token, less than tokens->count
+ * @return the token, as scanToken() would have returned it
+ */
+Token getToken(const TokenBuffer* tokens, int index) {
+    Token token;
+    token.type = (TokenType)tokens->types[index];
+    token.line = tokens->lines[index];
+    if (token.type == TOKEN_ERROR) {
+        token.start = tokens->messages[tokens->lengths[index]];
+        token.length = (int)strlen(token.start);
+    } else {
+        token.start = tokens->source + tokens->offsets[index];
+        token.length = (int)tokens->lengths[index];
+        if (token.type == TOKEN_NUMBER) token.number = tokens->numbers[index];
+    }
+    return token;
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include "common.h"
+
 typedef enum {
     // Single-character character tokens
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
@@ -15,7 +17,7 @@ typedef enum {
     TOKEN_LESS, TOKEN_LESS_EQUAL,
 
     // Literals
-    TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
+    TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER, TOKEN_INPUT,
 
     // Keywords
     TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE,
@@ -31,9 +33,56 @@ typedef struct {
     const char* start;
     int length;
     int line;
+    double number; // The value of a TOKEN_NUMBER, unset for other tokens
 } Token;
 
-void initScanner(const char* source);
-Token scanToken();
+// Every token of a source, scanned up front and stored as a struct of arrays
+// so that the parser walks them by index. Token i has type types[i] and spans
+// lengths[i] bytes from source + offsets[i], on line lines[i]. A
+// TOKEN_NUMBER has its value in numbers[i]. A TOKEN_ERROR spans the text it
+// was reported at, and lengths[i] is instead the index of its message in
+// messages.
+typedef struct {
+    const char* source;
+    uint8_t* types;
+    uint32_t* offsets;
+    uint32_t* lengths;
+    int* lines;
+    double* numbers;
+    int count;
+    int capacity;
+    const char** messages;
+    int messageCount;
+    int messageCapacity;
+} TokenBuffer;
+
+// Supplies up to capacity more bytes of source in buffer, returning how many
+// were written. Returning 0 signals the end of the source.
+typedef size_t (*ScannerRefill)(void* context, char* buffer, size_t capacity);
+
+typedef struct ScanBlock ScanBlock;
+
+typedef struct {
+    const char* start;
+    const char* current;
+    const char* end;
+    int line;
+    ScannerRefill refill; // NULL unless scanning a stream
+    void* refillContext;
+    ScanBlock* oldestBlock;
+    ScanBlock* newestBlock;
+    ScanBlock* tokenBlocks[2]; // Blocks holding the last two tokens returned
+} Scanner;
+
+void initScanner(Scanner* scanner, const char* source);
+void initScannerN(Scanner* scanner, const char* source, size_t length);
+void initScannerStream(Scanner* scanner, ScannerRefill refill, void* context);
+void freeScanner(Scanner* scanner);
+Token scanToken(Scanner* scanner);
+
+void initTokenBuffer(TokenBuffer* tokens);
+void freeTokenBuffer(TokenBuffer* tokens);
+bool tokenize(TokenBuffer* tokens, const char* source, size_t length);
+Token getToken(const TokenBuffer* tokens, int index);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "source.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Reads the contents of a file into a null-terminated string.
+ *
+ * @param path the path to the file to read
+ * @param file where the contents of the file are stored
+ * @param errors the stream failures are reported to
+ *
+ * @return true if the file was read, false if it could not be opened or there
+ *         was not enough memory to hold it
+ *
+ * The buffer is allocated using malloc. If the file could not be read in full
+ * (e.g. it is not a regular file), a message is printed but whatever was read
+ * is still returned.
+ */
+static bool readSourceBuffered(const char* path, SourceFile* file,
+                               FILE* errors) {
+    FILE* stream = fopen(path, "rb");
+    if (stream == NULL) {
+        fprintf(errors, "Could not open file \"%s\".\n", path);
+        return false;
+    }
+
+    fseek(stream, 0L, SEEK_END);
+    size_t fileSize = ftell(stream);
+    rewind(stream);
+
+    char* buffer = (char*)malloc(fileSize + 1);
+    if (buffer == NULL) {
+        fprintf(errors, "Not enough memory to read \"%s\".\n", path);
+        fclose(stream);
+        return false;
+    }
+
+    size_t bytesRead = fread(buffer, sizeof(char), fileSize, stream);
+    if (bytesRead < fileSize) {
+        fprintf(errors, "Could not read file \"%s\".\n", path);
+    }
+
+    buffer[bytesRead] = '\0';
+    fclose(stream);
+    *file = (SourceFile){buffer, bytesRead, false};
+    return true;
+}
+
+/**
+ * Loads the contents of a file, mapping it into memory when possible.
+ *
+ * @param path the path to the file to read
+ * @param file where the contents of the file are stored, to be released with
+ *             closeSource()
+ * @param errors the stream failures are reported to
+ *
+ * @return true if the file was loaded, false otherwise
+ *
+ * A mapped file is not null-terminated; its length is the only bound on the
+ * source. Empty files, files that are not regular (e.g. pipes) and platforms
+ * without mmap fall back to reading the file into a malloc'd buffer.
+ */
+bool openSource(const char* path, SourceFile* file, FILE* errors) {
+#ifdef HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(errors, "Could not open file \"%s\".\n", path);
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        size_t length = (size_t)info.st_size;
+        void* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            close(fd);
+            madvise(mapping, length, MADV_SEQUENTIAL);
+            *file = (SourceFile){(const char*)mapping, length, true};
+            return true;
+        }
+    }
+    close(fd);
+#endif
+
+    return readSourceBuffered(path, file, errors);
+}
+
+/**
+ * Releases the contents of a file loaded by openSource().
+ *
+ * @param file the file to release
+ */
+void closeSource(SourceFile* file) {
+#ifdef HAVE_MMAP
+    if (file->mapped) {
+        munmap((void*)file->source, file->length);
+        return;
+    }
+#endif
+    free((void*)file->source);
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#ifndef clox_source_h
+#define clox_source_h
+
+#include <stdio.h>
+
+#include "common.h"
+
+typedef struct {
+    const char* source;
+    size_t length;
+    bool mapped; // Whether source is a mapping rather than a malloc'd buffer
+} SourceFile;
+
+bool openSource(const char* path, SourceFile* file, FILE* errors);
+void closeSource(SourceFile* file);
+
+#endif
\ No newline at end of file
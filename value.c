@@ -25,7 +25,8 @@ void writeValueArray(ValueArray* array, Value value) {
     if (array->capacity < array->count + 1) {
         int oldCapacity = array->capacity;
         array->capacity = GROW_CAPACITY(array->capacity);
-        array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+        array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity,
+                                   MEMORY_CONSTANTS);
     }
 
     array->values[array->count] = value;
@@ -38,34 +39,63 @@ void writeValueArray(ValueArray* array, Value value) {
  * @param array the array of values to be freed
  */
 void freeValueArray(ValueArray* array) {
-    FREE_ARRAY(Value, array->values, array->capacity);
+    FREE_ARRAY(Value, array->values, array->capacity, MEMORY_CONSTANTS);
     initValueArray(array);
 }
 
 /**
- * Prints a value to the standard output.
+ * Prints a value to the given stream.
  *
+ * @param file the stream to print to
  * @param value the value to print
  */
-void printValue(Value value) {
+void fprintValue(FILE* file, Value value) {
+#ifdef NAN_BOXING
+    if (IS_BOOL(value)) {
+        fprintf(file, AS_BOOL(value) ? "true" : "false");
+    } else if (IS_NIL(value)) {
+        fprintf(file, "nil");
+    } else if (IS_NUMBER(value)) {
+        fprintf(file, "%g", AS_NUMBER(value));
+    }
+#else
     switch (value.type) {
         case VAL_BOOL:
-            printf(AS_BOOL(value) ? "true" : "false");
+            fprintf(file, AS_BOOL(value) ? "true" : "false");
             break;
-        case VAL_NIL: printf("nil"); break;
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
+        case VAL_NIL: fprintf(file, "nil"); break;
+        case VAL_NUMBER: fprintf(file, "%g", AS_NUMBER(value)); break;
     }
+#endif
+}
+
+/**
+ * Prints a value to the standard output.
+ *
+ * @param value the value to print
+ */
+void printValue(Value value) {
+    fprintValue(stdout, value);
 }
 
 /**
  * Checks if two values are equal. The values are equal if they have the same
  * type and their values are equal.
  *
+ * With NaN boxing, anything other than two numbers is compared by its bits.
+ * Numbers still go through a double comparison so that NaN != NaN.
+ *
  * @param a the first value to compare
  * @param b the second value to compare
  * @return true if the values are equal, false otherwise
  */
 bool valuesEqual(Value a, Value b) {
+#ifdef NAN_BOXING
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+    return a == b;
+#else
     if (a.type != b.type) return false;
     switch (a.type) {
         case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
@@ -73,4 +103,16 @@ bool valuesEqual(Value a, Value b) {
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
         default:         return false; // Unreachable
     }
+#endif
+}
+
+/**
+ * Checks if a value is falsey. Only nil and false are falsey; every other
+ * value, including 0, is truthy.
+ *
+ * @param value the value to check
+ * @return true if the value is falsey, false otherwise
+ */
+bool isFalsey(Value value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
\ No newline at end of file
@@ -1,8 +1,62 @@
 #ifndef clox_value_h
 #define clox_value_h
 
+#include <stdio.h>
+
 #include "common.h"
 
+#ifdef NAN_BOXING
+
+#include <string.h>
+
+#define QNAN     ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL   1 // 01
+#define TAG_FALSE 2 // 10
+#define TAG_TRUE  3 // 11
+
+typedef uint64_t Value;
+
+#define FALSE_VAL         ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL          ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+#define IS_BOOL(value)    (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)     ((value) == NIL_VAL)
+#define IS_NUMBER(value)  (((value) & QNAN) != QNAN)
+
+#define AS_BOOL(value)    ((value) == TRUE_VAL)
+#define AS_NUMBER(value)  valueToNum(value)
+
+#define BOOL_VAL(b)       ((b) ? TRUE_VAL : FALSE_VAL)
+#define NIL_VAL           ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define NUMBER_VAL(num)   numToValue(num)
+
+/**
+ * Reinterprets the bits of a NaN-boxed value as a double.
+ *
+ * @param value the value to convert, which must hold a number
+ * @return the number stored in the value
+ */
+static inline double valueToNum(Value value) {
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+/**
+ * Reinterprets the bits of a double as a NaN-boxed value.
+ *
+ * @param num the number to box
+ * @return a Value holding the number
+ */
+static inline Value numToValue(double num) {
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+#else
+
 typedef enum {
     VAL_BOOL,
     VAL_NIL,
@@ -28,6 +82,8 @@ typedef struct {
 #define NIL_VAL    ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
 
+#endif
+
 typedef struct {
     int capacity;
     int count;
@@ -35,9 +91,11 @@ typedef struct {
 } ValueArray;
 
 bool valuesEqual(Value a, Value b);
+bool isFalsey(Value value);
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
+void fprintValue(FILE* file, Value value);
 void printValue(Value value);
 
 #endif
\ No newline at end of file
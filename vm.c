@@ -1,64 +1,123 @@
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "profiler.h"
+#include "registers.h"
 #include "vm.h"
 
-VM vm;
 
 /**
  * Resets the virtual machine's stack pointer to the beginning of the stack.
  * This effectively empties the stack, preparing it for new data.
  */
-static void resetStack() {
-    vm.stackTop = vm.stack;
+static void resetStack(VM* vm) {
+    vm->stackTop = vm->stack;
 }
 
-static void runtimeError(const char* format, ...) {
+static void runtimeError(VM* vm, const char* format, ...) {
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vfprintf(vm->err, format, args);
     va_end(args);
-    fputs("\n", stderr);
+    fputs("\n", vm->err);
 
-    size_t instruction = vm.ip - vm.chunk->code - 1;
-    int line = vm.chunk->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
-    resetStack();
+    size_t instruction = vm->ip - vm->chunk->code - 1;
+    int line = getLine(vm->chunk, (int)instruction);
+    fprintf(vm->err, "[line %d] in script\n", line);
+    resetStack(vm);
 }
 
-void initVM() {
-    resetStack();
+/**
+ * Initializes a virtual machine. Every VM owns all of its state, so separate
+ * VMs can run on separate threads.
+ *
+ * @param vm the virtual machine to initialize
+ */
+void initVM(VM* vm) {
+    vm->stack = NULL;
+    vm->stackCapacity = 0;
+    resetStack(vm);
+    vm->out = stdout;
+    vm->err = stderr;
+    vm->arena = NULL;
+    vm->backend = BACKEND_STACK;
+#ifdef DEBUG_TRACE_EXECUTION
+    vm->trace = true;
+#else
+    vm->trace = false;
+#endif
+    vm->profile = NULL;
+    vm->scanAhead = false;
+    vm->inputs = NULL;
+    vm->inputCount = 0;
+    vm->quickenedCode = NULL;
+    vm->quickenedCapacity = 0;
+    vm->quickenedProgram = 0;
 }
 
-void freeVM() {
+/**
+ * Resizes the virtual machine's stack, discarding its contents.
+ *
+ * @param vm the virtual machine whose stack is resized
+ * @param capacity the number of values the stack must hold
+ *
+ * The stack outlives any one interpretN() call, so it always comes from the
+ * system allocator rather than the VM's arena.
+ */
+static void resizeStack(VM* vm, int capacity) {
+    const Allocator* previous = setAllocator(NULL);
+    vm->stack = GROW_ARRAY(Value, vm->stack, vm->stackCapacity, capacity,
+                           MEMORY_STACK);
+    setAllocator(previous);
+    vm->stackCapacity = capacity;
+    resetStack(vm);
+}
 
+/**
+ * Frees a virtual machine's stack and its quickened copy of a program's code.
+ *
+ * @param vm the virtual machine to free
+ */
+void freeVM(VM* vm) {
+    resizeStack(vm, 0);
+    const Allocator* previous = setAllocator(NULL);
+    FREE_ARRAY(uint8_t, vm->quickenedCode, vm->quickenedCapacity,
+               MEMORY_CODE);
+    setAllocator(previous);
+    vm->quickenedCode = NULL;
+    vm->quickenedCapacity = 0;
+    vm->quickenedProgram = 0;
 }
 
 /**
  * Pushes a value onto the stack.
  *
+ * @param vm the virtual machine whose stack is pushed to
  * @param value the value to push
  *
  * This function increments the stack pointer after pushing the value.
  */
-void push(Value value) {
-    *vm.stackTop = value;
-    vm.stackTop++;
+void push(VM* vm, Value value) {
+    *vm->stackTop = value;
+    vm->stackTop++;
 }
 
 /**
  * Pops a value from the stack.
  *
+ * @param vm the virtual machine whose stack is popped from
  * @return the popped value
  *
  * This function decrements the stack pointer after popping the value.
  */
-Value pop() {
-    vm.stackTop--;
-    return *vm.stackTop;
+Value pop(VM* vm) {
+    vm->stackTop--;
+    return *vm->stackTop;
 }
 
 /**
@@ -70,12 +129,24 @@ Value pop() {
  * @return the value at the specified distance
  */
 
-static Value peek(int distance) {
-    return vm.stackTop[-1 - distance];
+static Value peek(VM* vm, int distance) {
+    return vm->stackTop[-1 - distance];
 }
 
-static bool isFalsey(Value value) {
-    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+/**
+ * Prints the current contents of the stack followed by the disassembly of the
+ * instruction about to be executed, to vm->out.
+ */
+static void traceExecution(VM* vm) {
+    fprintf(vm->out, "          ");
+    for (Value* slot = vm->stack; slot < vm->stackTop; slot++) {
+        fprintf(vm->out, "[ ");
+        fprintValue(vm->out, *slot);
+        fprintf(vm->out, " ]");
+    }
+    fprintf(vm->out, "\n");
+    fdisassembleInstruction(vm->out, vm->chunk,
+                            (int)(vm->ip - vm->chunk->code));
 }
 
 /**
@@ -83,103 +154,857 @@ static bool isFalsey(Value value) {
  * reading and interpreting each instruction pointed to by the VM's instruction
  * pointer. Uses macros to read the next byte instruction and retrieve constant
  * values. The execution continues indefinitely until an OP_RETURN instruction is
- * encountered, at which point the function returns with an INTERPRET_OK result.
- * In debug mode, disassembles and prints each instruction for tracing purposes.
+ * encountered, at which point the function stores the value it returns and
+ * returns with an INTERPRET_OK result.
+ * When vm->trace is set, disassembles and prints each instruction first.
+ *
+ * When COMPUTED_GOTO is defined, every handler jumps straight to the next one
+ * through a table of label addresses indexed by OpCode, which gives each
+ * instruction its own indirect branch. Otherwise a plain switch is used.
  *
+ * With computed gotos, tracing swaps in a second table whose every entry
+ * leads to the trace, so the handlers themselves never test for it. When
+ * vm->profile is set, a third table does the same for the profiler.
+ *
+ * With quicken set, a generic arithmetic or comparison operator that has run
+ * on numbers rewrites itself into its number-specialized form, which skips
+ * the separate type checks and the stack pointer traffic of peek, pop and
+ * push. The specialized form still checks its operands once, and turns back
+ * into the generic operator if they are not numbers.
+ *
+ * @param vm the virtual machine, with its chunk and ip set
+ * @param result where the value of the chunk is stored on success
+ * @param quicken whether the chunk may be rewritten while it runs
  * @return INTERPRET_OK upon successful execution of bytecode instructions.
  */
-static InterpretResult run() {
-#define READ_BYTE() (*vm.ip++) // Gets next instruction and updates IP to the one after it
+static InterpretResult run(VM* vm, Value* result, bool quicken) {
+#define READ_BYTE() (*vm->ip++) // Gets next instruction and updates IP to the one after it
 #define READ_CONSTANT()                                   \
-    (vm.chunk->constants.values[READ_BYTE()])
+    (vm->chunk->constants.values[READ_BYTE()])
+#define READ_CONSTANT_LONG()                              \
+    (vm->ip += 3,                                          \
+     vm->chunk->constants.values[vm->ip[-3] |               \
+                                (vm->ip[-2] << 8) |        \
+                                (vm->ip[-1] << 16)])
 #define BINARY_OP(valueType, op)                                     \
     do {                                                  \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtimeError("Operands must be numbers.");    \
+        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
+            runtimeError(vm, "Operands must be numbers.");    \
             return INTERPRET_RUNTIME_ERROR;               \
         }                                                 \
-        double b = AS_NUMBER(pop());                      \
-        double a = AS_NUMBER(pop());                      \
-        push(valueType(a op b));                          \
+        double b = AS_NUMBER(pop(vm));                      \
+        double a = AS_NUMBER(pop(vm));                      \
+        push(vm, valueType(a op b));                          \
     } while (false)
+#define NEGATED_BINARY_OP(op)                             \
+    do {                                                  \
+        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
+            runtimeError(vm, "Operands must be numbers.");    \
+            return INTERPRET_RUNTIME_ERROR;               \
+        }                                                 \
+        double b = AS_NUMBER(pop(vm));                      \
+        double a = AS_NUMBER(pop(vm));                      \
+        push(vm, BOOL_VAL(!(a op b)));                        \
+    } while (false)
+#define CONSTANT_BINARY_OP(valueType, op)                 \
+    do {                                                  \
+        Value constant = READ_CONSTANT();                 \
+        if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(constant)) {\
+            runtimeError(vm, "Operands must be numbers.");    \
+            return INTERPRET_RUNTIME_ERROR;               \
+        }                                                 \
+        double a = AS_NUMBER(pop(vm));                      \
+        push(vm, valueType(a op AS_NUMBER(constant)));        \
+    } while (false)
+#define SMALL_INT_BINARY_OP(valueType, op)                \
+    do {                                                  \
+        double b = (int8_t)READ_BYTE();                   \
+        if (!IS_NUMBER(peek(vm, 0))) {                    \
+            runtimeError(vm, "Operands must be numbers.");    \
+            return INTERPRET_RUNTIME_ERROR;               \
+        }                                                 \
+        Value* operand = vm->stackTop - 1;                \
+        *operand = valueType(AS_NUMBER(*operand) op b);   \
+    } while (false)
+#define NUMBER_OP(generic, valueType, expression)         \
+    do {                                                  \
+        Value* operands = vm->stackTop - 2;               \
+        if (!IS_NUMBER(operands[0]) || !IS_NUMBER(operands[1])) { \
+            if (quicken) vm->ip[-1] = generic;            \
+            runtimeError(vm, "Operands must be numbers.");    \
+            return INTERPRET_RUNTIME_ERROR;               \
+        }                                                 \
+        double a = AS_NUMBER(operands[0]);                \
+        double b = AS_NUMBER(operands[1]);                \
+        operands[0] = valueType(expression);              \
+        vm->stackTop--;                                   \
+    } while (false)
+#define QUICKEN(specialized)                              \
+    do {                                                  \
+        if (quicken) vm->ip[-1] = specialized;            \
+    } while (false)
+
+#ifdef COMPUTED_GOTO
+    static void* dispatchTable[] = {
+        [OP_CONSTANT] = &&label_OP_CONSTANT,
+        [OP_CONSTANT_LONG] = &&label_OP_CONSTANT_LONG,
+        [OP_NIL]      = &&label_OP_NIL,
+        [OP_TRUE]     = &&label_OP_TRUE,
+        [OP_FALSE]    = &&label_OP_FALSE,
+        [OP_ZERO]     = &&label_OP_ZERO,
+        [OP_ONE]      = &&label_OP_ONE,
+        [OP_SMALL_INT] = &&label_OP_SMALL_INT,
+        [OP_INPUT]    = &&label_OP_INPUT,
+        [OP_EQUAL]    = &&label_OP_EQUAL,
+        [OP_GREATER]  = &&label_OP_GREATER,
+        [OP_LESS]     = &&label_OP_LESS,
+        [OP_NOT_EQUAL]     = &&label_OP_NOT_EQUAL,
+        [OP_GREATER_EQUAL] = &&label_OP_GREATER_EQUAL,
+        [OP_LESS_EQUAL]    = &&label_OP_LESS_EQUAL,
+        [OP_ADD]      = &&label_OP_ADD,
+        [OP_SUBTRACT] = &&label_OP_SUBTRACT,
+        [OP_MULTIPLY] = &&label_OP_MULTIPLY,
+        [OP_DIVIDE]   = &&label_OP_DIVIDE,
+        [OP_NOT]      = &&label_OP_NOT,
+        [OP_NEGATE]   = &&label_OP_NEGATE,
+        [OP_ADD_CONSTANT]      = &&label_OP_ADD_CONSTANT,
+        [OP_SUBTRACT_CONSTANT] = &&label_OP_SUBTRACT_CONSTANT,
+        [OP_MULTIPLY_CONSTANT] = &&label_OP_MULTIPLY_CONSTANT,
+        [OP_DIVIDE_CONSTANT]   = &&label_OP_DIVIDE_CONSTANT,
+        [OP_GREATER_CONSTANT]  = &&label_OP_GREATER_CONSTANT,
+        [OP_LESS_CONSTANT]     = &&label_OP_LESS_CONSTANT,
+        [OP_ADD_SMALL_INT]      = &&label_OP_ADD_SMALL_INT,
+        [OP_SUBTRACT_SMALL_INT] = &&label_OP_SUBTRACT_SMALL_INT,
+        [OP_MULTIPLY_SMALL_INT] = &&label_OP_MULTIPLY_SMALL_INT,
+        [OP_DIVIDE_SMALL_INT]   = &&label_OP_DIVIDE_SMALL_INT,
+        [OP_GREATER_SMALL_INT]  = &&label_OP_GREATER_SMALL_INT,
+        [OP_LESS_SMALL_INT]     = &&label_OP_LESS_SMALL_INT,
+        [OP_ADD_NUMBER]           = &&label_OP_ADD_NUMBER,
+        [OP_SUBTRACT_NUMBER]      = &&label_OP_SUBTRACT_NUMBER,
+        [OP_MULTIPLY_NUMBER]      = &&label_OP_MULTIPLY_NUMBER,
+        [OP_DIVIDE_NUMBER]        = &&label_OP_DIVIDE_NUMBER,
+        [OP_GREATER_NUMBER]       = &&label_OP_GREATER_NUMBER,
+        [OP_LESS_NUMBER]          = &&label_OP_LESS_NUMBER,
+        [OP_GREATER_EQUAL_NUMBER] = &&label_OP_GREATER_EQUAL_NUMBER,
+        [OP_LESS_EQUAL_NUMBER]    = &&label_OP_LESS_EQUAL_NUMBER,
+        [OP_RETURN]   = &&label_OP_RETURN,
+    };
+    static void* tracingTable[] = {
+        [0 ... OP_RETURN] = &&label_trace,
+    };
+    static void* profilingTable[] = {
+        [0 ... OP_RETURN] = &&label_profile,
+    };
+    void** table = vm->profile != NULL ? profilingTable
+                 : vm->trace ? tracingTable
+                 : dispatchTable;
+
+#define DISPATCH() goto *table[READ_BYTE()]
+#define CASE(opcode) label_##opcode:
+#define NEXT() DISPATCH()
 
+    DISPATCH();
+
+label_profile:
+    vm->ip--;
+    profileInstruction(vm->profile, (int)(vm->ip - vm->chunk->code));
+    if (vm->trace) traceExecution(vm);
+    goto *dispatchTable[READ_BYTE()];
+
+label_trace:
+    vm->ip--;
+    traceExecution(vm);
+    goto *dispatchTable[READ_BYTE()];
+#else
+#define CASE(opcode) case opcode:
+#define NEXT() break
+
+    bool trace = vm->trace;
+    Profile* profile = vm->profile;
     for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-        printf("          ");
-        for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-            printf("[ ");
-            printValue(*slot);
-            printf(" ]");
+        if (profile != NULL) {
+            profileInstruction(profile, (int)(vm->ip - vm->chunk->code));
         }
-        printf("\n");
-        disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
+        if (trace) traceExecution(vm);
+        switch (READ_BYTE()) {
 #endif
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
-            case OP_CONSTANT: {
+            CASE(OP_CONSTANT) {
                 Value constant = READ_CONSTANT();
-                push(constant);
-                break;
-            }
-            case OP_NIL:      push(NIL_VAL); break;
-            case OP_TRUE:     push(BOOL_VAL(true)); break;
-            case OP_FALSE:    push(BOOL_VAL(false)); break;
-            case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
-                break;
-            }
-            case OP_GREATER:  BINARY_OP(BOOL_VAL, >); break;
-            case OP_LESS:     BINARY_OP(BOOL_VAL, <); break;
-            case OP_ADD:      BINARY_OP(NUMBER_VAL, +); break;
-            case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
-            case OP_NOT:
-                push(BOOL_VAL(isFalsey(pop())));
-                break;
-            case OP_NEGATE:
-                if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
+                push(vm, constant);
+                NEXT();
+            }
+            CASE(OP_CONSTANT_LONG) {
+                Value constant = READ_CONSTANT_LONG();
+                push(vm, constant);
+                NEXT();
+            }
+            CASE(OP_NIL)      push(vm, NIL_VAL); NEXT();
+            CASE(OP_TRUE)     push(vm, BOOL_VAL(true)); NEXT();
+            CASE(OP_FALSE)    push(vm, BOOL_VAL(false)); NEXT();
+            CASE(OP_ZERO)     push(vm, NUMBER_VAL(0)); NEXT();
+            CASE(OP_ONE)      push(vm, NUMBER_VAL(1)); NEXT();
+            CASE(OP_SMALL_INT) push(vm, NUMBER_VAL((int8_t)READ_BYTE())); NEXT();
+            CASE(OP_INPUT) {
+                uint8_t input = READ_BYTE();
+                if (input >= vm->inputCount) {
+                    runtimeError(vm, "Input $%d was not given.", input);
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
-                break;
-            case OP_RETURN: {
-                printValue(pop());
-                printf("\n");
+                push(vm, vm->inputs[input]);
+                NEXT();
+            }
+            CASE(OP_EQUAL) {
+                Value b = pop(vm);
+                Value a = pop(vm);
+                push(vm, BOOL_VAL(valuesEqual(a, b)));
+                NEXT();
+            }
+            CASE(OP_GREATER) {
+                BINARY_OP(BOOL_VAL, >);
+                QUICKEN(OP_GREATER_NUMBER);
+                NEXT();
+            }
+            CASE(OP_LESS) {
+                BINARY_OP(BOOL_VAL, <);
+                QUICKEN(OP_LESS_NUMBER);
+                NEXT();
+            }
+            CASE(OP_NOT_EQUAL) {
+                Value b = pop(vm);
+                Value a = pop(vm);
+                push(vm, BOOL_VAL(!valuesEqual(a, b)));
+                NEXT();
+            }
+            // These are the negations of < and >, so NaN operands behave
+            // exactly as they did when the compiler emitted an OP_NOT.
+            CASE(OP_GREATER_EQUAL) {
+                NEGATED_BINARY_OP(<);
+                QUICKEN(OP_GREATER_EQUAL_NUMBER);
+                NEXT();
+            }
+            CASE(OP_LESS_EQUAL) {
+                NEGATED_BINARY_OP(>);
+                QUICKEN(OP_LESS_EQUAL_NUMBER);
+                NEXT();
+            }
+            CASE(OP_ADD) {
+                BINARY_OP(NUMBER_VAL, +);
+                QUICKEN(OP_ADD_NUMBER);
+                NEXT();
+            }
+            CASE(OP_SUBTRACT) {
+                BINARY_OP(NUMBER_VAL, -);
+                QUICKEN(OP_SUBTRACT_NUMBER);
+                NEXT();
+            }
+            CASE(OP_MULTIPLY) {
+                BINARY_OP(NUMBER_VAL, *);
+                QUICKEN(OP_MULTIPLY_NUMBER);
+                NEXT();
+            }
+            CASE(OP_DIVIDE) {
+                BINARY_OP(NUMBER_VAL, /);
+                QUICKEN(OP_DIVIDE_NUMBER);
+                NEXT();
+            }
+            CASE(OP_NOT)
+                push(vm, BOOL_VAL(isFalsey(pop(vm))));
+                NEXT();
+            CASE(OP_NEGATE)
+                if (!IS_NUMBER(peek(vm, 0))) {
+                    runtimeError(vm, "Operand must be a number.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
+                NEXT();
+            CASE(OP_ADD_CONSTANT)      CONSTANT_BINARY_OP(NUMBER_VAL, +); NEXT();
+            CASE(OP_SUBTRACT_CONSTANT) CONSTANT_BINARY_OP(NUMBER_VAL, -); NEXT();
+            CASE(OP_MULTIPLY_CONSTANT) CONSTANT_BINARY_OP(NUMBER_VAL, *); NEXT();
+            CASE(OP_DIVIDE_CONSTANT)   CONSTANT_BINARY_OP(NUMBER_VAL, /); NEXT();
+            CASE(OP_GREATER_CONSTANT)  CONSTANT_BINARY_OP(BOOL_VAL, >); NEXT();
+            CASE(OP_LESS_CONSTANT)     CONSTANT_BINARY_OP(BOOL_VAL, <); NEXT();
+            CASE(OP_ADD_SMALL_INT)      SMALL_INT_BINARY_OP(NUMBER_VAL, +); NEXT();
+            CASE(OP_SUBTRACT_SMALL_INT) SMALL_INT_BINARY_OP(NUMBER_VAL, -); NEXT();
+            CASE(OP_MULTIPLY_SMALL_INT) SMALL_INT_BINARY_OP(NUMBER_VAL, *); NEXT();
+            CASE(OP_DIVIDE_SMALL_INT)   SMALL_INT_BINARY_OP(NUMBER_VAL, /); NEXT();
+            CASE(OP_GREATER_SMALL_INT)  SMALL_INT_BINARY_OP(BOOL_VAL, >); NEXT();
+            CASE(OP_LESS_SMALL_INT)     SMALL_INT_BINARY_OP(BOOL_VAL, <); NEXT();
+            CASE(OP_ADD_NUMBER)      NUMBER_OP(OP_ADD, NUMBER_VAL, a + b); NEXT();
+            CASE(OP_SUBTRACT_NUMBER) NUMBER_OP(OP_SUBTRACT, NUMBER_VAL, a - b); NEXT();
+            CASE(OP_MULTIPLY_NUMBER) NUMBER_OP(OP_MULTIPLY, NUMBER_VAL, a * b); NEXT();
+            CASE(OP_DIVIDE_NUMBER)   NUMBER_OP(OP_DIVIDE, NUMBER_VAL, a / b); NEXT();
+            CASE(OP_GREATER_NUMBER)  NUMBER_OP(OP_GREATER, BOOL_VAL, a > b); NEXT();
+            CASE(OP_LESS_NUMBER)     NUMBER_OP(OP_LESS, BOOL_VAL, a < b); NEXT();
+            CASE(OP_GREATER_EQUAL_NUMBER) NUMBER_OP(OP_GREATER_EQUAL, BOOL_VAL, !(a < b)); NEXT();
+            CASE(OP_LESS_EQUAL_NUMBER)    NUMBER_OP(OP_LESS_EQUAL, BOOL_VAL, !(a > b)); NEXT();
+            CASE(OP_RETURN) {
+                *result = pop(vm);
                 return INTERPRET_OK;
             }
+#ifndef COMPUTED_GOTO
         }
     }
+#endif
 
 #undef READ_BYTE
 #undef READ_CONSTANT
+#undef READ_CONSTANT_LONG
 #undef BINARY_OP
+#undef NEGATED_BINARY_OP
+#undef CONSTANT_BINARY_OP
+#undef SMALL_INT_BINARY_OP
+#undef NUMBER_OP
+#undef QUICKEN
+#undef DISPATCH
+#undef CASE
+#undef NEXT
+}
+
+/**
+ * Prints the registers of the frame followed by the disassembly of the
+ * register instruction about to be executed, to vm->out.
+ */
+static void traceRegisters(VM* vm) {
+    fprintf(vm->out, "          ");
+    for (int i = 0; i < vm->chunk->maxStack; i++) {
+        fprintf(vm->out, "[ ");
+        fprintValue(vm->out, vm->stack[i]);
+        fprintf(vm->out, " ]");
+    }
+    fprintf(vm->out, "\n");
+    fdisassembleRegisterInstruction(vm->out, vm->chunk,
+                                    (int)(vm->ip - vm->chunk->code));
 }
 
+/**
+ * Executes the register code of the current chunk, as produced by
+ * translateRegisters(). The VM's stack serves as the frame of registers.
+ *
+ * The handlers mirror those of run(), with operands read from registers and
+ * constants named by the instruction instead of popped off the stack. Tracing
+ * works the same way too.
+ *
+ * @param vm the virtual machine, with its chunk and ip set
+ * @param result where the value of the code is stored on success
+ * @return INTERPRET_OK upon successful execution of the register code
+ */
+static InterpretResult runRegisters(VM* vm, Value* result) {
+    Value* registers = vm->stack;
+
+#define READ_BYTE() (*vm->ip++)
+#define READ_OPERAND() (vm->ip += 2, (uint16_t)(vm->ip[-2] | (vm->ip[-1] << 8)))
+#define READ_REGISTER() (registers[READ_OPERAND()])
+#define READ_CONSTANT() (vm->chunk->constants.values[READ_OPERAND()])
+#define REGISTER_BINARY_OP(valueType, op, readLeft, readRight)          \
+    do {                                                                \
+        Value* dst = &READ_REGISTER();                                  \
+        Value a = readLeft();                                           \
+        Value b = readRight();                                          \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) {                           \
+            runtimeError(vm, "Operands must be numbers.");              \
+            return INTERPRET_RUNTIME_ERROR;                             \
+        }                                                               \
+        *dst = valueType(AS_NUMBER(a) op AS_NUMBER(b));                 \
+    } while (false)
+#define REGISTER_NEGATED_OP(op, readLeft, readRight)                    \
+    do {                                                                \
+        Value* dst = &READ_REGISTER();                                  \
+        Value a = readLeft();                                           \
+        Value b = readRight();                                          \
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) {                           \
+            runtimeError(vm, "Operands must be numbers.");              \
+            return INTERPRET_RUNTIME_ERROR;                             \
+        }                                                               \
+        *dst = BOOL_VAL(!(AS_NUMBER(a) op AS_NUMBER(b)));               \
+    } while (false)
+#define REGISTER_EQUALITY_OP(negate, readRight)                         \
+    do {                                                                \
+        Value* dst = &READ_REGISTER();                                  \
+        Value a = READ_REGISTER();                                      \
+        Value b = readRight();                                          \
+        *dst = BOOL_VAL(valuesEqual(a, b) != (negate));                 \
+    } while (false)
+
+    // Registers are only written before they are read, but the trace prints
+    // all of them
+    if (vm->trace) {
+        for (int i = 0; i < vm->chunk->maxStack; i++) registers[i] = NIL_VAL;
+    }
+
+#ifdef COMPUTED_GOTO
+    static void* dispatchTable[] = {
+        [REG_LOAD]             = &&label_REG_LOAD,
+        [REG_INPUT]            = &&label_REG_INPUT,
+        [REG_EQUAL_RR]         = &&label_REG_EQUAL_RR,
+        [REG_EQUAL_RK]         = &&label_REG_EQUAL_RK,
+        [REG_NOT_EQUAL_RR]     = &&label_REG_NOT_EQUAL_RR,
+        [REG_NOT_EQUAL_RK]     = &&label_REG_NOT_EQUAL_RK,
+        [REG_GREATER_RR]       = &&label_REG_GREATER_RR,
+        [REG_GREATER_RK]       = &&label_REG_GREATER_RK,
+        [REG_LESS_RR]          = &&label_REG_LESS_RR,
+        [REG_LESS_RK]          = &&label_REG_LESS_RK,
+        [REG_GREATER_EQUAL_RR] = &&label_REG_GREATER_EQUAL_RR,
+        [REG_GREATER_EQUAL_RK] = &&label_REG_GREATER_EQUAL_RK,
+        [REG_LESS_EQUAL_RR]    = &&label_REG_LESS_EQUAL_RR,
+        [REG_LESS_EQUAL_RK]    = &&label_REG_LESS_EQUAL_RK,
+        [REG_ADD_RR]           = &&label_REG_ADD_RR,
+        [REG_ADD_RK]           = &&label_REG_ADD_RK,
+        [REG_SUBTRACT_RR]      = &&label_REG_SUBTRACT_RR,
+        [REG_SUBTRACT_RK]      = &&label_REG_SUBTRACT_RK,
+        [REG_SUBTRACT_KR]      = &&label_REG_SUBTRACT_KR,
+        [REG_MULTIPLY_RR]      = &&label_REG_MULTIPLY_RR,
+        [REG_MULTIPLY_RK]      = &&label_REG_MULTIPLY_RK,
+        [REG_DIVIDE_RR]        = &&label_REG_DIVIDE_RR,
+        [REG_DIVIDE_RK]        = &&label_REG_DIVIDE_RK,
+        [REG_DIVIDE_KR]        = &&label_REG_DIVIDE_KR,
+        [REG_NOT]              = &&label_REG_NOT,
+        [REG_NEGATE]           = &&label_REG_NEGATE,
+        [REG_RETURN]           = &&label_REG_RETURN,
+        [REG_RETURN_CONSTANT]  = &&label_REG_RETURN_CONSTANT,
+    };
+    static void* tracingTable[] = {
+        [0 ... REG_RETURN_CONSTANT] = &&label_trace,
+    };
+    void** table = vm->trace ? tracingTable : dispatchTable;
+
+#define DISPATCH() goto *table[READ_BYTE()]
+#define CASE(opcode) label_##opcode:
+#define NEXT() DISPATCH()
+
+    DISPATCH();
+
+label_trace:
+    vm->ip--;
+    traceRegisters(vm);
+    goto *dispatchTable[READ_BYTE()];
+#else
+#define CASE(opcode) case opcode:
+#define NEXT() break
+
+    bool trace = vm->trace;
+    for (;;) {
+        if (trace) traceRegisters(vm);
+        switch (READ_BYTE()) {
+#endif
+            CASE(REG_LOAD) {
+                Value* dst = &READ_REGISTER();
+                *dst = READ_CONSTANT();
+                NEXT();
+            }
+            CASE(REG_INPUT) {
+                Value* dst = &READ_REGISTER();
+                uint16_t input = READ_OPERAND();
+                if (input >= vm->inputCount) {
+                    runtimeError(vm, "Input $%d was not given.", input);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                *dst = vm->inputs[input];
+                NEXT();
+            }
+            CASE(REG_EQUAL_RR)     REGISTER_EQUALITY_OP(false, READ_REGISTER); NEXT();
+            CASE(REG_EQUAL_RK)     REGISTER_EQUALITY_OP(false, READ_CONSTANT); NEXT();
+            CASE(REG_NOT_EQUAL_RR) REGISTER_EQUALITY_OP(true, READ_REGISTER); NEXT();
+            CASE(REG_NOT_EQUAL_RK) REGISTER_EQUALITY_OP(true, READ_CONSTANT); NEXT();
+            CASE(REG_GREATER_RR)   REGISTER_BINARY_OP(BOOL_VAL, >, READ_REGISTER, READ_REGISTER); NEXT();
+            CASE(REG_GREATER_RK)   REGISTER_BINARY_OP(BOOL_VAL, >, READ_REGISTER, READ_CONSTANT); NEXT();
+            CASE(REG_LESS_RR)      REGISTER_BINARY_OP(BOOL_VAL, <, READ_REGISTER, READ_REGISTER); NEXT();
+            CASE(REG_LESS_RK)      REGISTER_BINARY_OP(BOOL_VAL, <, READ_REGISTER, READ_CONSTANT); NEXT();
+            // The negations of < and >, as in run()
+            CASE(REG_GREATER_EQUAL_RR) REGISTER_NEGATED_OP(<, READ_REGISTER, READ_REGISTER); NEXT();
+            CASE(REG_GREATER_EQUAL_RK) REGISTER_NEGATED_OP(<, READ_REGISTER, READ_CONSTANT); NEXT();
+            CASE(REG_LESS_EQUAL_RR)    REGISTER_NEGATED_OP(>, READ_REGISTER, READ_REGISTER); NEXT();
+            CASE(REG_LESS_EQUAL_RK)    REGISTER_NEGATED_OP(>, READ_REGISTER, READ_CONSTANT); NEXT();
+            CASE(REG_ADD_RR)       REGISTER_BINARY_OP(NUMBER_VAL, +, READ_REGISTER, READ_REGISTER); NEXT();
+            CASE(REG_ADD_RK)       REGISTER_BINARY_OP(NUMBER_VAL, +, READ_REGISTER, READ_CONSTANT); NEXT();
+            CASE(REG_SUBTRACT_RR)  REGISTER_BINARY_OP(NUMBER_VAL, -, READ_REGISTER, READ_REGISTER); NEXT();
+            CASE(REG_SUBTRACT_RK)  REGISTER_BINARY_OP(NUMBER_VAL, -, READ_REGISTER, READ_CONSTANT); NEXT();
+            CASE(REG_SUBTRACT_KR)  REGISTER_BINARY_OP(NUMBER_VAL, -, READ_CONSTANT, READ_REGISTER); NEXT();
+            CASE(REG_MULTIPLY_RR)  REGISTER_BINARY_OP(NUMBER_VAL, *, READ_REGISTER, READ_REGISTER); NEXT();
+            CASE(REG_MULTIPLY_RK)  REGISTER_BINARY_OP(NUMBER_VAL, *, READ_REGISTER, READ_CONSTANT); NEXT();
+            CASE(REG_DIVIDE_RR)    REGISTER_BINARY_OP(NUMBER_VAL, /, READ_REGISTER, READ_REGISTER); NEXT();
+            CASE(REG_DIVIDE_RK)    REGISTER_BINARY_OP(NUMBER_VAL, /, READ_REGISTER, READ_CONSTANT); NEXT();
+            CASE(REG_DIVIDE_KR)    REGISTER_BINARY_OP(NUMBER_VAL, /, READ_CONSTANT, READ_REGISTER); NEXT();
+            CASE(REG_NOT) {
+                Value* dst = &READ_REGISTER();
+                *dst = BOOL_VAL(isFalsey(READ_REGISTER()));
+                NEXT();
+            }
+            CASE(REG_NEGATE) {
+                Value* dst = &READ_REGISTER();
+                Value operand = READ_REGISTER();
+                if (!IS_NUMBER(operand)) {
+                    runtimeError(vm, "Operand must be a number.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                *dst = NUMBER_VAL(-AS_NUMBER(operand));
+                NEXT();
+            }
+            CASE(REG_RETURN) {
+                *result = READ_REGISTER();
+                return INTERPRET_OK;
+            }
+            CASE(REG_RETURN_CONSTANT) {
+                *result = READ_CONSTANT();
+                return INTERPRET_OK;
+            }
+#ifndef COMPUTED_GOTO
+        }
+    }
+#endif
+
+#undef READ_BYTE
+#undef READ_OPERAND
+#undef READ_REGISTER
+#undef READ_CONSTANT
+#undef REGISTER_BINARY_OP
+#undef REGISTER_NEGATED_OP
+#undef REGISTER_EQUALITY_OP
+#undef DISPATCH
+#undef CASE
+#undef NEXT
+}
+
+/**
+ * Makes sure the stack can hold everything a chunk pushes, so push() and pop()
+ * never need to check its bounds.
+ *
+ * @param vm the virtual machine about to run the chunk
+ * @param chunk the chunk, with its maxStack measured
+ * @return false, after reporting a stack overflow, if the chunk needs more
+ *         than STACK_MAX values
+ */
+static bool reserveStack(VM* vm, Chunk* chunk) {
+    if (chunk->maxStack > STACK_MAX) {
+        fprintf(vm->err, "Stack overflow: the expression needs %d stack "
+                "slots but at most %d are allowed.\n", chunk->maxStack,
+                STACK_MAX);
+        return false;
+    }
+    if (chunk->maxStack > vm->stackCapacity) {
+        resizeStack(vm, chunk->maxStack);
+    }
+    return true;
+}
+
+/**
+ * Runs register code produced by translateRegisters() from its first
+ * instruction, after growing the stack to hold its registers.
+ *
+ * @param vm the virtual machine to run the code on
+ * @param registers the register code to run
+ * @param result where the value of the code is stored on success
+ * @return the result of running the code
+ */
+static InterpretResult executeRegisters(VM* vm, Chunk* registers,
+                                        Value* result) {
+    if (!reserveStack(vm, registers)) return INTERPRET_RUNTIME_ERROR;
+
+    vm->chunk = registers;
+    vm->ip = registers->code;
+    return runRegisters(vm, result);
+}
+
+/**
+ * Runs stack code from its first instruction, after growing the stack to the
+ * chunk's maxStack, and records the run if the VM has a profile.
+ *
+ * @param vm the virtual machine to run the chunk on
+ * @param chunk the chunk to run
+ * @param result where the value of the chunk is stored on success
+ * @param quicken whether run() may specialize the chunk's instructions in
+ *        place; only for chunks nothing else is reading at the same time
+ * @return the result of running the chunk
+ */
+static InterpretResult executeChunk(VM* vm, Chunk* chunk, Value* result,
+                                    bool quicken) {
+    if (!reserveStack(vm, chunk)) return INTERPRET_RUNTIME_ERROR;
+
+    vm->chunk = chunk;
+    vm->ip = vm->chunk->code;
+    if (vm->profile == NULL) return run(vm, result, quicken);
+
+    beginProfile(vm->profile, chunk);
+    InterpretResult status = run(vm, result, quicken);
+    endProfile(vm->profile, chunk);
+    return status;
+}
+
+/**
+ * Tells whether stack code run on a VM may be replaced by native code.
+ *
+ * @param vm the virtual machine
+ * @return true for BACKEND_JIT, unless the VM traces or profiles, which only
+ *         the interpreter can do
+ */
+static bool jitEnabled(VM* vm) {
+    return vm->backend == BACKEND_JIT && !vm->trace && vm->profile == NULL;
+}
+
+/**
+ * Runs a chunk as native code, and interprets it instead if the code bails
+ * out. Since running a chunk has no side effects, the interpreter simply
+ * starts over from the first instruction.
+ *
+ * @param vm the virtual machine to run the chunk on
+ * @param jit the chunk compiled by compileJit(), which must hold code
+ * @param chunk the chunk it was compiled from
+ * @param result where the value of the chunk is stored on success
+ * @return the result of running the chunk
+ */
+static InterpretResult executeJit(VM* vm, const JitCode* jit, Chunk* chunk,
+                                  Value* result) {
+    if (!reserveStack(vm, chunk)) return INTERPRET_RUNTIME_ERROR;
+    if (runJit(jit, vm->stack, vm->inputs, vm->inputCount, result)) {
+        return INTERPRET_OK;
+    }
+    return executeChunk(vm, chunk, result, false);
+}
+
+/**
+ * Prints the value a chunk returned, if it ran successfully.
+ *
+ * The chunk must be run before the call rather than in its arguments: C
+ * leaves the order arguments are evaluated in unspecified, and value may be
+ * read before the run has stored it.
+ *
+ * @param vm the virtual machine that ran the chunk
+ * @param status the result of running it
+ * @param value the value it returned
+ * @return status, unchanged
+ */
+static InterpretResult printResult(VM* vm, InterpretResult status,
+                                   Value value) {
+    if (status == INTERPRET_OK) {
+        fprintValue(vm->out, value);
+        fputc('\n', vm->out);
+    }
+    return status;
+}
+
+/**
+ * Runs register code produced by translateRegisters() from its first
+ * instruction.
+ *
+ * @param vm the virtual machine to run the code on
+ * @param registers the register code to run; it is not freed
+ * @return the result of running the code
+ *
+ * This lets register code be translated once and run many times.
+ */
+InterpretResult interpretRegisters(VM* vm, Chunk* registers) {
+    Value value;
+    InterpretResult status = executeRegisters(vm, registers, &value);
+    return printResult(vm, status, value);
+}
+
+/**
+ * Runs an already compiled chunk from its first instruction.
+ *
+ * @param vm the virtual machine to run the chunk on
+ * @param chunk the chunk to run; it is not freed
+ * @return the result of running the chunk
+ *
+ * The stack is grown up front to the chunk's maxStack. A chunk that needs
+ * more than STACK_MAX values is not run at all.
+ *
+ * With BACKEND_REGISTER the chunk is translated to register code first, and
+ * it falls back to the stack code if it cannot be translated. With
+ * BACKEND_JIT it is compiled to native code, which is freed again once it has
+ * run, and it is interpreted if it cannot be compiled. Only stack code is
+ * profiled. The chunk is never quickened, since it runs once and has no
+ * jumps, so no instruction it rewrote would ever run again; evaluate() is the
+ * path that quickens.
+ */
+InterpretResult interpretChunk(VM* vm, Chunk* chunk) {
+    Value value;
+    if (jitEnabled(vm)) {
+        JitCode jit;
+        if (compileJit(&jit, chunk)) {
+            InterpretResult status = executeJit(vm, &jit, chunk, &value);
+            freeJit(&jit);
+            return printResult(vm, status, value);
+        }
+    }
+    if (vm->backend == BACKEND_REGISTER) {
+        Chunk registers;
+        initChunk(&registers);
+        if (translateRegisters(chunk, &registers)) {
+#ifdef DEBUG_PRINT_CODE
+            disassembleRegisterChunk(&registers, "registers");
+#endif
+            InterpretResult status = executeRegisters(vm, &registers, &value);
+            vm->chunk = chunk;
+            freeChunk(&registers);
+            return printResult(vm, status, value);
+        }
+        freeChunk(&registers);
+    }
+
+    InterpretResult status = executeChunk(vm, chunk, &value, false);
+    return printResult(vm, status, value);
+}
+
+// The id the next program made by compileProgram() gets; 0 is never used
+static atomic_uint_fast64_t nextProgramId = 1;
+
+/**
+ * Compiles source code into a program that can be evaluated any number of
+ * times.
+ *
+ * @param program the program to compile into
+ * @param source the source code, which does not need to be null-terminated
+ * @param length the length of the source code in bytes
+ * @param errors where compile errors are reported
+ * @return false if the source had compile errors, in which case the program
+ *         is left empty and need not be freed
+ *
+ * The register translation and the native code are made here too, so
+ * evaluating on any backend never has to compile or translate anything. The
+ * native code counts against the limit set by setJitLimit() for as long as
+ * the program lives.
+ */
+bool compileProgram(Program* program, const char* source, size_t length,
+                    FILE* errors) {
+    initChunk(&program->chunk);
+    initChunk(&program->registers);
+    initJit(&program->jit);
+
+    if (!compile(source, length, &program->chunk, errors)) {
+        freeChunk(&program->chunk);
+        return false;
+    }
+    if (!translateRegisters(&program->chunk, &program->registers)) {
+        freeChunk(&program->registers);
+    }
+    compileJit(&program->jit, &program->chunk);
+    program->id = atomic_fetch_add_explicit(&nextProgramId, 1,
+                                            memory_order_relaxed);
+    return true;
+}
+
+/**
+ * Frees a program made by compileProgram().
+ *
+ * @param program the program to free
+ */
+void freeProgram(Program* program) {
+    freeChunk(&program->chunk);
+    freeChunk(&program->registers);
+    freeJit(&program->jit);
+}
+
+/**
+ * Finds the code a VM runs a program's stack code from, copying the
+ * program's code into the VM unless it already holds it.
+ *
+ * Only the code is copied. run() can quicken it in place, and the quickened
+ * instructions carry over to the next row as long as the VM keeps evaluating
+ * the same program.
+ *
+ * @param vm the virtual machine about to run the program
+ * @param program the program, which must have an id
+ * @return the VM's copy of the program's code
+ */
+static uint8_t* quickenedCode(VM* vm, const Program* program) {
+    if (vm->quickenedProgram == program->id) return vm->quickenedCode;
+
+    const Chunk* chunk = &program->chunk;
+    if (vm->quickenedCapacity < chunk->count) {
+        // Like the stack, the copy outlives any one interpretN() call
+        const Allocator* previous = setAllocator(NULL);
+        vm->quickenedCode = GROW_ARRAY(uint8_t, vm->quickenedCode,
+                                       vm->quickenedCapacity, chunk->count,
+                                       MEMORY_CODE);
+        setAllocator(previous);
+        vm->quickenedCapacity = chunk->count;
+    }
+    memcpy(vm->quickenedCode, chunk->code, (size_t)chunk->count);
+    vm->quickenedProgram = program->id;
+    return vm->quickenedCode;
+}
+
+/**
+ * Evaluates a compiled program and hands back its value instead of printing
+ * it.
+ *
+ * @param vm the virtual machine to run the program on
+ * @param program the program to evaluate; it is never modified, so one
+ *        program can be evaluated on several VMs at once
+ * @param inputs the values $0, $1, ... load
+ * @param inputCount the number of inputs
+ * @param result where the value of the program is stored on success
+ * @return the result of running the program; runtime errors are reported to
+ *         vm->err as usual and leave result untouched
+ *
+ * Stack code runs from the VM's own copy of the program's code, which is
+ * quickened as it runs, so evaluating the same program row after row soon
+ * runs number-specialized instructions wherever the inputs were numbers.
+ * A program without an id runs as it is.
+ */
+InterpretResult evaluate(VM* vm, const Program* program, const Value* inputs,
+                         int inputCount, Value* result) {
+    // Running reads the chunks but never writes them
+    Program* code = (Program*)program;
+    vm->inputs = inputs;
+    vm->inputCount = inputCount;
+    if (vm->backend == BACKEND_REGISTER && code->registers.count > 0) {
+        return executeRegisters(vm, &code->registers, result);
+    }
+    if (jitEnabled(vm) && code->jit.code != NULL) {
+        return executeJit(vm, &code->jit, &code->chunk, result);
+    }
+    if (code->id == 0) return executeChunk(vm, &code->chunk, result, false);
+
+    // The program's chunk, running from the VM's copy of its code
+    Chunk chunk = code->chunk;
+    chunk.code = quickenedCode(vm, program);
+    InterpretResult status = executeChunk(vm, &chunk, result, true);
+    vm->chunk = &code->chunk;
+    return status;
+}
 
 /**
  * Interprets the given source code by compiling it and returning the result.
  *
- * @param source the source code to interpret
+ * @param vm the virtual machine to run the code on
+ * @param source the null-terminated source code to interpret
  * @return INTERPRET_OK upon successful compilation
  */
-InterpretResult interpret(const char* source) {
+InterpretResult interpret(VM* vm, const char* source) {
+    return interpretN(vm, source, strlen(source));
+}
+
+/**
+ * Interprets a source buffer of a known length, which does not need to be
+ * null-terminated.
+ *
+ * @param vm the virtual machine to run the code on
+ * @param source the source code to interpret
+ * @param length the length of the source code in bytes
+ * @return the result of compiling and running the source
+ *
+ * If the VM has an arena, everything allocated while compiling and running
+ * comes from it, and it is reset in one step before returning.
+ */
+InterpretResult interpretN(VM* vm, const char* source, size_t length) {
+    const Allocator* previous = NULL;
+    if (vm->arena != NULL) previous = setAllocator(&vm->arena->allocator);
+
     Chunk chunk;
     initChunk(&chunk);
 
-    if (!compile(source, &chunk)) {
-        freeChunk(&chunk);
-        return INTERPRET_COMPILE_ERROR;
+    InterpretResult result = INTERPRET_COMPILE_ERROR;
+    bool compiled = vm->scanAhead
+                        ? compileTokenized(source, length, &chunk, vm->err)
+                        : compile(source, length, &chunk, vm->err);
+    if (compiled) {
+        result = interpretChunk(vm, &chunk);
     }
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
-
-    InterpretResult result = run();
-
     freeChunk(&chunk);
+    if (vm->arena != NULL) {
+        setAllocator(previous);
+        resetArena(vm->arena);
+    }
     return result;
 }
\ No newline at end of file
@@ -2,27 +2,75 @@
 #define clox_vm_h
 
 #include "chunk.h"
+#include "jit.h"
+#include "memory.h"
+#include "profiler.h"
 #include "value.h"
 
-#define STACK_MAX 256
+// The most values the stack may grow to hold
+#define STACK_MAX (1 << 20)
+
+// Which instruction set compiled code is run as
+typedef enum {
+    BACKEND_STACK,    // The compiler's stack code, as is
+    BACKEND_REGISTER, // Translated to register code; see registers.h
+    BACKEND_JIT,      // Compiled to native code, with the stack code as the
+                      // fallback; see jit.h
+} Backend;
 
 typedef struct {
     Chunk* chunk;
     uint8_t* ip;
-    Value stack[STACK_MAX];
+    Value* stack; // Sized to the chunk being run; see interpretChunk()
+    int stackCapacity;
     Value* stackTop;
+    FILE* out; // Where results are printed; stdout by default
+    FILE* err; // Where compile and runtime errors go; stderr by default
+    Arena* arena; // Backs each interpretN() call when set; NULL by default
+    Backend backend; // BACKEND_STACK by default
+    bool trace; // Prints each instruction as it runs; off unless the build
+                // defines DEBUG_TRACE_EXECUTION
+    Profile* profile; // Records every run of stack code when set; NULL by
+                      // default
+    bool scanAhead; // Compiles each source with compileTokenized() rather
+                    // than compile(); off by default
+    const Value* inputs; // What $0, $1, ... load; set by evaluate()
+    int inputCount;
+    uint8_t* quickenedCode; // The code of the program evaluate() last ran as
+                            // stack code, copied so that run() can quicken it
+    int quickenedCapacity;
+    uint64_t quickenedProgram; // That program's id; 0 if there is none
 } VM;
 
+// Source compiled once, to be run by evaluate() any number of times
+typedef struct {
+    Chunk chunk;
+    Chunk registers; // The chunk translated to register code; empty if it
+                     // could not be translated
+    JitCode jit;     // The chunk compiled to native code; holds none if it
+                     // could not be compiled
+    uint64_t id;     // Unique to the program when made by compileProgram();
+                     // 0 for one built by hand, which is never quickened
+} Program;
+
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
     INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-void initVM();
-void freeVM();
-InterpretResult interpret(const char* source);
-void push(Value value);
-Value pop();
+void initVM(VM* vm);
+void freeVM(VM* vm);
+InterpretResult interpret(VM* vm, const char* source);
+InterpretResult interpretN(VM* vm, const char* source, size_t length);
+InterpretResult interpretChunk(VM* vm, Chunk* chunk);
+InterpretResult interpretRegisters(VM* vm, Chunk* registers);
+bool compileProgram(Program* program, const char* source, size_t length,
+                    FILE* errors);
+void freeProgram(Program* program);
+InterpretResult evaluate(VM* vm, const Program* program, const Value* inputs,
+                         int inputCount, Value* result);
+void push(VM* vm, Value value);
+Value pop(VM* vm);
 
 #endif
\ No newline at end of file